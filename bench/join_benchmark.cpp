@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <event_data.h>
+#include <monitor_types.h>
+#include <table.h>
+
+using common::event_data;
+using monitor::event;
+using monitor::event_table;
+
+// Table with columns (key, payload) where the keys are drawn from
+// [0, nkeys)
+static event_table make_table(size_t nrows, size_t nkeys, int64_t offset) {
+  event_table tab(2);
+  tab.reserve(nrows);
+  for (size_t i = 0; i < nrows; ++i)
+    tab.add_row(event{event_data::Int(static_cast<int64_t>(i % nkeys)),
+                      event_data::Int(offset + static_cast<int64_t>(i))});
+  return tab;
+}
+
+// Joins a table with range(0) rows on the left with a table with range(1) rows
+// on the right on a common key column
+static void BM_NaturalJoin(benchmark::State &state) {
+  auto n1 = static_cast<size_t>(state.range(0));
+  auto n2 = static_cast<size_t>(state.range(1));
+  size_t nkeys = std::max<size_t>(std::min(n1, n2), 1);
+  auto l = make_table(n1, nkeys, 0), r = make_table(n2, nkeys, 1 << 30);
+  auto info = get_join_info({0, 1}, {0, 2});
+  for (auto _ : state)
+    benchmark::DoNotOptimize(l.natural_join(r, info));
+}
+BENCHMARK(BM_NaturalJoin)
+  ->Args({4, 4})
+  ->Args({3, 300000})
+  ->Args({300000, 3})
+  ->Args({100, 300000})
+  ->Args({300000, 100})
+  ->Args({100000, 100000});
+
+static void BM_AntiJoin(benchmark::State &state) {
+  auto n1 = static_cast<size_t>(state.range(0));
+  auto n2 = static_cast<size_t>(state.range(1));
+  auto l = make_table(n1, n1, 0), r = make_table(n2, n2, 0);
+  auto info = get_anti_join_info({0, 1}, {0, 2});
+  for (auto _ : state)
+    benchmark::DoNotOptimize(l.anti_join(r, info));
+}
+BENCHMARK(BM_AntiJoin)
+  ->Args({4, 4})
+  ->Args({3, 300000})
+  ->Args({300000, 3})
+  ->Args({100000, 100000});
+
+// No common columns
+static void BM_CartesianJoin(benchmark::State &state) {
+  auto n1 = static_cast<size_t>(state.range(0));
+  auto n2 = static_cast<size_t>(state.range(1));
+  auto l = make_table(n1, n1, 0), r = make_table(n2, n2, 0);
+  auto info = get_join_info({0, 1}, {2, 3});
+  for (auto _ : state)
+    benchmark::DoNotOptimize(l.natural_join(r, info));
+}
+BENCHMARK(BM_CartesianJoin)->Args({2, 100000})->Args({300, 300});
+
+BENCHMARK_MAIN();
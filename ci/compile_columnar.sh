@@ -0,0 +1,5 @@
+#!/bin/bash
+export HOME=/root &&\
+conan install . -if builddir_columnar --build outdated -pr=ci/profile_ci &&\
+CC=clang CXX=clang++ cmake -G Ninja -DUSE_JEMALLOC=ON -DUSE_COLUMNAR_TABLES=ON -DCMAKE_BUILD_TYPE=Release -S . -B builddir_columnar &&\
+ninja -C builddir_columnar
@@ -48,6 +48,10 @@ aggregation_impl::aggregation_impl(const table_layout &phi_layout,
     state_ = grouped_state<avg_group>();
   else if (ty == fo::agg_type::MED)
     state_ = grouped_state<med_group>();
+  else if (ty == fo::agg_type::APPROX_DCNT)
+    state_ = grouped_state<approx_dcnt_group>();
+  else if (ty == fo::agg_type::APPROX_MED)
+    state_ = grouped_state<approx_med_group>();
   else
     throw std::runtime_error("unsupported operation");
 }
@@ -59,13 +63,13 @@ opt_table aggregation_impl::eval(opt_table &tab) {
   else if (tab) {
     assert(!tab->empty());
     for (const auto &e : *tab) {
-      auto group = filter_row(group_var_idxs_, e);
-      auto trm_var_val = e[term_var_idx_];
+      hashed_event group(filter_row(group_var_idxs_, e));
+      auto trm_var_val = (*e)[term_var_idx_];
       boost::variant2::visit(
         [&group, &trm_var_val](auto &&arg) {
           // fmt::print("group is: {}, trm_var_val is: {}\n", group,
           // trm_var_val);
-          arg.add_result(group, trm_var_val);
+          arg.add_result(std::move(group), trm_var_val);
         },
         state_);
     }
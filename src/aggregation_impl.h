@@ -7,6 +7,7 @@
 #include <fmt/core.h>
 #include <formula.h>
 #include <monitor_types.h>
+#include <sketches.h>
 #include <table.h>
 #include <utility>
 #include <vector>
@@ -17,10 +18,10 @@ class grouped_state {
 public:
   grouped_state() = default;
 
-  void add_result(const event &group, const common::event_data &val) {
-    auto it = groups_.template find(group);
+  void add_result(hashed_event group, const common::event_data &val) {
+    auto it = groups_.find(group);
     if (it == groups_.end()) {
-      groups_.emplace(group, GroupType(val));
+      groups_.emplace(std::move(group), GroupType(val));
     } else {
       it->second.add_event(val);
     }
@@ -32,7 +33,7 @@ public:
       auto result_value = group_state.finalize_group();
       event group_cp;
       group_cp.reserve(nfvs);
-      group_cp.insert(group_cp.end(), group.cbegin(), group.cend());
+      group_cp.insert(group_cp.end(), group->cbegin(), group->cend());
       group_cp.push_back(std::move(result_value));
       res.add_row(std::move(group_cp));
     }
@@ -42,7 +43,7 @@ public:
   }
 
 protected:
-  absl::flat_hash_map<event, GroupType> groups_;
+  common::hash_cached_map<event, GroupType> groups_;
 };
 
 class simple_combiner {
@@ -148,15 +149,19 @@ public:
     values_.emplace_back(val);
   }
 
+  // Selects the middle elements in linear time instead of sorting
   common::event_data finalize_group() {
-    std::sort(values_.begin(), values_.end(), common::compat_less());
     size_t n = values_.size();
+    auto mid = values_.begin() + static_cast<std::ptrdiff_t>(n / 2);
+    std::nth_element(values_.begin(), mid, values_.end(),
+                     common::compat_less());
     if (n % 2 == 0) {
-      double med =
-        (values_.at(n/2).to_double() + values_.at(n/2 - 1).to_double()) / 2.0;
+      auto lower =
+        std::max_element(values_.begin(), mid, common::compat_less());
+      double med = (mid->to_double() + lower->to_double()) / 2.0;
       return common::event_data::Float(med);
     } else {
-      return common::event_data::Float(values_.at(n/2).to_double());
+      return common::event_data::Float(mid->to_double());
     }
   }
 
@@ -164,6 +169,36 @@ protected:
   std::vector<common::event_data> values_;
 };
 
+class approx_dcnt_group {
+public:
+  approx_dcnt_group(const common::event_data &first_event) {
+    sketch_.add(first_event);
+  }
+
+  void add_event(const common::event_data &val) { sketch_.add(val); }
+
+  common::event_data finalize_group() const {
+    return common::event_data::Int(sketch_.estimate());
+  }
+
+protected:
+  sketch::distinct_count_sketch sketch_;
+};
+
+class approx_med_group {
+public:
+  approx_med_group(const common::event_data &first_event) {
+    sketch_.add(first_event);
+  }
+
+  void add_event(const common::event_data &val) { sketch_.add(val); }
+
+  common::event_data finalize_group() const { return sketch_.quantile(0.5); }
+
+protected:
+  sketch::quantile_sketch sketch_;
+};
+
 class aggregation_impl {
 public:
   aggregation_impl(const table_layout &phi_layout, const fo::Term &agg_term,
@@ -178,7 +213,9 @@ private:
                              grouped_state<avg_group>, grouped_state<max_group>,
                              grouped_state<min_group>,
                              grouped_state<sum_group>,
-                             grouped_state<med_group>>;
+                             grouped_state<med_group>,
+                             grouped_state<approx_dcnt_group>,
+                             grouped_state<approx_med_group>>;
   common::event_data default_val_;
   std::vector<size_t> group_var_idxs_;
   size_t nfvs_;
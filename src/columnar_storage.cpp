@@ -0,0 +1,398 @@
+#include <absl/hash/hash.h>
+#include <algorithm>
+#include <bit>
+#include <columnar_storage.h>
+#include <stdexcept>
+#include <symbol_table.h>
+#include <utility>
+
+namespace detail {
+
+columnar_storage::columnar_storage(const columnar_storage &other)
+    : ncols_(other.ncols_), nrows_(other.nrows_),
+      types_known_(other.types_known_), tagged_(other.tagged_),
+      cells_(other.cells_), col_types_(other.col_types_),
+      cell_types_(other.cell_types_), hashes_(other.hashes_),
+      slots_(other.slots_) {
+  acquire_rows(0, nrows_);
+}
+
+columnar_storage::columnar_storage(columnar_storage &&other) noexcept
+    : ncols_(other.ncols_), nrows_(std::exchange(other.nrows_, 0)),
+      types_known_(other.types_known_), tagged_(other.tagged_),
+      cells_(std::move(other.cells_)), col_types_(std::move(other.col_types_)),
+      cell_types_(std::move(other.cell_types_)),
+      hashes_(std::move(other.hashes_)), slots_(std::move(other.slots_)) {
+  other.cells_.clear();
+  other.hashes_.clear();
+  other.slots_.clear();
+}
+
+columnar_storage &columnar_storage::operator=(const columnar_storage &other) {
+  if (this != &other)
+    *this = columnar_storage(other);
+  return *this;
+}
+
+columnar_storage &
+columnar_storage::operator=(columnar_storage &&other) noexcept {
+  if (this == &other)
+    return *this;
+  release_rows(0, nrows_);
+  ncols_ = other.ncols_;
+  nrows_ = std::exchange(other.nrows_, 0);
+  types_known_ = other.types_known_;
+  tagged_ = other.tagged_;
+  cells_ = std::move(other.cells_);
+  col_types_ = std::move(other.col_types_);
+  cell_types_ = std::move(other.cell_types_);
+  hashes_ = std::move(other.hashes_);
+  slots_ = std::move(other.slots_);
+  other.cells_.clear();
+  other.hashes_.clear();
+  other.slots_.clear();
+  return *this;
+}
+
+columnar_storage::~columnar_storage() { release_rows(0, nrows_); }
+
+void columnar_storage::acquire_rows(size_t begin, size_t end) const {
+  if (!types_known_)
+    return;
+  for (size_t row = begin; row < end; ++row) {
+    const auto *rc = row_cells(row);
+    const auto *rt = row_types(row);
+    for (size_t i = 0; i < ncols_; ++i)
+      if (rt[i] == STRING_CELL)
+        common::symbol_table::acquire(
+          reinterpret_cast<const common::symbol *>(rc[i]));
+  }
+}
+
+void columnar_storage::release_rows(size_t begin, size_t end) const {
+  if (!types_known_)
+    return;
+  for (size_t row = begin; row < end; ++row) {
+    const auto *rc = row_cells(row);
+    const auto *rt = row_types(row);
+    for (size_t i = 0; i < ncols_; ++i)
+      if (rt[i] == STRING_CELL)
+        common::symbol_table::release(
+          reinterpret_cast<const common::symbol *>(rc[i]));
+  }
+}
+
+void columnar_storage::encode(const common::event_data &val,
+                              std::uint64_t &cell, cell_type &ty) {
+  if (const auto *s = val.get_if_symbol()) {
+    cell = reinterpret_cast<std::uintptr_t>(s);
+    ty = STRING_CELL;
+  } else if (const auto *d = val.get_if_float()) {
+    cell = std::bit_cast<std::uint64_t>(*d);
+    ty = FLOAT_CELL;
+  } else {
+    cell = std::bit_cast<std::uint64_t>(*val.get_if_int());
+    ty = INT_CELL;
+  }
+}
+
+common::event_data columnar_storage::decode(std::uint64_t cell, cell_type ty) {
+  switch (ty) {
+    case INT_CELL:
+      return common::event_data::Int(std::bit_cast<std::int64_t>(cell));
+    case FLOAT_CELL:
+      return common::event_data::Float(std::bit_cast<double>(cell));
+    case STRING_CELL:
+      return common::event_data::from_interned(
+        reinterpret_cast<const common::symbol *>(cell));
+  }
+  throw std::runtime_error("invalid cell type");
+}
+
+// Maps -0.0 to 0.0 so that cells which compare equal also hash equal.
+std::uint64_t columnar_storage::normalized(std::uint64_t cell, cell_type ty) {
+  if (ty == FLOAT_CELL && std::bit_cast<double>(cell) == 0.0)
+    return 0;
+  return cell;
+}
+
+size_t columnar_storage::hash_cells(const std::uint64_t *cells,
+                                    const cell_type *tys, size_t n) {
+  auto state = absl::HashOf(n);
+  for (size_t i = 0; i < n; ++i)
+    state = absl::HashOf(state, normalized(cells[i], tys[i]),
+                         static_cast<std::uint8_t>(tys[i]));
+  return state;
+}
+
+bool columnar_storage::cells_equal(size_t row, const std::uint64_t *cells,
+                                   const cell_type *tys) const {
+  const auto *rc = row_cells(row);
+  const auto *rt = row_types(row);
+  for (size_t i = 0; i < ncols_; ++i) {
+    if (rt[i] != tys[i])
+      return false;
+    if (tys[i] == FLOAT_CELL) {
+      if (std::bit_cast<double>(rc[i]) != std::bit_cast<double>(cells[i]))
+        return false;
+    } else if (rc[i] != cells[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t columnar_storage::find(size_t hash, const std::uint64_t *cells,
+                              const cell_type *tys) const {
+  if (slots_.empty())
+    return NOT_FOUND;
+  size_t mask = slots_.size() - 1;
+  for (size_t pos = hash & mask;; pos = (pos + 1) & mask) {
+    auto row = slots_[pos];
+    if (row == EMPTY_SLOT)
+      return NOT_FOUND;
+    if (hashes_[row] == hash && cells_equal(row, cells, tys))
+      return row;
+  }
+}
+
+void columnar_storage::place(size_t hash, size_t row) {
+  size_t mask = slots_.size() - 1;
+  size_t pos = hash & mask;
+  while (slots_[pos] != EMPTY_SLOT)
+    pos = (pos + 1) & mask;
+  slots_[pos] = static_cast<std::uint32_t>(row);
+}
+
+void columnar_storage::rehash(size_t capacity) {
+  slots_.assign(capacity, EMPTY_SLOT);
+  for (size_t row = 0; row < nrows_; ++row)
+    place(hashes_[row], row);
+}
+
+void columnar_storage::make_tagged() {
+  cell_types_.clear();
+  cell_types_.reserve(cells_.capacity());
+  for (size_t row = 0; row < nrows_; ++row)
+    cell_types_.insert(cell_types_.end(), col_types_.begin(), col_types_.end());
+  tagged_ = true;
+}
+
+void columnar_storage::insert_cells(const std::uint64_t *cells,
+                                    const cell_type *tys) {
+  size_t hash = hash_cells(cells, tys, ncols_);
+  if (find(hash, cells, tys) != NOT_FOUND)
+    return;
+  if (nrows_ >= EMPTY_SLOT)
+    throw std::runtime_error("columnar table exceeds maximum number of rows");
+  if (!types_known_) {
+    col_types_.assign(tys, tys + ncols_);
+    types_known_ = true;
+  } else if (!tagged_ && !std::equal(tys, tys + ncols_, col_types_.begin())) {
+    make_tagged();
+  }
+  if ((nrows_ + 1) * 2 > slots_.size())
+    rehash(std::max(size_t{16}, slots_.size() * 2));
+  cells_.insert(cells_.end(), cells, cells + ncols_);
+  if (tagged_)
+    cell_types_.insert(cell_types_.end(), tys, tys + ncols_);
+  hashes_.push_back(hash);
+  place(hash, nrows_);
+  ++nrows_;
+  acquire_rows(nrows_ - 1, nrows_);
+}
+
+void columnar_storage::reserve(size_t n) {
+  cells_.reserve(n * ncols_);
+  hashes_.reserve(n);
+  if (tagged_)
+    cell_types_.reserve(n * ncols_);
+  if (n * 2 > slots_.size())
+    rehash(std::bit_ceil(std::max(size_t{16}, n * 2)));
+}
+
+bool columnar_storage::contains(const row_type &row) const {
+  if (row.size() != ncols_)
+    return false;
+  cell_buf cells(ncols_);
+  type_buf tys(ncols_);
+  for (size_t i = 0; i < ncols_; ++i)
+    encode(row[i], cells[i], tys[i]);
+  return find(hash_cells(cells.data(), tys.data(), ncols_), cells.data(),
+              tys.data()) != NOT_FOUND;
+}
+
+void columnar_storage::insert(const row_type &row) {
+  if (row.size() != ncols_)
+    throw std::runtime_error("row does not match the number of columns");
+  cell_buf cells(ncols_);
+  type_buf tys(ncols_);
+  for (size_t i = 0; i < ncols_; ++i)
+    encode(row[i], cells[i], tys[i]);
+  insert_cells(cells.data(), tys.data());
+}
+
+void columnar_storage::insert_copy(const columnar_storage &src, handle h) {
+  insert_cells(src.row_cells(h), src.row_types(h));
+}
+
+void columnar_storage::insert_projected(const columnar_storage &src, handle h,
+                                        const vector<size_t> &idxs) {
+  const auto *sc = src.row_cells(h);
+  const auto *st = src.row_types(h);
+  cell_buf cells(idxs.size());
+  type_buf tys(idxs.size());
+  for (size_t i = 0; i < idxs.size(); ++i) {
+    cells[i] = sc[idxs[i]];
+    tys[i] = st[idxs[i]];
+  }
+  insert_cells(cells.data(), tys.data());
+}
+
+void columnar_storage::insert_concat(const columnar_storage &l, handle h1,
+                                     const columnar_storage &r, handle h2,
+                                     const vector<size_t> &keep_idx2) {
+  const auto *lc = l.row_cells(h1);
+  const auto *lt = l.row_types(h1);
+  const auto *rc = r.row_cells(h2);
+  const auto *rt = r.row_types(h2);
+  cell_buf cells(lc, lc + l.ncols_);
+  type_buf tys(lt, lt + l.ncols_);
+  for (auto idx : keep_idx2) {
+    cells.push_back(rc[idx]);
+    tys.push_back(rt[idx]);
+  }
+  insert_cells(cells.data(), tys.data());
+}
+
+columnar_storage::row_type columnar_storage::get(handle h) const {
+  const auto *rc = row_cells(h);
+  const auto *rt = row_types(h);
+  row_type row;
+  row.reserve(ncols_);
+  for (size_t i = 0; i < ncols_; ++i)
+    row.push_back(decode(rc[i], rt[i]));
+  return row;
+}
+
+columnar_storage::row_type
+columnar_storage::project(handle h, const vector<size_t> &idxs) const {
+  const auto *rc = row_cells(h);
+  const auto *rt = row_types(h);
+  row_type row;
+  row.reserve(idxs.size());
+  for (auto idx : idxs)
+    row.push_back(decode(rc[idx], rt[idx]));
+  return row;
+}
+
+// Join keys consist of the normalized cells followed by the cell types packed
+// into 2 bit fields, so that keys built from different tables compare equal
+// iff the projected values are equal.
+columnar_storage::key_type
+columnar_storage::key(handle h, const vector<size_t> &idxs) const {
+  const auto *rc = row_cells(h);
+  const auto *rt = row_types(h);
+  key_type k;
+  k.reserve(idxs.size() + (idxs.size() + 31) / 32);
+  for (auto idx : idxs)
+    k.push_back(normalized(rc[idx], rt[idx]));
+  for (size_t i = 0; i < idxs.size(); i += 32) {
+    std::uint64_t word = 0;
+    for (size_t j = i; j < std::min(i + 32, idxs.size()); ++j)
+      word |= std::uint64_t{rt[idxs[j]]} << (2 * (j - i));
+    k.push_back(word);
+  }
+  return k;
+}
+
+bool columnar_storage::key_equal(handle h1, const vector<size_t> &idxs1,
+                                 const columnar_storage &other, handle h2,
+                                 const vector<size_t> &idxs2) const {
+  const auto *rc1 = row_cells(h1), *rc2 = other.row_cells(h2);
+  const auto *rt1 = row_types(h1), *rt2 = other.row_types(h2);
+  for (size_t i = 0; i < idxs1.size(); ++i) {
+    auto ty = rt1[idxs1[i]];
+    if (ty != rt2[idxs2[i]] ||
+        normalized(rc1[idxs1[i]], ty) != normalized(rc2[idxs2[i]], ty))
+      return false;
+  }
+  return true;
+}
+
+size_t columnar_storage::key_hash(handle h, const vector<size_t> &idxs) const {
+  const auto *rc = row_cells(h);
+  const auto *rt = row_types(h);
+  auto state = absl::HashOf(idxs.size());
+  for (auto idx : idxs)
+    state = absl::HashOf(state, normalized(rc[idx], rt[idx]),
+                         static_cast<std::uint8_t>(rt[idx]));
+  return state;
+}
+
+// The cells are appended as they are, so the symbol references they hold
+// move along with them
+void columnar_storage::splice(columnar_storage &&other) {
+  if (other.nrows_ == 0)
+    return;
+  if (nrows_ == 0) {
+    *this = std::move(other);
+    return;
+  }
+  if (nrows_ + other.nrows_ >= EMPTY_SLOT)
+    throw std::runtime_error("columnar table exceeds maximum number of rows");
+  if (!tagged_ && (other.tagged_ || other.col_types_ != col_types_))
+    make_tagged();
+  reserve(nrows_ + other.nrows_);
+  cells_.insert(cells_.end(), other.cells_.begin(), other.cells_.end());
+  if (tagged_) {
+    for (size_t row = 0; row < other.nrows_; ++row) {
+      const auto *tys = other.row_types(row);
+      cell_types_.insert(cell_types_.end(), tys, tys + ncols_);
+    }
+  }
+  for (size_t row = 0; row < other.nrows_; ++row) {
+    hashes_.push_back(other.hashes_[row]);
+    place(other.hashes_[row], nrows_++);
+  }
+  other.nrows_ = 0;
+  other = columnar_storage(other.ncols_);
+}
+
+void columnar_storage::compact(const vector<bool> &erase_mask) {
+  size_t out = 0;
+  for (size_t row = 0; row < nrows_; ++row) {
+    if (erase_mask[row]) {
+      release_rows(row, row + 1);
+      continue;
+    }
+    if (out != row) {
+      std::copy_n(cells_.data() + row * ncols_, ncols_,
+                  cells_.data() + out * ncols_);
+      if (tagged_)
+        std::copy_n(cell_types_.data() + row * ncols_, ncols_,
+                    cell_types_.data() + out * ncols_);
+      hashes_[out] = hashes_[row];
+    }
+    ++out;
+  }
+  if (out == nrows_)
+    return;
+  nrows_ = out;
+  cells_.resize(nrows_ * ncols_);
+  if (tagged_)
+    cell_types_.resize(nrows_ * ncols_);
+  hashes_.resize(nrows_);
+  rehash(slots_.size());
+}
+
+common::hash_cached_set<columnar_storage::row_type>
+columnar_storage::take_all() {
+  common::hash_cached_set<row_type> res;
+  res.reserve(nrows_);
+  for (size_t row = 0; row < nrows_; ++row)
+    res.emplace(get(static_cast<handle>(row)));
+  *this = columnar_storage(ncols_);
+  return res;
+}
+}// namespace detail
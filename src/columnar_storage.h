@@ -0,0 +1,179 @@
+#ifndef CPPMON_COLUMNAR_STORAGE_H
+#define CPPMON_COLUMNAR_STORAGE_H
+
+#include <absl/container/inlined_vector.h>
+#include <cstddef>
+#include <cstdint>
+#include <event_data.h>
+#include <hash_cache.h>
+#include <iterator>
+#include <table.h>
+#include <vector>
+
+namespace detail {
+
+// Row storage for tables of event_data that keeps all rows of a table in a
+// single arena of fixed-width 8 byte cells. Every column is typed (int64,
+// double or interned string pointer). String cells hold a reference to their
+// symbol while the row is stored. Per-cell type tags are only materialized once a
+// column turns out to contain values of different types, so the common case of
+// homogeneously typed columns costs exactly ncols * 8 bytes per row plus the
+// precomputed row hash and one index slot. The arena hash is computed over the
+// cells, so iterating materializes rows together with a freshly computed
+// content hash.
+class columnar_storage {
+public:
+  using row_type = inline_tuple<common::event_data>;
+  using hashed_row = common::hash_cached<row_type>;
+  using handle = std::uint32_t;
+  using key_type = absl::InlinedVector<std::uint64_t, 4>;
+
+  class const_iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = hashed_row;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = hashed_row;
+
+    const_iterator() = default;
+    const_iterator(const columnar_storage *storage, size_t idx)
+        : storage_(storage), idx_(idx) {}
+
+    reference operator*() const {
+      return storage_->get(static_cast<handle>(idx_));
+    }
+
+    const_iterator &operator++() {
+      ++idx_;
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      auto tmp = *this;
+      ++idx_;
+      return tmp;
+    }
+
+    friend bool operator==(const const_iterator &l, const const_iterator &r) {
+      return l.idx_ == r.idx_;
+    }
+
+    friend bool operator!=(const const_iterator &l, const const_iterator &r) {
+      return l.idx_ != r.idx_;
+    }
+
+  private:
+    const columnar_storage *storage_ = nullptr;
+    size_t idx_ = 0;
+  };
+  using iterator = const_iterator;
+
+  columnar_storage() = default;
+  explicit columnar_storage(size_t ncols) : ncols_(ncols) {}
+  columnar_storage(const columnar_storage &other);
+  columnar_storage(columnar_storage &&other) noexcept;
+  columnar_storage &operator=(const columnar_storage &other);
+  columnar_storage &operator=(columnar_storage &&other) noexcept;
+  ~columnar_storage();
+
+  const_iterator begin() const { return {this, 0}; }
+  const_iterator end() const { return {this, nrows_}; }
+  const_iterator cbegin() const { return begin(); }
+  const_iterator cend() const { return end(); }
+
+  [[nodiscard]] size_t size() const { return nrows_; }
+  [[nodiscard]] bool empty() const { return nrows_ == 0; }
+  void reserve(size_t n);
+  bool contains(const row_type &row) const;
+  bool contains(const hashed_row &row) const { return contains(*row); }
+  void insert(const row_type &row);
+  void insert(const hashed_row &row) { insert(*row); }
+
+  void insert_copy(const columnar_storage &src, handle h);
+  void insert_projected(const columnar_storage &src, handle h,
+                        const vector<size_t> &idxs);
+  void insert_concat(const columnar_storage &l, handle h1,
+                     const columnar_storage &r, handle h2,
+                     const vector<size_t> &keep_idx2);
+
+  row_type get(handle h) const;
+  row_type project(handle h, const vector<size_t> &idxs) const;
+  key_type key(handle h, const vector<size_t> &idxs) const;
+  bool key_equal(handle h1, const vector<size_t> &idxs1,
+                 const columnar_storage &other, handle h2,
+                 const vector<size_t> &idxs2) const;
+  size_t key_hash(handle h, const vector<size_t> &idxs) const;
+  // Moves all rows of other, none of which may be in this storage, into it
+  void splice(columnar_storage &&other);
+
+  template<typename F>
+  void for_each_handle(F f) const {
+    for (size_t i = 0; i < nrows_; ++i)
+      f(static_cast<handle>(i));
+  }
+
+  template<typename Pred>
+  void erase_if(Pred pred) {
+    vector<bool> erase_mask(nrows_);
+    for (size_t i = 0; i < nrows_; ++i)
+      erase_mask[i] = pred(static_cast<handle>(i));
+    compact(erase_mask);
+  }
+
+  common::hash_cached_set<row_type> take_all();
+
+private:
+  enum cell_type : std::uint8_t
+  {
+    INT_CELL,
+    FLOAT_CELL,
+    STRING_CELL
+  };
+  using cell_buf = absl::InlinedVector<std::uint64_t, 8>;
+  using type_buf = absl::InlinedVector<cell_type, 8>;
+  static constexpr std::uint32_t EMPTY_SLOT = ~std::uint32_t{0};
+  static constexpr size_t NOT_FOUND = ~size_t{0};
+
+  static void encode(const common::event_data &val, std::uint64_t &cell,
+                     cell_type &ty);
+  static common::event_data decode(std::uint64_t cell, cell_type ty);
+  static std::uint64_t normalized(std::uint64_t cell, cell_type ty);
+  static size_t hash_cells(const std::uint64_t *cells, const cell_type *tys,
+                           size_t n);
+
+  const std::uint64_t *row_cells(size_t row) const {
+    return cells_.data() + row * ncols_;
+  }
+  const cell_type *row_types(size_t row) const {
+    return tagged_ ? cell_types_.data() + row * ncols_ : col_types_.data();
+  }
+  bool cells_equal(size_t row, const std::uint64_t *cells,
+                   const cell_type *tys) const;
+  size_t find(size_t hash, const std::uint64_t *cells,
+              const cell_type *tys) const;
+  void insert_cells(const std::uint64_t *cells, const cell_type *tys);
+  void place(size_t hash, size_t row);
+  void rehash(size_t capacity);
+  void make_tagged();
+  void compact(const vector<bool> &erase_mask);
+  // Acquire or release the symbol references held by the string cells of
+  // rows [begin, end)
+  void acquire_rows(size_t begin, size_t end) const;
+  void release_rows(size_t begin, size_t end) const;
+
+  size_t ncols_ = 0;
+  size_t nrows_ = 0;
+  bool types_known_ = false;
+  bool tagged_ = false;
+  vector<std::uint64_t> cells_;
+  vector<cell_type> col_types_;
+  vector<cell_type> cell_types_;
+  vector<size_t> hashes_;
+  vector<std::uint32_t> slots_;
+};
+}// namespace detail
+
+using detail::columnar_storage;
+
+#endif// CPPMON_COLUMNAR_STORAGE_H
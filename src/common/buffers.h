@@ -3,13 +3,169 @@
 
 #include <algorithm>
 #include <boost/container/devector.hpp>
+#include <cassert>
 #include <iterator>
+#include <limits>
 #include <type_traits>
 #include <utility>
 #include <vector>
 
 namespace common {
 
+// Whether elem is an empty element (nullopt table, empty delta). Elements of
+// other types are never empty.
+template<typename T>
+bool is_empty_elem(const T &elem) {
+  if constexpr (requires { elem.has_value(); })
+    return !elem.has_value();
+  else if constexpr (requires { elem.empty(); })
+    return elem.empty();
+  else
+    return false;
+}
+
+// Sequence of elements stored as runs of equal elements (count, element).
+// Adjacent empty elements are always merged into one run, so that a stretch
+// of tps without results is a single run no matter how long it is. Non-empty
+// runs with a count > 1 come from operators that map a run to a run, e.g. the
+// negation of an empty run.
+template<typename T>
+class run_length_vec {
+public:
+  using run_type = std::pair<size_t, T>;
+
+  run_length_vec() = default;
+  explicit run_length_vec(std::vector<T> &&elems) {
+    runs_.reserve(elems.size());
+    for (auto &elem : elems)
+      push_back(std::move(elem));
+  }
+
+  [[nodiscard]] bool empty() const { return size_ == 0; }
+
+  // Number of elements, not of runs
+  [[nodiscard]] size_t size() const { return size_; }
+
+  void reserve(size_t n_runs) { runs_.reserve(n_runs); }
+
+  void push_back(T &&elem) { push_run(1, std::move(elem)); }
+
+  void push_run(size_t n, T &&elem) {
+    if (n == 0)
+      return;
+    size_ += n;
+    if (is_empty_elem(elem) && !runs_.empty() &&
+        is_empty_elem(runs_.back().second))
+      runs_.back().first += n;
+    else
+      runs_.emplace_back(n, std::move(elem));
+  }
+
+  // Repeats the last element n more times
+  void repeat_back(size_t n = 1) {
+    assert(!runs_.empty());
+    runs_.back().first += n;
+    size_ += n;
+  }
+
+  [[nodiscard]] const std::vector<run_type> &runs() const { return runs_; }
+  std::vector<run_type> &runs() { return runs_; }
+
+  // One element per position; every element of a run but the last is a copy
+  std::vector<T> expand() && {
+    std::vector<T> res;
+    res.reserve(size_);
+    for (auto &[n, elem] : runs_) {
+      for (size_t i = 1; i < n; ++i)
+        res.push_back(elem);
+      res.push_back(std::move(elem));
+    }
+    return res;
+  }
+
+private:
+  std::vector<run_type> runs_;
+  size_t size_ = 0;
+};
+
+// Queue with the same run representation as run_length_vec, so that a long
+// stretch of tps without results takes O(1) memory and is appended and
+// consumed in O(1).
+template<typename T>
+class run_length_queue {
+public:
+  [[nodiscard]] bool empty() const { return size_ == 0; }
+
+  [[nodiscard]] size_t size() const { return size_; }
+
+  // Number of elements in the first run
+  [[nodiscard]] size_t front_run_size() const {
+    assert(!empty());
+    return runs_.front().first;
+  }
+
+  void push_back(T &&elem) { push_run(1, std::move(elem)); }
+
+  void push_run(size_t n, T &&elem) {
+    if (n == 0)
+      return;
+    size_ += n;
+    if (is_empty_elem(elem) && !runs_.empty() &&
+        is_empty_elem(runs_.back().second))
+      runs_.back().first += n;
+    else
+      runs_.emplace_back(n, std::move(elem));
+  }
+
+  [[nodiscard]] const T &front() const {
+    assert(!empty());
+    return runs_.front().second;
+  }
+
+  // Removes the first n elements, which must belong to the first run
+  void pop_front(size_t n = 1) {
+    assert(n > 0 && n <= front_run_size());
+    size_ -= n;
+    if (n < runs_.front().first)
+      runs_.front().first -= n;
+    else
+      runs_.pop_front();
+  }
+
+  // Removes the first element and returns it
+  T take_front() { return take_front_run(1); }
+
+  // Removes the first n elements, which must belong to the first run, and
+  // returns their value
+  T take_front_run(size_t n) {
+    assert(n > 0 && n <= front_run_size());
+    size_ -= n;
+    auto &[num, elem] = runs_.front();
+    if (n < num) {
+      num -= n;
+      return elem;
+    }
+    T res = std::move(elem);
+    runs_.pop_front();
+    return res;
+  }
+
+  template<typename It>
+  void append(It first, It last) {
+    for (; first != last; ++first)
+      push_back(std::move(*first));
+  }
+
+  void append_runs(std::vector<std::pair<size_t, T>> &runs) {
+    for (auto &[n, elem] : runs)
+      push_run(n, std::move(elem));
+  }
+
+private:
+  boost::container::devector<std::pair<size_t, T>> runs_;
+  size_t size_ = 0;
+};
+
 template<typename T>
 class binary_buffer {
 public:
@@ -32,11 +188,12 @@ public:
       std::swap(it1, it2);
       std::swap(eit1, eit2);
     }
-    for (; !buf.empty() && it2 != eit2; buf.pop_front(), ++it2) {
+    for (; !buf.empty() && it2 != eit2; ++it2) {
+      T elem = buf.take_front();
       if (is_l)
-        res.push_back(f(buf.front(), *it2));
+        res.push_back(f(elem, *it2));
       else
-        res.push_back(f(*it2, buf.front()));
+        res.push_back(f(*it2, elem));
     }
     for (; it1 != eit1 && it2 != eit2; it1++, it2++) {
       if (is_l)
@@ -49,16 +206,89 @@ public:
       std::swap(it1, it2);
       std::swap(eit1, eit2);
     }
-    buf.insert(buf.end(), std::make_move_iterator(it1),
-               std::make_move_iterator(eit1));
+    buf.append(it1, eit1);
     return res;
   }
 
+  // Same as update_and_reduce, but on runs: f is called once for every pair
+  // of overlapping runs and its result is repeated for the whole overlap.
+  // Only valid if f is a pure function of its arguments. After calling this
+  // function new_l and new_r will contain garbage
+  template<typename F>
+  auto update_and_reduce_runs(run_length_vec<T> &new_l,
+                              run_length_vec<T> &new_r, F f) {
+    using R = std::invoke_result_t<decltype(f), std::add_lvalue_reference_t<T>,
+                                   std::add_lvalue_reference_t<T>>;
+    run_length_vec<R> res;
+    update_and_visit_runs(new_l, new_r, [&res, &f](size_t n, T &l, T &r) {
+      res.push_run(n, f(l, r));
+    });
+    return res;
+  }
+
+  // Calls f(n, l, r) in order for every pair of overlapping runs, where n is
+  // the length of the overlap. After calling this function new_l and new_r
+  // will contain garbage
+  template<typename F>
+  void update_and_visit_runs(run_length_vec<T> &new_l,
+                             run_length_vec<T> &new_r, F f) {
+    run_length_queue<T> other;
+    buf.append_runs(is_l ? new_l.runs() : new_r.runs());
+    other.append_runs(is_l ? new_r.runs() : new_l.runs());
+    while (!buf.empty() && !other.empty()) {
+      size_t n = std::min(buf.front_run_size(), other.front_run_size());
+      T elem1 = buf.take_front_run(n), elem2 = other.take_front_run(n);
+      if (is_l)
+        f(n, elem1, elem2);
+      else
+        f(n, elem2, elem1);
+    }
+    if (buf.empty() && !other.empty()) {
+      is_l = !is_l;
+      buf = std::move(other);
+    }
+  }
+
 private:
-  boost::container::devector<T> buf;
+  run_length_queue<T> buf;
   bool is_l;
 };
 
+template<typename T>
+class nary_buffer {
+public:
+  nary_buffer() = default;
+  explicit nary_buffer(size_t n) : bufs(n) {}
+
+  // Calls f once for every index for which all n inputs are available, with
+  // the n elements at that index. After calling this function new_elems will
+  // contain garbage
+  template<typename F>
+  auto update_and_reduce(std::vector<std::vector<T>> &new_elems, F f) {
+    using R = std::invoke_result_t<decltype(f), std::vector<T> &>;
+    assert(new_elems.size() == bufs.size());
+    size_t n_ready = std::numeric_limits<size_t>::max();
+    for (size_t i = 0; i < bufs.size(); ++i) {
+      bufs[i].append(new_elems[i].begin(), new_elems[i].end());
+      n_ready = std::min(n_ready, bufs[i].size());
+    }
+    std::vector<R> res;
+    if (bufs.empty())
+      return res;
+    res.reserve(n_ready);
+    std::vector<T> args(bufs.size());
+    for (size_t k = 0; k < n_ready; ++k) {
+      for (size_t i = 0; i < bufs.size(); ++i)
+        args[i] = bufs[i].take_front();
+      res.push_back(f(args));
+    }
+    return res;
+  }
+
+private:
+  std::vector<run_length_queue<T>> bufs;
+};
+
 }// namespace common
 
 
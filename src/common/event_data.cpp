@@ -1,5 +1,6 @@
 #include <event_data.h>
 #include <string_view>
+#include <symbol_table.h>
 #include <util.h>
 
 namespace common {
@@ -7,65 +8,59 @@ using std::string;
 using std::string_view;
 using std::literals::string_view_literals::operator""sv;
 
-event_data::event_data() : tag(HOLDS_INT) {}
+event_data::event_data() : tag(HOLDS_INT), i(0) {}
 
-void event_data::do_move(event_data &&other) noexcept {
-  if (other.tag == HOLDS_INT) {
-    i = other.i;
-  } else if (other.tag == HOLDS_FLOAT) {
-    d = other.d;
-  } else {
-    if (tag == HOLD_STRING)
-      *s = std::move(*other.s);
-    else {
-      s = other.s;
-      other.s = nullptr;
-    }
-  }
-  tag = other.tag;
+event_data::event_data(const event_data &other) {
+  copy_payload(other);
+  if (tag == HOLD_STRING)
+    symbol_table::acquire(s);
 }
-void event_data::do_copy(const event_data &other) {
-  if (other.tag == HOLDS_INT) {
-    i = other.i;
-  } else if (other.tag == HOLDS_FLOAT) {
-    d = other.d;
-  } else {
-    if (tag == HOLD_STRING)
-      *s = *other.s;
-    else
-      s = new std::string(*other.s);
-  }
-  tag = other.tag;
+
+event_data::event_data(event_data &&other) noexcept {
+  copy_payload(other);
+  other.tag = HOLDS_INT;
+  other.i = 0;
 }
 
-event_data &event_data::operator=(event_data &&other) noexcept {
-  do_move(std::move(other));
+event_data &event_data::operator=(const event_data &other) {
+  if (other.tag == HOLD_STRING)
+    symbol_table::acquire(other.s);
+  if (tag == HOLD_STRING)
+    symbol_table::release(s);
+  copy_payload(other);
   return *this;
 }
 
-event_data &event_data::operator=(const event_data &other) {
-  do_copy(other);
+event_data &event_data::operator=(event_data &&other) noexcept {
+  if (this == &other)
+    return *this;
+  if (tag == HOLD_STRING)
+    symbol_table::release(s);
+  copy_payload(other);
+  other.tag = HOLDS_INT;
+  other.i = 0;
   return *this;
 }
 
-event_data::event_data(const event_data &other) : event_data() {
-  do_copy(other);
+event_data::~event_data() {
+  if (tag == HOLD_STRING)
+    symbol_table::release(s);
 }
 
-event_data::event_data(event_data &&other) noexcept : event_data() {
-  do_move(std::move(other));
+void event_data::copy_payload(const event_data &other) {
+  tag = other.tag;
+  if (tag == HOLDS_INT)
+    i = other.i;
+  else if (tag == HOLDS_FLOAT)
+    d = other.d;
+  else
+    s = other.s;
 }
 
 bool event_data::operator>(const event_data &other) const {
   return !(*this <= other);
 }
 
-event_data::~event_data() {
-  if (tag == HOLD_STRING) {
-    delete s;
-  }
-}
-
 event_data event_data::Int(int64_t i) {
   event_data tmp;
   tmp.tag = HOLDS_INT;
@@ -78,16 +73,17 @@ event_data event_data::Float(double d) {
   tmp.d = d;
   return tmp;
 }
-event_data event_data::String(const std::string &s) {
+event_data event_data::String(std::string_view s) {
   event_data tmp;
   tmp.tag = HOLD_STRING;
-  tmp.s = new std::string(s);
+  tmp.s = symbol_table::intern(s);
   return tmp;
 }
-event_data event_data::String(std::string &&s) {
+event_data event_data::from_interned(const symbol *s) {
+  symbol_table::acquire(s);
   event_data tmp;
   tmp.tag = HOLD_STRING;
-  tmp.s = new std::string(std::move(s));
+  tmp.s = s;
   return tmp;
 }
 
@@ -99,7 +95,7 @@ bool event_data::operator==(const event_data &other) const {
   } else if (tag == HOLDS_FLOAT) {
     return d == other.d;
   } else {
-    return *s == *other.s;
+    return s == other.s;
   }
 }
 
@@ -123,7 +119,7 @@ bool event_data::operator<=(const event_data &other) const {
     if (other.tag == HOLDS_INT || other.tag == HOLDS_FLOAT)
       return false;
     else
-      return *s <= *other.s;
+      return s->str <= other.s->str;
   }
 }
 
@@ -198,6 +194,27 @@ const int64_t *event_data::get_if_int() const {
     return nullptr;
 }
 
+const double *event_data::get_if_float() const {
+  if (tag == HOLDS_FLOAT)
+    return &d;
+  else
+    return nullptr;
+}
+
+const std::string *event_data::get_if_string() const {
+  if (tag == HOLD_STRING)
+    return &s->str;
+  else
+    return nullptr;
+}
+
+const symbol *event_data::get_if_symbol() const {
+  if (tag == HOLD_STRING)
+    return s;
+  else
+    return nullptr;
+}
+
 event_data event_data::from_json(const json &json_formula) {
   string_view event_ty = json_formula.at(0).get<string_view>();
   if (event_ty == "EInt"sv) {
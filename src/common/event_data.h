@@ -4,11 +4,15 @@
 #include <absl/base/optimization.h>
 #include <boost/operators.hpp>
 #include <boost/variant2/variant.hpp>
+#include <cstdint>
+#include <cstring>
 #include <fmt/core.h>
 #include <fmt/format.h>
 #include <memory>
 #include <nlohmann/json.hpp>
 #include <string>
+#include <string_view>
+#include <symbol_table.h>
 #include <util.h>
 
 namespace common {
@@ -32,8 +36,12 @@ public:
 
   static event_data Int(int64_t i);
   static event_data Float(double d);
-  static event_data String(const std::string &s);
-  static event_data String(std::string &&s);
+  // Strings are interned in the process-wide symbol_table, so string equality
+  // and hashing work on the address. Every string event_data holds a reference
+  // to its symbol.
+  static event_data String(std::string_view s);
+  // Takes a new reference to s
+  static event_data from_interned(const symbol *s);
   static event_data from_json(const json &json_formula);
   static event_data nan();
 
@@ -51,6 +59,20 @@ public:
   [[nodiscard]] event_data int_to_float() const;
   [[nodiscard]] event_data float_to_int() const;
   [[nodiscard]] const int64_t *get_if_int() const;
+  [[nodiscard]] const double *get_if_float() const;
+  [[nodiscard]] const std::string *get_if_string() const;
+  [[nodiscard]] const symbol *get_if_symbol() const;
+  // Type tag (0: int, 1: float, 2: string) and the raw 8 byte payload, for
+  // batched comparisons. Two non-float values are equal iff their tags and
+  // payloads are.
+  [[nodiscard]] std::uint8_t type_tag() const {
+    return static_cast<std::uint8_t>(tag);
+  }
+  [[nodiscard]] std::uint64_t raw_bits() const {
+    std::uint64_t bits;
+    std::memcpy(&bits, &i, sizeof(bits));
+    return bits;
+  }
 
   template<typename H>
   friend H AbslHashValue(H h, const event_data &elem) {
@@ -59,13 +81,11 @@ public:
     } else if (elem.tag == HOLDS_FLOAT) {
       return H::combine(std::move(h), elem.d);
     } else {
-      return H::combine(std::move(h), *elem.s);
+      return H::combine(std::move(h), elem.s);
     }
   }
 
 private:
-  void do_move(event_data &&other) noexcept;
-  void do_copy(const event_data &other);
   template<typename F>
   static event_data apply_arith_bin_op(F op, const event_data &l,
                                        const event_data &r) {
@@ -81,6 +101,8 @@ private:
       return nan();
     }
   }
+  // Copies tag and the union member it selects, without touching refcounts
+  void copy_payload(const event_data &other);
   enum tag_ty
   {
     HOLDS_INT,
@@ -90,7 +112,7 @@ private:
   union {
     int64_t i;
     double d;
-    std::string *s;
+    const symbol *s;
   };
 };
 
@@ -134,7 +156,7 @@ struct [[maybe_unused]] fmt::formatter<common::event_data> {
     } else if (tab.tag == common::event_data::HOLDS_FLOAT) {
       return format_to(ctx.out(), "{:.15e}", tab.d);
     } else {
-      return format_to(ctx.out(), "\"{}\"", *tab.s);
+      return format_to(ctx.out(), "\"{}\"", tab.s->str);
     }
   }
 };
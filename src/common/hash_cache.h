@@ -1,30 +1,42 @@
 #ifndef CPPMON_HASH_CACHE_H
 #define CPPMON_HASH_CACHE_H
+#include <absl/container/flat_hash_map.h>
+#include <absl/container/flat_hash_set.h>
 #include <absl/hash/hash.h>
 #include <cstddef>
 #include <fmt/core.h>
 #include <fmt/format.h>
+#include <utility>
 
 namespace common {
+// Immutable wrapper that computes the hash of its key once on construction.
+// Copies and moves carry the hash along, so a key is hashed only when it is
+// created and never again when it is moved between hash containers or when
+// those containers grow.
 template<typename T>
 class hash_cached {
   friend ::fmt::formatter<hash_cached<T>>;
 
 public:
-  hash_cached() : key_(T()), hash_(absl::Hash<T>(key_)) {}
+  hash_cached() : key_(), hash_(absl::Hash<T>{}(key_)) {}
 
-  hash_cached(const T &key) : key_(key), hash_(absl::Hash<T>(key_)) {}
-  hash_cached(T &&key) : key_(std::move(key)), hash_(absl::Hash<T>(key_)) {}
-
-  operator hash_cached<T> const &() const { return key_; }
+  hash_cached(const T &key) : key_(key), hash_(absl::Hash<T>{}(key_)) {}
+  hash_cached(T &&key) : key_(std::move(key)), hash_(absl::Hash<T>{}(key_)) {}
 
   hash_cached(hash_cached<T> &&) noexcept = default;
   hash_cached(hash_cached<T> const &) = default;
-  hash_cached<T> &operator=(hash_cached<T> &&) = default;
+  hash_cached<T> &operator=(hash_cached<T> &&) noexcept = default;
   hash_cached<T> &operator=(hash_cached<T> const &) = default;
 
+  const T &get() const { return key_; }
+  const T &operator*() const { return key_; }
+  const T *operator->() const { return &key_; }
+  [[nodiscard]] size_t hash() const { return hash_; }
+
+  T release() && { return std::move(key_); }
+
   friend bool operator==(const hash_cached<T> &lhs, const hash_cached<T> &rhs) {
-    return lhs.key_ == rhs.key_;
+    return lhs.hash_ == rhs.hash_ && lhs.key_ == rhs.key_;
   }
 
   template<typename H>
@@ -36,6 +48,41 @@ private:
   T key_;
   size_t hash_;
 };
+
+// Transparent hasher that returns the cached hash as is. Plain keys are hashed
+// with absl::Hash<T>, which is also what hash_cached uses, so containers using
+// it can be probed with a T without wrapping (and copying) it first.
+template<typename T>
+struct hash_cached_hash {
+  using is_transparent = void;
+
+  size_t operator()(const hash_cached<T> &key) const { return key.hash(); }
+  size_t operator()(const T &key) const { return absl::Hash<T>{}(key); }
+};
+
+template<typename T>
+struct hash_cached_eq {
+  using is_transparent = void;
+
+  bool operator()(const hash_cached<T> &l, const hash_cached<T> &r) const {
+    return l == r;
+  }
+  bool operator()(const hash_cached<T> &l, const T &r) const {
+    return *l == r;
+  }
+  bool operator()(const T &l, const hash_cached<T> &r) const {
+    return l == *r;
+  }
+};
+
+template<typename T>
+using hash_cached_set =
+  absl::flat_hash_set<hash_cached<T>, hash_cached_hash<T>, hash_cached_eq<T>>;
+
+template<typename K, typename V>
+using hash_cached_map = absl::flat_hash_map<hash_cached<K>, V,
+                                            hash_cached_hash<K>,
+                                            hash_cached_eq<K>>;
 }// namespace common
 
 template<typename T>
@@ -51,7 +98,7 @@ struct [[maybe_unused]] fmt::formatter<common::hash_cached<T>> {
 
   template<typename FormatContext>
   auto format
-    [[maybe_unused]] (const common::hash_cached<T> &val, FormatContext &ctx)
+    [[maybe_unused]] (const common::hash_cached<T> &val, FormatContext &ctx) const
     -> decltype(ctx.out()) {
     return format_to(ctx.out(), "{}", val.key_);
   }
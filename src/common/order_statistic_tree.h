@@ -0,0 +1,190 @@
+#ifndef CPPMON_ORDER_STATISTIC_TREE_H
+#define CPPMON_ORDER_STATISTIC_TREE_H
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace common {
+// Multiset with rank queries. It is a treap whose nodes store the multiplicity
+// of their key and the total multiplicity of their subtree, so insert, erase,
+// nth and count_prefix take expected O(log n). Nodes live in one vector and
+// are recycled through a free list.
+template<typename T, typename Compare = std::less<>>
+class order_statistic_tree {
+public:
+  order_statistic_tree() = default;
+
+  [[nodiscard]] size_t size() const { return subtree_size(root_); }
+
+  [[nodiscard]] bool empty() const { return root_ == nil; }
+
+  void insert(const T &key) { root_ = insert(root_, key); }
+
+  // Removes one occurrence of key, which must be contained
+  void erase(const T &key) { root_ = erase(root_, key); }
+
+  // The k-th smallest element (counted from 0), requires k < size()
+  const T &nth(size_t k) const {
+    assert(k < size());
+    uint32_t t = root_;
+    for (;;) {
+      const node &n = nodes_[t];
+      size_t left_size = subtree_size(n.left);
+      if (k < left_size) {
+        t = n.left;
+      } else if (k < left_size + n.count) {
+        return n.key;
+      } else {
+        k -= left_size + n.count;
+        t = n.right;
+      }
+    }
+  }
+
+  // Number of elements e with before(e). before must hold for a prefix of the
+  // elements in sorted order.
+  template<typename Pred>
+  size_t count_prefix(Pred before) const {
+    size_t res = 0;
+    for (uint32_t t = root_; t != nil;) {
+      const node &n = nodes_[t];
+      if (before(n.key)) {
+        res += subtree_size(n.left) + n.count;
+        t = n.right;
+      } else {
+        t = n.left;
+      }
+    }
+    return res;
+  }
+
+  void clear() {
+    nodes_.clear();
+    free_.clear();
+    root_ = nil;
+  }
+
+private:
+  static constexpr uint32_t nil = std::numeric_limits<uint32_t>::max();
+
+  struct node {
+    T key;
+    size_t count;
+    size_t size;
+    uint32_t prio;
+    uint32_t left, right;
+  };
+
+  size_t subtree_size(uint32_t t) const {
+    return t == nil ? 0 : nodes_[t].size;
+  }
+
+  void update(uint32_t t) {
+    node &n = nodes_[t];
+    n.size = subtree_size(n.left) + n.count + subtree_size(n.right);
+  }
+
+  uint32_t next_prio() {
+    // xorshift32, deterministic so that runs are reproducible
+    prio_state_ ^= prio_state_ << 13;
+    prio_state_ ^= prio_state_ >> 17;
+    prio_state_ ^= prio_state_ << 5;
+    return prio_state_;
+  }
+
+  uint32_t new_node(const T &key) {
+    node n{key, 1, 1, next_prio(), nil, nil};
+    if (!free_.empty()) {
+      uint32_t t = free_.back();
+      free_.pop_back();
+      nodes_[t] = std::move(n);
+      return t;
+    }
+    nodes_.push_back(std::move(n));
+    return static_cast<uint32_t>(nodes_.size() - 1);
+  }
+
+  uint32_t rotate_right(uint32_t t) {
+    uint32_t l = nodes_[t].left;
+    nodes_[t].left = nodes_[l].right;
+    nodes_[l].right = t;
+    update(t);
+    update(l);
+    return l;
+  }
+
+  uint32_t rotate_left(uint32_t t) {
+    uint32_t r = nodes_[t].right;
+    nodes_[t].right = nodes_[r].left;
+    nodes_[r].left = t;
+    update(t);
+    update(r);
+    return r;
+  }
+
+  uint32_t insert(uint32_t t, const T &key) {
+    if (t == nil)
+      return new_node(key);
+    if (cmp_(key, nodes_[t].key)) {
+      uint32_t l = insert(nodes_[t].left, key);
+      nodes_[t].left = l;
+      if (nodes_[l].prio > nodes_[t].prio)
+        return rotate_right(t);
+    } else if (cmp_(nodes_[t].key, key)) {
+      uint32_t r = insert(nodes_[t].right, key);
+      nodes_[t].right = r;
+      if (nodes_[r].prio > nodes_[t].prio)
+        return rotate_left(t);
+    } else {
+      nodes_[t].count++;
+    }
+    update(t);
+    return t;
+  }
+
+  uint32_t merge(uint32_t a, uint32_t b) {
+    if (a == nil)
+      return b;
+    if (b == nil)
+      return a;
+    if (nodes_[a].prio > nodes_[b].prio) {
+      nodes_[a].right = merge(nodes_[a].right, b);
+      update(a);
+      return a;
+    } else {
+      nodes_[b].left = merge(a, nodes_[b].left);
+      update(b);
+      return b;
+    }
+  }
+
+  uint32_t erase(uint32_t t, const T &key) {
+    assert(t != nil);
+    if (cmp_(key, nodes_[t].key)) {
+      nodes_[t].left = erase(nodes_[t].left, key);
+    } else if (cmp_(nodes_[t].key, key)) {
+      nodes_[t].right = erase(nodes_[t].right, key);
+    } else if (nodes_[t].count > 1) {
+      nodes_[t].count--;
+    } else {
+      uint32_t res = merge(nodes_[t].left, nodes_[t].right);
+      free_.push_back(t);
+      return res;
+    }
+    update(t);
+    return t;
+  }
+
+  std::vector<node> nodes_;
+  std::vector<uint32_t> free_;
+  uint32_t root_ = nil;
+  uint32_t prio_state_ = 2463534242u;
+  [[no_unique_address]] Compare cmp_;
+};
+}// namespace common
+
+#endif// CPPMON_ORDER_STATISTIC_TREE_H
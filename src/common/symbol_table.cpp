@@ -0,0 +1,36 @@
+#include <algorithm>
+#include <symbol_table.h>
+
+namespace common {
+symbol_table &symbol_table::instance() {
+  static symbol_table table;
+  return table;
+}
+
+const symbol *symbol_table::intern(std::string_view s) {
+  auto &inst = instance();
+  absl::MutexLock lock(&inst.mutex_);
+  auto it = inst.symbols_.find(s);
+  if (it != inst.symbols_.end()) {
+    acquire(&*it);
+    return &*it;
+  }
+  if (inst.symbols_.size() >= inst.sweep_at_)
+    inst.sweep();
+  return &*inst.symbols_.emplace(s).first;
+}
+
+void symbol_table::sweep() {
+  absl::erase_if(symbols_, [](const symbol &s) {
+    return s.refs.load(std::memory_order_acquire) == 0;
+  });
+  sweep_at_ = std::max(MIN_SWEEP_SIZE, 2 * symbols_.size());
+}
+
+size_t symbol_table::size() {
+  auto &inst = instance();
+  absl::MutexLock lock(&inst.mutex_);
+  inst.sweep();
+  return inst.symbols_.size();
+}
+}// namespace common
@@ -0,0 +1,81 @@
+#ifndef CPPMON_SYMBOL_TABLE_H
+#define CPPMON_SYMBOL_TABLE_H
+
+#include <absl/container/node_hash_set.h>
+#include <absl/hash/hash.h>
+#include <absl/synchronization/mutex.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace common {
+
+// A string interned in the symbol_table together with the number of
+// references to it.
+struct symbol {
+  explicit symbol(std::string_view s) : str(s) {}
+
+  std::string str;
+  mutable std::atomic<std::uint64_t> refs{1};
+};
+
+// Process-wide pool of interned strings. Interned strings are reference
+// counted so a long-running monitor fed ever new strings does not keep them
+// all. Releasing the last reference never takes the lock: unreferenced
+// symbols stay in the pool, where intern can revive them, until a sweep frees
+// them. intern sweeps whenever the pool has doubled since the last sweep, so
+// at most half of it is garbage and the sweeps cost amortized O(1) per new
+// string. While a string is referenced, its symbol is the only one with that
+// content, so live symbols can be compared and hashed by address.
+//
+// Copying an event_data still bumps the atomic refcount of its symbol, so
+// threads sharing a hot string contend on its cache line; the lock is only
+// taken by intern and size.
+class symbol_table {
+public:
+  // Returns the symbol for s with one reference owned by the caller
+  static const symbol *intern(std::string_view s);
+  static void acquire(const symbol *s) {
+    s->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  static void release(const symbol *s) {
+    // Only intern can revive a symbol without references, and it does so
+    // under the same lock as the sweep.
+    s->refs.fetch_sub(1, std::memory_order_release);
+  }
+  // Frees all unreferenced symbols and returns the number of live ones
+  static size_t size();
+
+private:
+  struct symbol_hash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const {
+      return absl::Hash<std::string_view>()(s);
+    }
+    size_t operator()(const symbol &s) const { return (*this)(s.str); }
+  };
+  struct symbol_eq {
+    using is_transparent = void;
+    static std::string_view view(std::string_view s) { return s; }
+    static std::string_view view(const symbol &s) { return s.str; }
+    template<typename L, typename R>
+    bool operator()(const L &l, const R &r) const {
+      return view(l) == view(r);
+    }
+  };
+
+  static symbol_table &instance();
+  void sweep() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  static constexpr size_t MIN_SWEEP_SIZE = 1024;
+
+  absl::Mutex mutex_;
+  absl::node_hash_set<symbol, symbol_hash, symbol_eq>
+    symbols_ ABSL_GUARDED_BY(mutex_);
+  size_t sweep_at_ ABSL_GUARDED_BY(mutex_) = MIN_SWEEP_SIZE;
+};
+
+}// namespace common
+
+#endif// CPPMON_SYMBOL_TABLE_H
@@ -0,0 +1,140 @@
+#include <task_pool.h>
+
+namespace common {
+namespace {
+  // The pool the current thread works for and the index of its queue
+  thread_local const task_pool *curr_pool = nullptr;
+  thread_local size_t curr_queue = 0;
+
+  std::unique_ptr<task_pool> &global_pool() {
+    static std::unique_ptr<task_pool> pool;
+    return pool;
+  }
+}// namespace
+
+task_pool::task_pool(size_t num_threads) {
+  if (num_threads == 0)
+    num_threads = 1;
+  queues_.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i)
+    queues_.push_back(std::make_unique<task_queue>());
+  workers_.reserve(num_threads - 1);
+  for (size_t i = 1; i < num_threads; ++i)
+    workers_.emplace_back([this, i]() { worker_loop(i); });
+}
+
+task_pool::~task_pool() {
+  {
+    std::lock_guard lock(sleep_mutex_);
+    stopped_ = true;
+  }
+  wake_up_.notify_all();
+  for (auto &worker : workers_)
+    worker.join();
+}
+
+task_pool *task_pool::global() { return global_pool().get(); }
+
+void task_pool::set_global_threads(size_t num_threads) {
+  global_pool().reset();
+  if (num_threads > 1)
+    global_pool() = std::make_unique<task_pool>(num_threads);
+}
+
+void task_pool::execute(task *t) {
+  try {
+    t->fn(t->arg);
+  } catch (...) { t->error = std::current_exception(); }
+  // t may be destroyed by its owner as soon as it is marked as done, so the
+  // waiting owner is notified through the pool
+  t->done.store(true, std::memory_order_release);
+  signal_event();
+}
+
+void task_pool::signal_event() {
+  // Both sides are sequentially consistent: either the waiter sees the new
+  // count and does not block, or this sees the waiter and wakes it up
+  num_events_.fetch_add(1);
+  if (num_waiting_.load() > 0)
+    num_events_.notify_all();
+}
+
+size_t task_pool::own_queue() const {
+  return curr_pool == this ? curr_queue : 0;
+}
+
+void task_pool::push(task *t) {
+  auto &queue = *queues_[own_queue()];
+  {
+    std::lock_guard lock(queue.mutex);
+    queue.tasks.push_back(t);
+  }
+  num_queued_.fetch_add(1);
+  signal_event();
+  if (num_sleeping_.load() > 0) {
+    // Taking the mutex ensures that no worker is between checking
+    // num_queued_ and going to sleep
+    { std::lock_guard lock(sleep_mutex_); }
+    wake_up_.notify_one();
+  }
+}
+
+bool task_pool::try_pop(task *t) {
+  auto &queue = *queues_[own_queue()];
+  std::lock_guard lock(queue.mutex);
+  if (queue.tasks.empty() || queue.tasks.back() != t)
+    return false;
+  queue.tasks.pop_back();
+  num_queued_.fetch_sub(1);
+  return true;
+}
+
+task_pool::task *task_pool::steal(size_t own_idx) {
+  const size_t n = queues_.size();
+  for (size_t i = 1; i < n; ++i) {
+    auto &queue = *queues_[(own_idx + i) % n];
+    std::lock_guard lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task *t = queue.tasks.front();
+      queue.tasks.pop_front();
+      num_queued_.fetch_sub(1);
+      return t;
+    }
+  }
+  return nullptr;
+}
+
+void task_pool::wait_for(task *t) {
+  const size_t own_idx = own_queue();
+  while (!t->done.load(std::memory_order_acquire)) {
+    // read before stealing, so that a push or a finished task in between
+    // ends the wait
+    auto seen = num_events_.load(std::memory_order_acquire);
+    if (task *other = steal(own_idx))
+      execute(other);
+    else if (!t->done.load(std::memory_order_acquire)) {
+      num_waiting_.fetch_add(1);
+      num_events_.wait(seen);
+      num_waiting_.fetch_sub(1);
+    }
+  }
+}
+
+void task_pool::worker_loop(size_t idx) {
+  curr_pool = this;
+  curr_queue = idx;
+  for (;;) {
+    if (task *t = steal(idx)) {
+      execute(t);
+      continue;
+    }
+    std::unique_lock lock(sleep_mutex_);
+    num_sleeping_.fetch_add(1);
+    wake_up_.wait(lock,
+                  [this]() { return stopped_ || num_queued_.load() > 0; });
+    num_sleeping_.fetch_sub(1);
+    if (stopped_)
+      return;
+  }
+}
+}// namespace common
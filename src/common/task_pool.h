@@ -0,0 +1,133 @@
+#ifndef CPPMON_TASK_POOL_H
+#define CPPMON_TASK_POOL_H
+
+#include <atomic>
+#include <boost/container/devector.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace common {
+
+// Work-stealing pool for fork-join parallelism. Every thread working for the
+// pool owns a deque of tasks: it pushes and pops forked tasks at the back,
+// while idle threads steal from the front of the other deques. A thread that
+// waits for a stolen task executes other tasks in the meantime, so nested
+// fork_join calls never block a worker.
+//
+// The thread calling fork_join from outside the pool takes the first deque,
+// hence only one such thread may use the pool at a time.
+class task_pool {
+public:
+  // Starts num_threads - 1 workers, the calling thread is the last one
+  explicit task_pool(size_t num_threads);
+  ~task_pool();
+  task_pool(const task_pool &) = delete;
+  task_pool &operator=(const task_pool &) = delete;
+
+  [[nodiscard]] size_t num_threads() const { return queues_.size(); }
+
+  // Runs f1() and f2(), possibly in parallel, and returns once both are done.
+  // If one of them throws, the exception is rethrown (that of f1 first).
+  template<typename F1, typename F2>
+  void fork_join(F1 &&f1, F2 &&f2) {
+    using F2_t = std::remove_reference_t<F2>;
+    task t2{[](void *f) { (*static_cast<F2_t *>(f))(); },
+            const_cast<void *>(static_cast<const void *>(std::addressof(f2)))};
+    push(&t2);
+    std::exception_ptr f1_error;
+    try {
+      f1();
+    } catch (...) { f1_error = std::current_exception(); }
+    if (try_pop(&t2))
+      execute(&t2);
+    else
+      wait_for(&t2);
+    if (f1_error)
+      std::rethrow_exception(f1_error);
+    if (t2.error)
+      std::rethrow_exception(t2.error);
+  }
+
+  // Calls f(i, j) for disjoint ranges [i, j) covering [lo, hi), splitting
+  // the range in halves as long as they contain at least grain elements
+  template<typename F>
+  void parallel_for(size_t lo, size_t hi, size_t grain, const F &f) {
+    if (hi - lo < 2 * grain) {
+      f(lo, hi);
+      return;
+    }
+    size_t mid = lo + (hi - lo) / 2;
+    fork_join([&]() { parallel_for(lo, mid, grain, f); },
+              [&]() { parallel_for(mid, hi, grain, f); });
+  }
+
+  // The pool used by the monitor, nullptr if it runs sequentially. Only the
+  // thread that steps the monitor may use it from outside: with --pipeline
+  // that is the monitor stage, and sliced_monitor runs its slices as tasks of
+  // this pool rather than on threads of its own. The parser and printer
+  // stages must not fork.
+  static task_pool *global();
+  // Replaces the global pool, num_threads <= 1 disables it
+  static void set_global_threads(size_t num_threads);
+
+private:
+  struct task {
+    void (*fn)(void *);
+    void *arg;
+    std::atomic<bool> done = false;
+    std::exception_ptr error = nullptr;
+  };
+
+  struct alignas(64) task_queue {
+    std::mutex mutex;
+    boost::container::devector<task *> tasks;
+  };
+
+  void execute(task *t);
+  void signal_event();
+  size_t own_queue() const;
+  void push(task *t);
+  // Pops t if no other thread stole it
+  bool try_pop(task *t);
+  task *steal(size_t own_idx);
+  void wait_for(task *t);
+  void worker_loop(size_t idx);
+
+  std::vector<std::unique_ptr<task_queue>> queues_;
+  std::vector<std::thread> workers_;
+  // Number of tasks in all queues, workers sleep while it is 0
+  std::atomic<size_t> num_queued_ = 0;
+  std::atomic<size_t> num_sleeping_ = 0;
+  // Incremented whenever a task is pushed or finished, threads in wait_for
+  // that find nothing to steal wait for it to change
+  std::atomic<std::uint64_t> num_events_ = 0;
+  // Number of threads blocked on num_events_, only they need to be notified
+  std::atomic<size_t> num_waiting_ = 0;
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_up_;
+  bool stopped_ = false;
+};
+
+// Calls f(i, j) for disjoint ranges [i, j) covering [0, n), in parallel on
+// the global pool if there is one. Ranges contain at least grain > 0
+// elements, unless n itself is smaller.
+template<typename F>
+void parallel_for(size_t n, size_t grain, const F &f) {
+  task_pool *pool = task_pool::global();
+  if (n == 0)
+    return;
+  if (pool)
+    pool->parallel_for(0, n, grain, f);
+  else
+    f(0, n);
+}
+
+}// namespace common
+
+#endif// CPPMON_TASK_POOL_H
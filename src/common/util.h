@@ -2,6 +2,7 @@
 #define UTIL_H
 
 #include <absl/container/flat_hash_map.h>
+#include <absl/container/inlined_vector.h>
 #include <algorithm>
 #include <boost/hana.hpp>
 #include <filesystem>
@@ -56,6 +57,12 @@ template<class... Ts>
 overloaded(Ts...) -> overloaded<Ts...>;
 }// namespace detail
 
+// Sequence with inline storage for small sizes. Used for the tuples of event
+// values, whose arity is at most 4 for almost all predicates, so that creating
+// or copying a tuple does not need a heap allocation.
+template<typename T>
+using inline_tuple = absl::InlinedVector<T, 4>;
+
 template<typename T, typename... Rest>
 auto make_vector(T &&e, Rest &&...rest) {
   using elem_ty = std::decay_t<T>;
@@ -3,10 +3,13 @@
 #include <absl/flags/parse.h>
 #include <absl/flags/usage.h>
 #include <absl/strings/string_view.h>
+#include <algorithm>
 #include <config.h>
 #include <file_monitor_driver.h>
 #include <memory>
 #include <string>
+#include <task_pool.h>
+#include <vector>
 
 #ifdef ENABLE_SOCK_INTF
 #include <uds_monitor_driver.h>
@@ -15,15 +18,37 @@ ABSL_FLAG(bool, use_socket, false,
 ABSL_FLAG(std::string, socket_path, "cppmon_uds",
           "path of the unix socket to create");
 #endif
-ABSL_FLAG(std::string, formula, "formula.fo", "path to formula file");
+ABSL_FLAG(std::vector<std::string>, formula,
+          std::vector<std::string>{"formula.fo"},
+          "comma-separated paths to formula files; several formulas are "
+          "monitored on the same trace and their verdicts are tagged with "
+          "the index of the formula");
 ABSL_FLAG(std::string, log, "log.fo", "path to log in monpoly format");
 ABSL_FLAG(std::string, sig, "formula.sig", "path to signature");
 ABSL_FLAG(std::string, vpath, "", "output file of the monitor's verdicts");
+ABSL_FLAG(size_t, batch_size, 1,
+          "number of time points of the log that are monitored in one step; "
+          "larger values increase throughput, but delay verdicts");
+ABSL_FLAG(size_t, batch_bytes, 0,
+          "a batch also ends once its time points take up this many bytes of "
+          "the log; 0 for no limit");
+ABSL_FLAG(bool, pipeline, false,
+          "read the input, monitor and print the verdicts on separate threads");
+ABSL_FLAG(size_t, threads, 1,
+          "number of threads evaluating independent subformulas in parallel");
+ABSL_FLAG(size_t, slices, 1,
+          "number of slices the trace is split into on the values of a free "
+          "variable; every slice is monitored separately on its own thread");
 
 int main(int argc, char *argv[]) {
   absl::SetProgramUsageMessage("MFOTL monitor written in C++");
   absl::ParseCommandLine(argc, argv);
+  common::task_pool::set_global_threads(
+    std::max(absl::GetFlag(FLAGS_threads), absl::GetFlag(FLAGS_slices)));
   std::unique_ptr<monitor_driver> driver;
+  auto formula_flag = absl::GetFlag(FLAGS_formula);
+  std::vector<std::filesystem::path> formula_paths(formula_flag.cbegin(),
+                                                   formula_flag.cend());
   std::optional<std::string> vpath =
     absl::GetFlag(FLAGS_vpath) == ""
       ? std::nullopt
@@ -32,17 +57,22 @@ int main(int argc, char *argv[]) {
 #ifdef ENABLE_SOCK_INTF
   if (absl::GetFlag(FLAGS_use_socket)) {
     driver.reset(new uds_monitor_driver(
-      absl::GetFlag(FLAGS_formula), absl::GetFlag(FLAGS_sig),
-      absl::GetFlag(FLAGS_socket_path), std::move(vpath)));
+      formula_paths, absl::GetFlag(FLAGS_sig),
+      absl::GetFlag(FLAGS_socket_path), std::move(vpath),
+      absl::GetFlag(FLAGS_pipeline), absl::GetFlag(FLAGS_slices)));
   } else {
     driver.reset(new file_monitor_driver(
-      absl::GetFlag(FLAGS_formula), absl::GetFlag(FLAGS_sig),
-      absl::GetFlag(FLAGS_log), std::move(vpath)));
+      formula_paths, absl::GetFlag(FLAGS_sig),
+      absl::GetFlag(FLAGS_log), std::move(vpath),
+      absl::GetFlag(FLAGS_batch_size), absl::GetFlag(FLAGS_batch_bytes),
+      absl::GetFlag(FLAGS_pipeline), absl::GetFlag(FLAGS_slices)));
   }
 #else
   driver.reset(new file_monitor_driver(
-    absl::GetFlag(FLAGS_formula), absl::GetFlag(FLAGS_sig),
-    absl::GetFlag(FLAGS_log), std::move(vpath)));
+    formula_paths, absl::GetFlag(FLAGS_sig),
+    absl::GetFlag(FLAGS_log), std::move(vpath),
+    absl::GetFlag(FLAGS_batch_size), absl::GetFlag(FLAGS_batch_bytes),
+    absl::GetFlag(FLAGS_pipeline), absl::GetFlag(FLAGS_slices)));
 #endif
 
   driver->do_monitor();
@@ -135,7 +135,7 @@ dbgen::sub_form_info dbgen::validate_formula_impl(const Formula &formula,
 void dbgen::update_or_insert(database &db, const std::string &pred_name,
                              const std::vector<int64_t> &pred_args) {
   auto it = db.find(pred_name);
-  std::vector<event_data> ev_dat;
+  parse::database_tuple ev_dat;
   ev_dat.reserve(pred_args.size());
   for (const auto d : pred_args)
     ev_dat.push_back(event_data::Int(d));
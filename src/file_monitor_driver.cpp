@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <config.h>
 #include <database.h>
 #include <file_monitor_driver.h>
@@ -16,17 +17,21 @@ ABSL_FLAG(bool, dump_heap, false, "create a heap dump before terminating");
 #endif
 
 file_monitor_driver::file_monitor_driver(
-  const std::filesystem::path &formula_path,
+  const std::vector<std::filesystem::path> &formula_paths,
   const std::filesystem::path &sig_path, const std::filesystem::path &log_path,
-  std::optional<std::string> verdict_path)
-    : printer_(std::move(verdict_path)) {
+  std::optional<std::string> verdict_path, size_t batch_size,
+  size_t batch_bytes, bool pipelined, size_t num_slices)
+    : batch_size_(std::max(batch_size, size_t(1))), batch_bytes_(batch_bytes),
+      pipelined_(pipelined), printer_(std::move(verdict_path)) {
   using parse::signature;
   using parse::signature_parser;
   using parse::trace_parser;
 
-  std::string formula_file_content = read_file(formula_path);
-  fo::Formula formula(formula_file_content);
-  monitor::monitor tmp_mon(formula);
+  std::vector<fo::Formula> formulas;
+  formulas.reserve(formula_paths.size());
+  for (const auto &formula_path : formula_paths)
+    formulas.emplace_back(read_file(formula_path));
+  formula_monitor tmp_mon(formulas, num_slices);
   signature sig = signature_parser::parse(read_file(sig_path));
 
   trace_parser db_parser(std::move(sig), fo::Formula::get_known_preds());
@@ -38,21 +43,67 @@ file_monitor_driver::file_monitor_driver(
 
 file_monitor_driver::~file_monitor_driver() noexcept = default;
 
-void file_monitor_driver::do_monitor() {
-  // fmt::print("pred map is: {}\n", fo::Formula::get_known_preds());
-  using parse::timestamped_database;
-  std::string db_str;
-  while (std::getline(log_, db_str)) {
-    // fmt::print("asking to parse string: {}\n", db_str);
-    auto [ts, db] = parser_.parse_database(db_str);
-    auto mon_db = monitor::monitor_db_from_parser_db(std::move(db));
-    auto sats = monitor_.step(mon_db, make_vector(ts));
-    printer_.print_verdict(sats);
+namespace {
+void add_to_batch(monitor_input &batch, parse::timestamped_database &&ts_db) {
+  auto &[batch_db, batch_ts] = batch;
+  size_t idx = batch_ts.size();
+  batch_ts.push_back(ts_db.first);
+  for (auto &[pred, elem] : ts_db.second) {
+    if (elem.empty())
+      continue;
+    auto &pred_dbs = batch_db[pred];
+    pred_dbs.resize(idx + 1);
+    pred_dbs[idx] = std::move(elem);
   }
+}
+
+// Creates a heap dump if requested, called before the last step
+void dump_heap() {
 #ifdef USE_JEMALLOC
   if (absl::GetFlag(FLAGS_dump_heap))
     mallctl("prof.dump", NULL, NULL, NULL, 0);
 #endif
+}
+}// namespace
+
+std::optional<monitor_input> file_monitor_driver::next_batch() {
+  std::string db_str;
+  if (batch_size_ == 1) {
+    if (!std::getline(log_, db_str))
+      return std::nullopt;
+    auto [ts, db] = parser_.parse_database(db_str);
+    return monitor_input(monitor::monitor_db_from_parser_db(std::move(db)),
+                         make_vector(ts));
+  }
+  monitor_input batch;
+  size_t num_bytes = 0;
+  while (batch.second.size() < batch_size_ &&
+         (batch_bytes_ == 0 || num_bytes < batch_bytes_) &&
+         std::getline(log_, db_str)) {
+    num_bytes += db_str.size();
+    add_to_batch(batch, parser_.parse_database(db_str));
+  }
+  if (batch.second.empty())
+    return std::nullopt;
+  // predicates that do not occur in the last tps
+  for (auto &[pred, pred_dbs] : batch.first)
+    pred_dbs.resize(batch.second.size());
+  return batch;
+}
+
+void file_monitor_driver::do_monitor() {
+  // fmt::print("pred map is: {}\n", fo::Formula::get_known_preds());
+  if (pipelined_) {
+    pipeline_source source{
+      [this](std::vector<int64_t> &) { return next_batch(); }, {}, {}};
+    run_pipelined(source, monitor_, printer_, dump_heap);
+    return;
+  }
+  while (auto batch = next_batch()) {
+    auto sats = monitor_.step(batch->first, batch->second);
+    printer_.print_verdict(sats);
+  }
+  dump_heap();
   auto sats_last = monitor_.last_step();
   printer_.print_verdict(sats_last);
 }
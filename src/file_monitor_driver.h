@@ -5,21 +5,37 @@
 #include <fstream>
 #include <monitor.h>
 #include <monitor_driver.h>
+#include <slicer.h>
 #include <traceparser.h>
+#include <vector>
 
 class file_monitor_driver : public monitor_driver {
 public:
-  file_monitor_driver(const std::filesystem::path &formula_path,
+  file_monitor_driver(const std::vector<std::filesystem::path> &formula_paths,
                       const std::filesystem::path &sig_path,
                       const std::filesystem::path &log_path,
-                      std::optional<std::string> verdict_path);
+                      std::optional<std::string> verdict_path,
+                      size_t batch_size = 1, size_t batch_bytes = 0,
+                      bool pipelined = false, size_t num_slices = 1);
   ~file_monitor_driver() noexcept override;
   void do_monitor() override;
 
 private:
+  // Parses the next batch_size_ tps, or fewer if they reach batch_bytes_,
+  // nullopt at the end of the log
+  std::optional<monitor_input> next_batch();
+
   parse::trace_parser parser_;
+  // Number of tps (log lines) that are monitored in one step. Larger batches
+  // amortize the per step overhead, but delay the verdicts.
+  size_t batch_size_;
+  // Number of bytes of the log after which a batch ends early, 0 if batches
+  // are only limited by batch_size_. Bounds the memory and the delay of
+  // batches of large tps.
+  size_t batch_bytes_;
+  bool pipelined_;
   std::ifstream log_;
-  monitor::monitor monitor_;
+  formula_monitor monitor_;
   verdict_printer printer_;
 };
 
@@ -1,8 +1,10 @@
 #include <absl/container/flat_hash_set.h>
 #include <algorithm>
+#include <cassert>
 #include <fmt/core.h>
 #include <fmt/ranges.h>
 #include <formula.h>
+#include <functional>
 #include <stdexcept>
 #include <type_traits>
 #include <util.h>
@@ -25,6 +27,10 @@ agg_type agg_type_from_json(const json &json_formula) {
     return agg_type::AVG;
   } else if (agg_ty == "Agg_Med"sv) {
     return agg_type::MED;
+  } else if (agg_ty == "Agg_Approx_Dcnt"sv) {
+    return agg_type::APPROX_DCNT;
+  } else if (agg_ty == "Agg_Approx_Med"sv) {
+    return agg_type::APPROX_MED;
   } else {
     throw std::runtime_error("invalid aggregation type");
   }
@@ -113,7 +119,7 @@ Term::Term(val_type &&val) noexcept : val(std::move(val)) {}
 Term::Term(const val_type &val) : val(copy_val(val)) {}
 
 event_data Term::eval(const vector<size_t> &var_2_idx,
-                      const vector<event_data> &tuple) const {
+                      const inline_tuple<event_data> &tuple) const {
   auto visitor = [&var_2_idx, &tuple](auto &&arg) -> event_data {
     using T = std::decay_t<decltype(arg)>;
     if constexpr (std::is_same_v<T, event_data>) {
@@ -276,6 +282,194 @@ fv_set Term::fvi(size_t num_bound_vars) const {
 }
 fv_set Term::fvs() const { return fvi(0); }
 
+// compiled_term member functions
+bool compiled_term::folds_safely(const Term &t) {
+  auto visitor = [](auto &&arg) -> bool {
+    using T = std::decay_t<decltype(arg)>;
+    if constexpr (any_type_equal_v<T, event_data, Term::var_t>) {
+      return true;
+    } else if constexpr (any_type_equal_v<T, Term::div_t, Term::mod_t>) {
+      if (!folds_safely(*arg.l) || !folds_safely(*arg.r))
+        return false;
+      const auto divisor = arg.r->eval({}, {});
+      const auto *int_divisor = divisor.get_if_int();
+      return !int_divisor || (*int_divisor != 0 && *int_divisor != -1);
+    } else if constexpr (any_type_equal_v<T, Term::f2i_t, Term::i2f_t>) {
+      if (!folds_safely(*arg.t))
+        return false;
+      const auto val = arg.t->eval({}, {});
+      if constexpr (std::is_same_v<T, Term::f2i_t>)
+        return val.get_if_float() != nullptr;
+      else
+        return val.get_if_int() != nullptr;
+    } else if constexpr (std::is_same_v<T, Term::uminus_t>) {
+      return folds_safely(*arg.t);
+    } else if constexpr (any_type_equal_v<T, Term::plus_t, Term::minus_t,
+                                          Term::mult_t>) {
+      return folds_safely(*arg.l) && folds_safely(*arg.r);
+    } else {
+      static_assert(always_false_v<T>, "not exhaustive");
+    }
+  };
+  return var2::visit(visitor, t.val);
+}
+
+compiled_term::compiled_term(const Term &t, const vector<size_t> &var_2_idx)
+    : max_depth_(0) {
+  compile(t, var_2_idx, 0);
+}
+
+void compiled_term::compile(const Term &t, const vector<size_t> &var_2_idx,
+                            size_t depth) {
+  max_depth_ = std::max(max_depth_, depth + 1);
+  if (!t.is_const() && t.fvs().empty() && folds_safely(t)) {
+    consts_.push_back(t.eval({}, {}));
+    code_.push_back({opcode::CONST, consts_.size() - 1});
+    return;
+  }
+  auto bin_op = [this, &var_2_idx, depth](const Term &l, const Term &r,
+                                          opcode op) {
+    compile(l, var_2_idx, depth);
+    compile(r, var_2_idx, depth + 1);
+    code_.push_back({op, 0});
+  };
+  auto un_op = [this, &var_2_idx, depth](const Term &t, opcode op) {
+    compile(t, var_2_idx, depth);
+    code_.push_back({op, 0});
+  };
+  auto visitor = [&](auto &&arg) {
+    using T = std::decay_t<decltype(arg)>;
+    if constexpr (std::is_same_v<T, event_data>) {
+      consts_.push_back(arg);
+      code_.push_back({opcode::CONST, consts_.size() - 1});
+    } else if constexpr (std::is_same_v<T, Term::var_t>) {
+      code_.push_back({opcode::LOAD, var_2_idx[arg.idx]});
+    } else if constexpr (std::is_same_v<T, Term::plus_t>) {
+      bin_op(*arg.l, *arg.r, opcode::PLUS);
+    } else if constexpr (std::is_same_v<T, Term::minus_t>) {
+      bin_op(*arg.l, *arg.r, opcode::MINUS);
+    } else if constexpr (std::is_same_v<T, Term::uminus_t>) {
+      un_op(*arg.t, opcode::UMINUS);
+    } else if constexpr (std::is_same_v<T, Term::mult_t>) {
+      bin_op(*arg.l, *arg.r, opcode::MULT);
+    } else if constexpr (std::is_same_v<T, Term::div_t>) {
+      bin_op(*arg.l, *arg.r, opcode::DIV);
+    } else if constexpr (std::is_same_v<T, Term::mod_t>) {
+      bin_op(*arg.l, *arg.r, opcode::MOD);
+    } else if constexpr (std::is_same_v<T, Term::f2i_t>) {
+      un_op(*arg.t, opcode::F2I);
+    } else if constexpr (std::is_same_v<T, Term::i2f_t>) {
+      un_op(*arg.t, opcode::I2F);
+    } else {
+      static_assert(always_false_v<T>, "not exhaustive");
+    }
+  };
+  var2::visit(visitor, t.val);
+}
+
+event_data compiled_term::eval(const inline_tuple<event_data> &tuple) const {
+  absl::InlinedVector<event_data, 8> stack(max_depth_);
+  size_t sp = 0;
+  for (const auto &ins : code_) {
+    switch (ins.op) {
+      case opcode::CONST:
+        stack[sp++] = consts_[ins.arg];
+        break;
+      case opcode::LOAD:
+        stack[sp++] = tuple[ins.arg];
+        break;
+      case opcode::PLUS:
+        --sp;
+        stack[sp - 1] = stack[sp - 1] + stack[sp];
+        break;
+      case opcode::MINUS:
+        --sp;
+        stack[sp - 1] = stack[sp - 1] - stack[sp];
+        break;
+      case opcode::UMINUS:
+        stack[sp - 1] = -stack[sp - 1];
+        break;
+      case opcode::MULT:
+        --sp;
+        stack[sp - 1] = stack[sp - 1] * stack[sp];
+        break;
+      case opcode::DIV:
+        --sp;
+        stack[sp - 1] = stack[sp - 1] / stack[sp];
+        break;
+      case opcode::MOD:
+        --sp;
+        stack[sp - 1] = stack[sp - 1] % stack[sp];
+        break;
+      case opcode::F2I:
+        stack[sp - 1] = stack[sp - 1].float_to_int();
+        break;
+      case opcode::I2F:
+        stack[sp - 1] = stack[sp - 1].int_to_float();
+        break;
+    }
+  }
+  assert(sp == 1);
+  return stack[0];
+}
+
+void compiled_term::eval_batch(const vector<vector<event_data>> &cols,
+                               size_t n, vector<event_data> &out) const {
+  vector<vector<event_data>> stack(max_depth_);
+  size_t sp = 0;
+  auto bin_op = [&stack, &sp, n](auto op) {
+    --sp;
+    auto &l = stack[sp - 1];
+    const auto &r = stack[sp];
+    for (size_t i = 0; i < n; ++i)
+      l[i] = op(l[i], r[i]);
+  };
+  auto un_op = [&stack, &sp, n](auto op) {
+    auto &t = stack[sp - 1];
+    for (size_t i = 0; i < n; ++i)
+      t[i] = op(t[i]);
+  };
+  for (const auto &ins : code_) {
+    switch (ins.op) {
+      case opcode::CONST:
+        stack[sp++].assign(n, consts_[ins.arg]);
+        break;
+      case opcode::LOAD: {
+        const auto &col = cols[ins.arg];
+        stack[sp++].assign(col.cbegin(),
+                           col.cbegin() + static_cast<std::ptrdiff_t>(n));
+        break;
+      }
+      case opcode::PLUS:
+        bin_op(std::plus<>{});
+        break;
+      case opcode::MINUS:
+        bin_op(std::minus<>{});
+        break;
+      case opcode::UMINUS:
+        un_op(std::negate<>{});
+        break;
+      case opcode::MULT:
+        bin_op(std::multiplies<>{});
+        break;
+      case opcode::DIV:
+        bin_op(std::divides<>{});
+        break;
+      case opcode::MOD:
+        bin_op(std::modulus<>{});
+        break;
+      case opcode::F2I:
+        un_op([](const event_data &d) { return d.float_to_int(); });
+        break;
+      case opcode::I2F:
+        un_op([](const event_data &d) { return d.int_to_float(); });
+        break;
+    }
+  }
+  assert(sp == 1);
+  out = std::move(stack[0]);
+}
+
 // Formula member functions
 size_t Formula::formula_id_counter = 0;
 std::uint32_t Formula::pred_id_counter = USER_PRED;
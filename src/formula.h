@@ -8,6 +8,7 @@
 #include <boost/operators.hpp>
 #include <boost/variant2/variant.hpp>
 #include <cstddef>
+#include <cstdint>
 #include <event_data.h>
 #include <memory>
 #include <nlohmann/json.hpp>
@@ -23,6 +24,7 @@
 namespace monitor::detail {
 class MState;
 struct MPred;
+class slicer;
 }// namespace monitor::detail
 
 class dbgen;
@@ -48,7 +50,10 @@ enum class agg_type
   MAX,
   SUM,
   AVG,
-  MED
+  MED,
+  // approximate, with memory bounded independently of the number of values
+  APPROX_DCNT,
+  APPROX_MED
 };
 
 agg_type agg_type_from_json(const json &json_formula);
@@ -66,9 +71,11 @@ template<typename T>
 using ptr_type = std::unique_ptr<T>;
 
 struct Formula;
+class compiled_term;
 
 struct Term : equality_comparable<Term> {
   friend Formula;
+  friend compiled_term;
   friend ::monitor::detail::MPred;
   friend ::dbgen;
   friend class ::monitor::detail::MState;
@@ -94,7 +101,25 @@ public:
   [[nodiscard]] const event_data *get_if_const() const;
   [[nodiscard]] fv_set fvs() const;
   [[nodiscard]] event_data eval(const vector<size_t> &var_2_idx,
-                                const vector<event_data> &tuple) const;
+                                const inline_tuple<event_data> &tuple) const;
+  // Structural, consistent with operator==
+  template<typename H>
+  friend H AbslHashValue(H h, const Term &t) {
+    h = H::combine(std::move(h), t.val.index());
+    return var2::visit(
+      [&h](const auto &arg) -> H {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, var_t>)
+          return H::combine(std::move(h), arg.idx);
+        else if constexpr (std::is_same_v<T, event_data>)
+          return H::combine(std::move(h), arg);
+        else if constexpr (any_type_equal_v<T, uminus_t, f2i_t, i2f_t>)
+          return H::combine(std::move(h), *arg.t);
+        else
+          return H::combine(std::move(h), *arg.l, *arg.r);
+      },
+      t.val);
+  }
 
 private:
   struct var_t {
@@ -138,6 +163,49 @@ private:
   val_type val;
 };
 
+// A term flattened into postfix code for a stack machine. Variables are
+// resolved to tuple positions and variable-free subterms are folded into
+// constants when compiling, so evaluating walks a flat instruction array
+// instead of the Term tree.
+class compiled_term {
+public:
+  compiled_term(const Term &t, const vector<size_t> &var_2_idx);
+  [[nodiscard]] event_data eval(const inline_tuple<event_data> &tuple) const;
+  // Column-at-a-time version of eval: evaluates the term for the first n rows
+  // of a batch given column by column and writes the n results to out
+  void eval_batch(const vector<vector<event_data>> &cols, size_t n,
+                  vector<event_data> &out) const;
+
+private:
+  enum class opcode : std::uint8_t
+  {
+    CONST,
+    LOAD,
+    PLUS,
+    MINUS,
+    UMINUS,
+    MULT,
+    DIV,
+    MOD,
+    F2I,
+    I2F
+  };
+  struct instr {
+    opcode op;
+    // index into consts_ for CONST, tuple position for LOAD
+    size_t arg;
+  };
+  // Whether evaluating the variable-free term t cannot fail. Integer
+  // divisions by 0 (and of the minimum by -1) trap and the conversions
+  // require an operand of the right type, so such subterms are left to fail
+  // when the term is evaluated rather than when the formula is built.
+  static bool folds_safely(const Term &t);
+  void compile(const Term &t, const vector<size_t> &var_2_idx, size_t depth);
+  vector<instr> code_;
+  vector<event_data> consts_;
+  size_t max_depth_;
+};
+
 class Interval : equality_comparable<Interval> {
   friend Formula;
 
@@ -151,6 +219,12 @@ public:
   [[nodiscard]] bool contains(size_t n) const;
   [[nodiscard]] bool is_bounded() const;
   [[nodiscard]] size_t get_lower() const;
+  template<typename H>
+  friend H AbslHashValue(H h, const Interval &inter) {
+    if (inter.bounded_)
+      return H::combine(std::move(h), true, inter.l_, inter.u_);
+    return H::combine(std::move(h), false, inter.l_);
+  }
   template<typename Rnd>
   size_t random_sample(Rnd &bitgen) const {
     if (!bounded_)
@@ -166,6 +240,7 @@ private:
 
 struct Formula : equality_comparable<Formula> {
   friend class ::monitor::detail::MState;
+  friend class ::monitor::detail::slicer;
   friend class ::dbgen;
 
 public:
@@ -198,6 +273,34 @@ public:
   [[nodiscard]] bool is_safe_assignment(const fv_set &vars) const;
   [[nodiscard]] bool is_safe_formula() const;
   [[nodiscard]] bool is_always_true() const;
+  // Structural, consistent with operator==
+  template<typename H>
+  friend H AbslHashValue(H h, const Formula &f) {
+    h = H::combine(std::move(h), f.val.index());
+    return var2::visit(
+      [&h](const auto &arg) -> H {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, pred_t>)
+          return H::combine(std::move(h), arg.pred_id, arg.pred_args);
+        else if constexpr (any_type_equal_v<T, eq_t, less_t, less_eq_t>)
+          return H::combine(std::move(h), arg.l, arg.r);
+        else if constexpr (any_type_equal_v<T, neg_t, exists_t>)
+          return H::combine(std::move(h), *arg.phi);
+        else if constexpr (any_type_equal_v<T, or_t, and_t>)
+          return H::combine(std::move(h), *arg.phil, *arg.phir);
+        else if constexpr (any_type_equal_v<T, prev_t, next_t>)
+          return H::combine(std::move(h), arg.inter, *arg.phi);
+        else if constexpr (any_type_equal_v<T, since_t, until_t>)
+          return H::combine(std::move(h), arg.inter, *arg.phil, *arg.phir);
+        else if constexpr (std::is_same_v<T, agg_t>)
+          return H::combine(std::move(h), arg.ty, arg.res_var,
+                            arg.num_bound_vars, arg.default_value,
+                            arg.agg_term, *arg.phi);
+        else
+          return H::combine(std::move(h), arg.pred_id, *arg.phi, *arg.psi);
+      },
+      f.val);
+  }
 
 
 private:
@@ -0,0 +1,57 @@
+#include <join_index.h>
+
+namespace monitor::detail {
+join_index::join_index(std::vector<size_t> key_idxs)
+    : key_idxs_(std::move(key_idxs)) {}
+
+void join_index::apply(table_delta &delta) {
+  for (auto &[row, is_insert] : delta) {
+    auto key = filter_row(key_idxs_, row);
+    if (is_insert) {
+      if (buckets_[std::move(key)].insert(std::move(row)).second)
+        n_rows_++;
+    } else {
+      // Like a row that is missing from its bucket, a row without a bucket
+      // was never inserted and there is nothing to delete
+      auto it = buckets_.find(key);
+      if (it == buckets_.end())
+        continue;
+      if (it->second.erase(row) > 0)
+        n_rows_--;
+      if (it->second.empty())
+        buckets_.erase(it);
+    }
+  }
+}
+
+opt_table join_index::natural_join(const opt_table &tab,
+                                   const join_info &info) const {
+  if (!tab || empty())
+    return {};
+  event_table res(info.result_layout.size());
+  for (const auto &row : *tab) {
+    auto it = buckets_.find(filter_row(info.comm_idx1, row));
+    if (it == buckets_.end())
+      continue;
+    for (const auto &match : it->second) {
+      event new_row(row->cbegin(), row->cend());
+      for (size_t idx : info.keep_idx2)
+        new_row.push_back((*match)[idx]);
+      res.add_row(std::move(new_row));
+    }
+  }
+  return res.empty() ? opt_table() : std::move(res);
+}
+
+opt_table join_index::anti_join(const opt_table &tab,
+                                const anti_join_info &info) const {
+  if (!tab || empty())
+    return tab;
+  event_table res(info.result_layout.size());
+  for (const auto &row : *tab) {
+    if (!buckets_.contains(filter_row(info.comm_idx1, row)))
+      res.add_row(row);
+  }
+  return res.empty() ? opt_table() : std::move(res);
+}
+}// namespace monitor::detail
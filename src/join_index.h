@@ -0,0 +1,35 @@
+#ifndef CPPMON_JOIN_INDEX_H
+#define CPPMON_JOIN_INDEX_H
+
+#include <hash_cache.h>
+#include <monitor_types.h>
+#include <table.h>
+#include <vector>
+
+namespace monitor::detail {
+// Hash index of a table on a fixed set of key columns that is maintained
+// incrementally from the deltas of the operator producing the table, instead
+// of being rebuilt from the whole table at every time point.
+class join_index {
+public:
+  explicit join_index(std::vector<size_t> key_idxs);
+
+  void apply(table_delta &delta);
+  [[nodiscard]] size_t size() const { return n_rows_; }
+  [[nodiscard]] bool empty() const { return n_rows_ == 0; }
+
+  // Same results as table::natural_join and table::anti_join with the
+  // indexed table as the right operand
+  opt_table natural_join(const opt_table &tab, const join_info &info) const;
+  opt_table anti_join(const opt_table &tab, const anti_join_info &info) const;
+
+private:
+  using bucket_t = common::hash_cached_set<event>;
+
+  std::vector<size_t> key_idxs_;
+  common::hash_cached_map<event, bucket_t> buckets_;
+  size_t n_rows_ = 0;
+};
+}// namespace monitor::detail
+
+#endif// CPPMON_JOIN_INDEX_H
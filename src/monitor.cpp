@@ -1,5 +1,7 @@
+#include <bit>
 #include <fmt/core.h>
 #include <monitor.h>
+#include <utility>
 
 namespace monitor::detail {
 static parse::database_tuple remove_col(parse::database_tuple &row,
@@ -34,6 +36,9 @@ monitor::monitor(const Formula &formula) : curr_tp_(0) {
   }
   assert(layout_fvs == formula.fvs());
 #endif
+  // The root does not produce deltas: the verdicts are full tables, which
+  // would have to be kept next to the state, while its result runs already
+  // repeat unchanged results without copying them
   state_ = MState(std::move(state_tmp));
   output_var_permutation_ =
     find_permutation(id_permutation(layout_tmp.size()), layout_tmp);
@@ -45,21 +50,25 @@ satisfactions monitor::step(database &db, const ts_list &ts) {
     tp_ts_map_.emplace(max_tp_, t);
     max_tp_++;
   }
-  auto sats = state_.eval(db, ts);
+  auto sats = state_.eval_runs(db, ts);
   satisfactions transformed_sats;
   transformed_sats.reserve(sats.size());
-  size_t new_curr_tp = curr_tp_;
-  size_t n = sats.size();
-  for (size_t i = 0; i < n; ++i, ++new_curr_tp) {
-    auto output_tab = sats[i] ? sats[i]->make_verdicts(output_var_permutation_)
-                              : vector<vector<common::event_data>>();
-    auto it = tp_ts_map_.find(new_curr_tp);
-    if (it->second < MAXIMUM_TIMESTAMP)
-      transformed_sats.emplace_back(it->second, new_curr_tp,
-                                    std::move(output_tab));
-    tp_ts_map_.erase(it);
-  }
-  curr_tp_ = new_curr_tp;
+  for (auto &[n, sat] : sats.runs()) {
+    // A run's verdicts are copied for all but its last tp
+    auto output_tab = sat ? sat->make_verdicts(output_var_permutation_)
+                          : vector<event>();
+    for (size_t i = 1; i <= n; ++i, ++curr_tp_) {
+      auto it = tp_ts_map_.find(curr_tp_);
+      if (it->second < MAXIMUM_TIMESTAMP) {
+        if (i < n)
+          transformed_sats.emplace_back(it->second, curr_tp_, output_tab);
+        else
+          transformed_sats.emplace_back(it->second, curr_tp_,
+                                        std::move(output_tab));
+      }
+      tp_ts_map_.erase(it);
+    }
+  }
   return transformed_sats;
 }
 
@@ -68,17 +77,95 @@ satisfactions monitor::last_step() {
   return step(db, make_vector(static_cast<size_t>(MAXIMUM_TIMESTAMP)));
 }
 
+void monitor::erase_rows_if(const row_filter &filter) {
+  state_.erase_rows_if(filter, 0);
+}
+
+bool monitor::has_rows(const row_filter &filter) const {
+  return state_.has_rows(filter, 0);
+}
+
+// Multi monitor methods
+multi_monitor::multi_monitor(const vector<Formula> &formulas) {
+  shared_subformulas shared(formulas);
+  MState::sharing_ = &shared;
+  try {
+    monitors_.reserve(formulas.size());
+    for (const auto &formula : formulas)
+      monitors_.emplace_back(formula);
+  } catch (...) {
+    MState::sharing_ = nullptr;
+    throw;
+  }
+  MState::sharing_ = nullptr;
+  shared_ = std::move(shared.entries);
+  contains_let_ = std::any_of(
+    monitors_.cbegin(), monitors_.cend(),
+    [](const monitor &mon) { return mon.state_.contains_let; });
+}
+
+vector<satisfactions> multi_monitor::step(database &db, const ts_list &ts) {
+  // The entries are ordered such that the shared states an entry refers to
+  // are evaluated before it
+  for (auto &entry : shared_)
+    *entry.res = entry.state.eval_runs(db, ts);
+  vector<satisfactions> res(monitors_.size());
+  auto step_range = [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; ++i)
+      res[i] = monitors_[i].step(db, ts);
+  };
+  if (contains_let_)
+    step_range(0, monitors_.size());
+  else
+    common::parallel_for(monitors_.size(), 1, step_range);
+  for (auto &entry : shared_)
+    *entry.res = {};
+  return res;
+}
+
+vector<satisfactions> multi_monitor::last_step() {
+  database db;
+  return step(db, make_vector(static_cast<size_t>(MAXIMUM_TIMESTAMP)));
+}
+
+shared_subformulas::shared_subformulas(const vector<Formula> &formulas) {
+  for (const auto &formula : formulas)
+    MState::count_subformulas(formula, *this);
+}
+
 // MState methods
-MState::MState(val_type &&state) : state(std::move(state)) {}
+MState::MState(val_type &&state) : state(std::move(state)) {
+  var2::visit(
+    [this](const auto &arg) {
+      using T = std::decay_t<decltype(arg)>;
+      if constexpr (any_type_equal_v<T, MRel, MShared>)
+        eval_weight = 0;
+      else if constexpr (any_type_equal_v<T, MPred, MNeg, MPrev, MNext,
+                                          MFusedUnaryOps, MLet>)
+        eval_weight = 1;
+      else if constexpr (any_type_equal_v<T, MAnd, MMultiAnd, MOr, MAgg>)
+        eval_weight = 2;
+      else
+        eval_weight = 4;
+      contains_let = std::is_same_v<T, MLet>;
+    },
+    this->state);
+  for_each_child([this](const MState &child) {
+    eval_weight += child.eval_weight;
+    contains_let = contains_let || child.contains_let;
+  });
+}
 
 event_table_vec MState::eval(database &db, const ts_list &ts) {
   auto visitor = [&db, &ts](auto &&arg) -> event_table_vec {
     using T = std::decay_t<decltype(arg)>;
-    if constexpr (any_type_equal_v<T, MPred, MNeg, MLet, MRel, MFusedUnaryOps,
-                                   MAnd, MOr, MNext, MPrev, MSince<since_impl>,
+    if constexpr (any_type_equal_v<T, MPred, MNeg, MRel, MAnd, MOr, MPrev,
+                                   MNext, MSince<since_impl>,
                                    MSince<since_agg_impl>, MOnce<once_impl>,
                                    MOnce<once_agg_impl>, MUntil, MEventually,
-                                   MAgg>) {
+                                   MAgg, MLet, MShared>) {
+      return arg.eval_runs(db, ts).expand();
+    } else if constexpr (any_type_equal_v<T, MFusedUnaryOps, MMultiAnd>) {
       return arg.eval(db, ts);
     } else {
       throw not_implemented_error();
@@ -87,6 +174,122 @@ event_table_vec MState::eval(database &db, const ts_list &ts) {
   return var2::visit(visitor, state);
 }
 
+event_table_runs MState::eval_runs(database &db, const ts_list &ts) {
+  auto visitor = [this, &db, &ts](auto &&arg) -> event_table_runs {
+    using T = std::decay_t<decltype(arg)>;
+    if constexpr (any_type_equal_v<T, MPred, MNeg, MRel, MAnd, MOr, MPrev,
+                                   MNext, MSince<since_impl>,
+                                   MSince<since_agg_impl>, MOnce<once_impl>,
+                                   MOnce<once_agg_impl>, MUntil, MEventually,
+                                   MAgg, MLet, MShared>)
+      return arg.eval_runs(db, ts);
+    else
+      return event_table_runs(eval(db, ts));
+  };
+  return var2::visit(visitor, state);
+}
+
+std::vector<table_delta> MState::eval_deltas(database &db, const ts_list &ts) {
+  auto visitor = [&db, &ts](auto &&arg) -> std::vector<table_delta> {
+    using T = std::decay_t<decltype(arg)>;
+    if constexpr (any_type_equal_v<T, MSince<since_impl>, MOnce<once_impl>,
+                                   MOr>) {
+      return arg.eval_deltas(db, ts);
+    } else {
+      throw std::runtime_error("operator does not produce deltas");
+    }
+  };
+  return var2::visit(visitor, state);
+}
+
+bool MState::supports_deltas(const val_type &state) {
+  if (const auto *or_ptr = var2::get_if<MOr>(&state)) {
+    return supports_deltas(or_ptr->l_state->state) &&
+           supports_deltas(or_ptr->r_state->state);
+  }
+  return var2::holds_alternative<MSince<since_impl>>(state) ||
+         var2::holds_alternative<MOnce<once_impl>>(state);
+}
+
+bool MState::enable_deltas(val_type &state) {
+  if (!supports_deltas(state))
+    return false;
+  if (auto *since_ptr = var2::get_if<MSince<since_impl>>(&state)) {
+    since_ptr->impl.enable_deltas();
+  } else if (auto *once_ptr = var2::get_if<MOnce<once_impl>>(&state)) {
+    once_ptr->impl.enable_deltas();
+  } else {
+    auto &or_state = var2::get<MOr>(state);
+    enable_deltas(or_state.l_state->state);
+    enable_deltas(or_state.r_state->state);
+  }
+  return true;
+}
+
+std::optional<row_filter::row_pred>
+row_filter::for_layout(const table_layout &layout,
+                       size_t num_bound_vars) const {
+  auto col_of = [&layout, num_bound_vars](size_t v) -> std::optional<size_t> {
+    auto it = std::find(layout.cbegin(), layout.cend(), v + num_bound_vars);
+    if (it == layout.cend())
+      return std::nullopt;
+    return static_cast<size_t>(std::distance(layout.cbegin(), it));
+  };
+  auto col = col_of(var);
+  if (!col)
+    return std::nullopt;
+  return row_pred{this, *col, sub_var ? col_of(*sub_var) : std::nullopt};
+}
+
+void MState::erase_rows_if(const row_filter &filter, size_t num_bound_vars) {
+  var2::visit(
+    [&filter, num_bound_vars](auto &arg) {
+      using T = std::decay_t<decltype(arg)>;
+      if constexpr (requires { arg.layout; }) {
+        size_t n = num_bound_vars;
+        if constexpr (requires { arg.num_bound_vars; })
+          n += arg.num_bound_vars;
+        if (auto drop = filter.for_layout(arg.layout, n))
+          arg.impl.erase_tuples_if(*drop);
+      }
+      if constexpr (std::is_same_v<T, MUntil>) {
+        if (auto drop = filter.for_layout(arg.l_layout, num_bound_vars))
+          arg.impl.erase_left_tuples_if(*drop);
+      }
+    },
+    state);
+  for_each_scoped_child(*this, [&filter, num_bound_vars](MState &child,
+                                                         size_t n) {
+    child.erase_rows_if(filter, num_bound_vars + n);
+  });
+}
+
+bool MState::has_rows(const row_filter &filter, size_t num_bound_vars) const {
+  bool found = var2::visit(
+    [&filter, num_bound_vars](const auto &arg) {
+      using T = std::decay_t<decltype(arg)>;
+      if constexpr (requires { arg.layout; }) {
+        size_t n = num_bound_vars;
+        if constexpr (requires { arg.num_bound_vars; })
+          n += arg.num_bound_vars;
+        auto pred = filter.for_layout(arg.layout, n);
+        if (pred && arg.impl.any_tuple(*pred))
+          return true;
+      }
+      if constexpr (std::is_same_v<T, MUntil>) {
+        auto pred = filter.for_layout(arg.l_layout, num_bound_vars);
+        if (pred && arg.impl.any_left_tuple(*pred))
+          return true;
+      }
+      return false;
+    },
+    state);
+  for_each_scoped_child(*this, [&](const MState &child, size_t n) {
+    found = found || child.has_rows(filter, num_bound_vars + n);
+  });
+  return found;
+}
+
 MState::init_pair MState::init_and_rel_state(const fo::Formula::and_t &arg) {
   const auto &phil = *arg.phil;
   const auto *phir = arg.phir.get();
@@ -117,7 +320,8 @@ MState::init_pair MState::init_and_rel_state(const fo::Formula::and_t &arg) {
   }
   auto var_2_idx = get_sparse_var_2_idx(rec_layout);
   auto and_rel_node =
-    MFusedUnaryOps::AndRel{std::move(var_2_idx), *t1, *t2, cst_type, cst_neg};
+    MFusedUnaryOps::AndRel{fo::compiled_term(*t1, var_2_idx),
+                           fo::compiled_term(*t2, var_2_idx), cst_type, cst_neg};
 
   return combine_fused_state(std::move(and_rel_node), std::move(rec_layout),
                              std::move(rec_state));
@@ -154,7 +358,7 @@ MState::init_pair MState::init_and_safe_assign(const fo::Formula &phil,
     rec_layout.push_back(new_var);
 
     auto and_ass_node = MFusedUnaryOps::AndAssign{
-      std::move(var_2_idx), *trm_to_eval, rec_layout.size()};
+      fo::compiled_term(*trm_to_eval, var_2_idx), rec_layout.size()};
 
     return combine_fused_state(std::move(and_ass_node), std::move(rec_layout),
                                std::move(rec_state));
@@ -189,26 +393,10 @@ event_table_vec MState::MFusedUnaryOps::eval(database &db, const ts_list &ts) {
       res_tabs.emplace_back(std::nullopt);
     } else {
       event_table new_tab(nfvs);
-      for (auto &row : *tab) {
-        assert(!un_ops.empty());
-        parse::database_tuple last_res = std::move(row);
-        bool is_empty = false;
-        for (auto &op : un_ops) {
-          auto visitor =
-            [&last_res](auto &&arg) -> std::optional<parse::database_tuple> {
-            return arg.eval(last_res);
-          };
-          auto new_res = var2::visit(visitor, op);
-          if (new_res)
-            last_res = std::move(*new_res);
-          else {
-            is_empty = true;
-            break;
-          }
-        }
-        if (!is_empty)
-          new_tab.add_row(std::move(last_res));
-      }
+      if (tab->tab_size() < MIN_BATCH_ROWS)
+        eval_rows(*tab, new_tab);
+      else
+        eval_batches(*tab, new_tab);
       if (new_tab.empty())
         res_tabs.emplace_back(std::nullopt);
       else
@@ -218,9 +406,71 @@ event_table_vec MState::MFusedUnaryOps::eval(database &db, const ts_list &ts) {
   return res_tabs;
 }
 
-std::optional<parse::database_tuple>
-MState::MFusedUnaryOps::AndRel::eval(parse::database_tuple &row) {
-  auto l_res = l.eval(var_2_idx, row), r_res = r.eval(var_2_idx, row);
+void MState::MFusedUnaryOps::eval_rows(const event_table &tab,
+                                       event_table &new_tab) {
+  for (const auto &row : tab) {
+    assert(!un_ops.empty());
+    parse::database_tuple last_res = *row;
+    bool is_empty = false;
+    for (auto &op : un_ops) {
+      auto visitor =
+        [&last_res](auto &&arg) -> std::optional<parse::database_tuple> {
+        return arg.eval(last_res);
+      };
+      auto new_res = var2::visit(visitor, op);
+      if (new_res)
+        last_res = std::move(*new_res);
+      else {
+        is_empty = true;
+        break;
+      }
+    }
+    if (!is_empty)
+      new_tab.add_row(std::move(last_res));
+  }
+}
+
+void MState::MFusedUnaryOps::eval_batches(const event_table &tab,
+                                          event_table &new_tab) {
+  assert(!un_ops.empty());
+  column_batch batch;
+  size_t nrows = 0;
+  auto flush = [this, &batch, &nrows, &new_tab]() {
+    for (auto &op : un_ops) {
+      var2::visit([&batch, &nrows](auto &&arg) { arg.eval_batch(batch, nrows); },
+                  op);
+      if (nrows == 0)
+        return;
+    }
+    for (size_t i = 0; i < nrows; ++i) {
+      event row;
+      row.reserve(batch.size());
+      for (const auto &col : batch)
+        row.push_back(col[i]);
+      new_tab.add_row(std::move(row));
+    }
+  };
+  for (const auto &row : tab) {
+    if (nrows == 0) {
+      batch.resize(row->size());
+      for (auto &col : batch) {
+        col.clear();
+        col.reserve(BATCH_ROWS);
+      }
+    }
+    for (size_t i = 0; i < row->size(); ++i)
+      batch[i].push_back((*row)[i]);
+    if (++nrows == BATCH_ROWS) {
+      flush();
+      nrows = 0;
+    }
+  }
+  if (nrows > 0)
+    flush();
+}
+
+bool MState::MFusedUnaryOps::AndRel::holds(const event_data &l_res,
+                                           const event_data &r_res) const {
   bool keep;
   if (cst_type == CST_EQ)
     keep = l_res == r_res;
@@ -230,21 +480,57 @@ MState::MFusedUnaryOps::AndRel::eval(parse::database_tuple &row) {
     assert(cst_type == CST_LESS_EQ);
     keep = l_res <= r_res;
   }
-  if (cst_neg)
-    keep = !keep;
-  if (!keep)
+  return keep != cst_neg;
+}
+
+std::optional<parse::database_tuple>
+MState::MFusedUnaryOps::AndRel::eval(parse::database_tuple &row) {
+  auto l_res = l.eval(row), r_res = r.eval(row);
+  if (!holds(l_res, r_res))
     return {};
   else
     return std::move(row);
 }
 
+void MState::MFusedUnaryOps::AndRel::eval_batch(column_batch &batch,
+                                                size_t &nrows) {
+  vector<event_data> l_res, r_res;
+  l.eval_batch(batch, nrows, l_res);
+  r.eval_batch(batch, nrows, r_res);
+  vector<std::uint64_t> mask((nrows + 63) / 64);
+  size_t nkeep = 0;
+  for (size_t i = 0; i < nrows; ++i) {
+    bool keep = holds(l_res[i], r_res[i]);
+    mask[i / 64] |= std::uint64_t{keep} << (i % 64);
+    nkeep += keep;
+  }
+  if (nkeep == nrows)
+    return;
+  for (auto &col : batch) {
+    size_t out = 0;
+    for (size_t w = 0; w < mask.size(); ++w) {
+      for (std::uint64_t m = mask[w]; m != 0; m &= m - 1)
+        col[out++] = col[w * 64 + static_cast<size_t>(std::countr_zero(m))];
+    }
+    col.resize(nkeep);
+  }
+  nrows = nkeep;
+}
+
 std::optional<parse::database_tuple>
 MState::MFusedUnaryOps::AndAssign::eval(parse::database_tuple &row) {
-  auto t_eval = t.eval(var_2_idx, row);
+  auto t_eval = t.eval(row);
   row.push_back(std::move(t_eval));
   return std::move(row);
 }
 
+void MState::MFusedUnaryOps::AndAssign::eval_batch(column_batch &batch,
+                                                   size_t &nrows) {
+  vector<event_data> res;
+  t.eval_batch(batch, nrows, res);
+  batch.push_back(std::move(res));
+}
+
 std::optional<parse::database_tuple>
 MState::MFusedUnaryOps::Exists::eval(parse::database_tuple &row) {
   if (drop_idx) {
@@ -254,6 +540,12 @@ MState::MFusedUnaryOps::Exists::eval(parse::database_tuple &row) {
   }
 }
 
+void MState::MFusedUnaryOps::Exists::eval_batch(column_batch &batch,
+                                                size_t &) {
+  if (drop_idx)
+    batch.erase(batch.begin() + static_cast<std::ptrdiff_t>(*drop_idx));
+}
+
 MState::init_pair MState::init_eq_state(const fo::Formula::eq_t &arg) {
   const auto &r = arg.l, &l = arg.r;
   const auto *lcst = l.get_if_const(), *rcst = r.get_if_const();
@@ -280,17 +572,71 @@ MState::init_pair MState::init_and_join_state(const fo::Formula &phil,
                                               bool right_negated) {
   auto [l_state, l_layout] = init_mstate(phil);
   auto [r_state, r_layout] = init_mstate(phir);
+  // The right operand of a join is the side that is hashed. Results of
+  // temporal operators change slowly, so if one of the operands is one, keep
+  // it on the right and maintain its index incrementally.
+  bool swapped = false;
+  if (!right_negated && !enable_deltas(r_state) && enable_deltas(l_state)) {
+    std::swap(l_state, r_state);
+    std::swap(l_layout, r_layout);
+    swapped = true;
+  }
+  bool incremental = enable_deltas(r_state);
+  MAnd res{binary_buffer(), uniq(std::move(l_state)), uniq(std::move(r_state)),
+           {}};
+  table_layout layout;
+  vector<size_t> idx_key;
   if (right_negated) {
     auto info = get_anti_join_info(l_layout, r_layout);
-    return {MAnd{binary_buffer(), uniq(std::move(l_state)),
-                 uniq(std::move(r_state)), info},
-            info.result_layout};
+    idx_key = info.comm_idx2;
+    layout = info.result_layout;
+    res.op_info = std::move(info);
   } else {
     auto info = get_join_info(l_layout, r_layout);
-    return {MAnd{binary_buffer(), uniq(std::move(l_state)),
-                 uniq(std::move(r_state)), info},
-            info.result_layout};
+    idx_key = info.comm_idx2;
+    layout = info.result_layout;
+    res.op_info = std::move(info);
   }
+  if (incremental) {
+    res.r_index.emplace(std::move(idx_key));
+    res.swapped = swapped;
+  }
+  return {std::move(res), std::move(layout)};
+}
+
+bool MState::is_positive_join(const fo::Formula::and_t &arg) {
+  const auto &phil = *arg.phil, &phir = *arg.phir;
+  return !phir.is_safe_assignment(phil.fvs()) && phir.is_safe_formula();
+}
+
+// Flattens nested conjunctions that are all compiled to natural joins
+void MState::collect_join_operands(const fo::Formula &formula,
+                                   vector<const fo::Formula *> &operands) {
+  const auto *and_ptr = var2::get_if<fo::Formula::and_t>(&formula.val);
+  if (and_ptr && is_positive_join(*and_ptr)) {
+    collect_join_operands(*and_ptr->phil, operands);
+    collect_join_operands(*and_ptr->phir, operands);
+  } else {
+    operands.push_back(&formula);
+  }
+}
+
+MState::init_pair
+MState::init_multi_and_state(const vector<const fo::Formula *> &operands) {
+  assert(operands.size() >= 3);
+  MMultiAnd res{nary_buffer(operands.size()), {}, {}, {}};
+  res.states.reserve(operands.size());
+  res.layouts.reserve(operands.size());
+  for (const auto *op : operands) {
+    auto [op_state, op_layout] = init_mstate(*op);
+    res.states.push_back(uniq(std::move(op_state)));
+    res.layouts.push_back(std::move(op_layout));
+  }
+  res.res_layout = res.layouts[0];
+  for (size_t i = 1; i < res.layouts.size(); ++i)
+    res.res_layout = get_join_info(res.res_layout, res.layouts[i]).result_layout;
+  auto layout = res.res_layout;
+  return {std::move(res), std::move(layout)};
 }
 
 MState::init_pair MState::init_and_state(const fo::Formula::and_t &arg) {
@@ -298,6 +644,11 @@ MState::init_pair MState::init_and_state(const fo::Formula::and_t &arg) {
   if (phir.is_safe_assignment(phil.fvs())) {
     return init_and_safe_assign(*arg.phil, *arg.phir);
   } else if (phir.is_safe_formula()) {
+    vector<const fo::Formula *> operands;
+    collect_join_operands(phil, operands);
+    collect_join_operands(phir, operands);
+    if (operands.size() >= 3)
+      return init_multi_and_state(operands);
     return init_and_join_state(*arg.phil, *arg.phir, false);
   } else if (phir.is_constraint()) {
     return init_and_rel_state(arg);
@@ -331,8 +682,9 @@ MState::init_pair MState::init_pred_state(const fo::Formula::pred_t &arg) {
                            arg.is_builtin,
                            arg.pred_id,
                            arg.pred_args,
-                           std::move(var_pos),
-                           std::move(pos_2_cst)};
+                           var_pos,
+                           pos_2_cst,
+                           pred_filter(pos_2_cst, var_pos)};
   return {std::move(mpred_state), lay};
 }
 
@@ -368,21 +720,37 @@ MState::init_pair MState::init_agg_state(const fo::Formula::agg_t &arg) {
     auto impl = agg_temporal::temporal_aggregation_impl(
       rec_layout.second, arg.agg_term, arg.default_value, arg.ty, arg.res_var,
       arg.num_bound_vars);
-    return init_since_until(*since_ptr, std::move(impl));
+    auto res = init_since_until(*since_ptr, std::move(impl));
+    var2::visit(
+      [&arg](auto &st) {
+        if constexpr (requires { st.num_bound_vars; })
+          st.num_bound_vars = arg.num_bound_vars;
+      },
+      res.first);
+    return res;
   } else {
     auto [rec_state, rec_layout] = init_mstate(*arg.phi);
     auto impl =
       agg_base::aggregation_impl(rec_layout, arg.agg_term, arg.default_value,
                                  arg.ty, arg.res_var, arg.num_bound_vars);
     auto layout = impl.get_layout();
-    return {MAgg{uniq(std::move(rec_state)), std::move(impl)},
-            std::move(layout)};
+    MAgg res{uniq(std::move(rec_state)), std::move(impl)};
+    res.num_bound_vars = arg.num_bound_vars;
+    if (enable_deltas(res.state->state)) {
+      res.inc_impl.emplace(rec_layout, arg.agg_term, arg.default_value, arg.ty,
+                           arg.res_var, arg.num_bound_vars);
+    }
+    return {std::move(res), std::move(layout)};
   }
 }
 
 MState::init_pair MState::init_let_state(const fo::Formula::let_t &arg) {
+  // The let binds a predicate, so subformulas in it do not mean the same as
+  // outside of it
+  shared_subformulas *sharing = std::exchange(sharing_, nullptr);
   auto [phi_state, phi_layout] = init_mstate(*arg.phi);
   auto [psi_state, psi_layout] = init_mstate(*arg.psi);
+  sharing_ = sharing;
   auto proj_mask =
     find_permutation(id_permutation(phi_layout.size()), phi_layout);
   return {MLet{std::move(proj_mask), arg.pred_id, uniq(std::move(phi_state)),
@@ -391,6 +759,51 @@ MState::init_pair MState::init_let_state(const fo::Formula::let_t &arg) {
 }
 
 MState::init_pair MState::init_mstate(const Formula &formula) {
+  if (sharing_) {
+    auto it = sharing_->num_occurrences.find(&formula);
+    if (it != sharing_->num_occurrences.end() && it->second > 1)
+      return init_shared_state(formula);
+  }
+  return init_unshared_state(formula);
+}
+
+MState::init_pair MState::init_shared_state(const Formula &formula) {
+  auto &entries = sharing_->entries;
+  auto [it, inserted] = sharing_->entry_idx.try_emplace(&formula, 0);
+  if (inserted) {
+    auto [state, layout] = init_unshared_state(formula);
+    // Initializing the state may have added entries
+    it = sharing_->entry_idx.find(&formula);
+    it->second = entries.size();
+    entries.push_back({MState(std::move(state)),
+                       std::make_shared<event_table_runs>(), layout});
+  }
+  const auto &entry = entries[it->second];
+  return {MShared{entry.res}, entry.layout};
+}
+
+void MState::count_subformulas(const Formula &formula,
+                               shared_subformulas &shared) {
+  var2::visit(
+    [&formula, &shared](const auto &arg) {
+      using T = std::decay_t<decltype(arg)>;
+      if constexpr (!any_type_equal_v<T, fo::Formula::pred_t,
+                                      fo::Formula::eq_t, fo::Formula::less_t,
+                                      fo::Formula::less_eq_t,
+                                      fo::Formula::let_t>) {
+        ++shared.num_occurrences[&formula];
+        if constexpr (requires { arg.phi; })
+          count_subformulas(*arg.phi, shared);
+        if constexpr (requires { arg.phil; }) {
+          count_subformulas(*arg.phil, shared);
+          count_subformulas(*arg.phir, shared);
+        }
+      }
+    },
+    formula.val);
+}
+
+MState::init_pair MState::init_unshared_state(const Formula &formula) {
   auto visitor1 = [](auto &&arg) -> MState::init_pair {
     using T = std::decay_t<decltype(arg)>;
     using std::is_same_v;
@@ -439,9 +852,9 @@ MState::init_pair MState::init_mstate(const Formula &formula) {
 }
 
 
-void MState::MPred::match(const vector<event_data> &event_args,
+void MState::MPred::match(const event &event_args,
                           event_table &acc_tab) const {
-  vector<event_data> res;
+  event res;
   res.reserve(nfvs);
   assert(event_args.size() == pred_args.size());
   for (const auto &[pos, cst] : pos_2_cst)
@@ -459,75 +872,78 @@ void MState::MPred::match(const vector<event_data> &event_args,
   acc_tab.add_row(std::move(res));
 }
 
-event_table_vec MState::MPred::eval(database &db, const ts_list &ts) {
+event MState::MPred::project(const event &event_args) const {
+  event res;
+  res.reserve(nfvs);
+  for (const auto &poss : var_pos)
+    res.push_back(event_args[poss[0]]);
+  return res;
+}
+
+event_table_runs MState::MPred::eval_runs(database &db, const ts_list &ts) {
   size_t num_tps = ts.size();
-  event_table_vec res_tabs;
-  res_tabs.reserve(num_tps);
+  event_table_runs res_tabs;
   if (is_builtin) {
-    if (pred_id == TP_PRED) {
+    // one table per tp, also if several tps are monitored in one step
+    for (size_t i = 0; i < num_tps; ++i, ++curr_tp) {
       event_table tab(nfvs);
-      for (size_t i = 0; i < num_tps; ++i, ++curr_tp)
-        match(
-          make_vector(common::event_data::Int(static_cast<int64_t>(curr_tp))),
-          tab);
-      res_tabs.push_back(tab.empty() ? opt_table() : std::move(tab));
-    } else if (pred_id == TS_PRED) {
-      event_table tab(nfvs);
-      for (size_t curr_ts : ts)
-        match(
-          make_vector(common::event_data::Int(static_cast<int64_t>(curr_ts))),
-          tab);
-      res_tabs.push_back(tab.empty() ? opt_table() : std::move(tab));
-    } else {
-      assert(pred_id == TP_TS_PRED);
-      event_table tab(nfvs);
-      for (size_t i = 0; i < num_tps; ++i, ++curr_tp)
-        match(
-          make_vector(common::event_data::Int(static_cast<int64_t>(curr_tp)),
-                      common::event_data::Int(static_cast<int64_t>(ts[i]))),
-          tab);
+      auto tp_val = common::event_data::Int(static_cast<int64_t>(curr_tp));
+      auto ts_val = common::event_data::Int(static_cast<int64_t>(ts[i]));
+      if (pred_id == TP_PRED) {
+        match(event{tp_val}, tab);
+      } else if (pred_id == TS_PRED) {
+        match(event{ts_val}, tab);
+      } else {
+        assert(pred_id == TP_TS_PRED);
+        match(event{tp_val, ts_val}, tab);
+      }
       res_tabs.push_back(tab.empty() ? opt_table() : std::move(tab));
     }
   } else {
     const auto it = db.find(pred_id);
     if (it == db.end()) {
-      res_tabs.emplace_back(std::nullopt);
+      res_tabs.push_run(num_tps, opt_table());
       return res_tabs;
     }
+    assert(it->second.size() == num_tps);
+    vector<std::uint32_t> sel;
     for (const auto &ev_for_ts : it->second) {
+      sel.clear();
+      filter.select(ev_for_ts, sel);
+      if (sel.empty()) {
+        res_tabs.push_back(opt_table());
+        continue;
+      }
       event_table tab(nfvs);
-      for (const auto &ev : ev_for_ts)
-        match(ev, tab);
-      res_tabs.push_back(tab.empty() ? opt_table() : std::move(tab));
+      tab.reserve(sel.size());
+      for (auto idx : sel)
+        tab.add_row(project(ev_for_ts[idx]));
+      res_tabs.push_back(std::move(tab));
     }
   }
   return res_tabs;
 }
 
-event_table_vec MState::MRel::eval(database &, const ts_list &ts) {
-  size_t num_tabs = ts.size();
-  event_table_vec res_tabs;
-  res_tabs.reserve(ts.size());
-  for (size_t i = 0; i < num_tabs; ++i)
-    res_tabs.push_back(tab);
+event_table_runs MState::MRel::eval_runs(database &, const ts_list &ts) {
+  event_table_runs res_tabs;
+  res_tabs.push_run(ts.size(), opt_table(tab));
   return res_tabs;
 }
 
-event_table_vec MState::MNeg::eval(database &db, const ts_list &ts) {
-  auto rec_tabs = state->eval(db, ts);
-  event_table_vec res_tabs;
-  res_tabs.reserve(rec_tabs.size());
-  std::transform(rec_tabs.cbegin(), rec_tabs.cend(),
-                 std::back_inserter(res_tabs), [](const auto &tab) {
-                   if (!tab)
-                     return opt_table(event_table::unit_table());
-                   else
-                     return opt_table();
-                 });
+event_table_runs MState::MNeg::eval_runs(database &db, const ts_list &ts) {
+  auto rec_tabs = state->eval_runs(db, ts);
+  event_table_runs res_tabs;
+  res_tabs.reserve(rec_tabs.runs().size());
+  for (const auto &[n, tab] : rec_tabs.runs()) {
+    if (!tab)
+      res_tabs.push_run(n, opt_table(event_table::unit_table()));
+    else
+      res_tabs.push_run(n, opt_table());
+  }
   return res_tabs;
 }
 
-event_table_vec MState::MOr::eval(database &db, const ts_list &ts) {
+event_table_runs MState::MOr::eval_runs(database &db, const ts_list &ts) {
   auto reduction_fn = [this](const opt_table &tab1,
                              const opt_table &tab2) -> opt_table {
     if (!tab2)
@@ -536,11 +952,46 @@ event_table_vec MState::MOr::eval(database &db, const ts_list &ts) {
     tab1_tmp.t_union_in_place(*tab2, r_layout_permutation);
     return std::move(tab1_tmp);
   };
-  return apply_recursive_bin_reduction(reduction_fn, *l_state, *r_state, buf,
+  return apply_recursive_run_reduction(reduction_fn, *l_state, *r_state, buf,
                                        db, ts);
 }
 
-event_table_vec MState::MAnd::eval(database &db, const ts_list &ts) {
+std::vector<table_delta> MState::MOr::eval_deltas(database &db,
+                                                  const ts_list &ts) {
+  std::vector<table_delta> l_deltas, r_deltas;
+  eval_siblings(
+    *l_state, *r_state, [&]() { l_deltas = l_state->eval_deltas(db, ts); },
+    [&]() { r_deltas = r_state->eval_deltas(db, ts); });
+  auto apply_delta = [this](table_delta &res, hashed_event row, bool inserted) {
+    if (inserted) {
+      auto it = row_counts.try_emplace(row, 0).first;
+      if (it->second++ == 0)
+        res.emplace_back(std::move(row), true);
+    } else {
+      auto it = row_counts.find(row);
+      assert(it != row_counts.end() && it->second > 0);
+      if (--it->second == 0) {
+        row_counts.erase(it);
+        res.emplace_back(std::move(row), false);
+      }
+    }
+  };
+  return delta_buf.update_and_reduce(
+    l_deltas, r_deltas,
+    [this, &apply_delta](table_delta &delta_l,
+                         table_delta &delta_r) -> table_delta {
+      table_delta res;
+      for (auto &[row, inserted] : delta_l)
+        apply_delta(res, std::move(row), inserted);
+      for (auto &[row, inserted] : delta_r)
+        apply_delta(res, filter_row(r_layout_permutation, row), inserted);
+      return res;
+    });
+}
+
+event_table_runs MState::MAnd::eval_runs(database &db, const ts_list &ts) {
+  if (r_index)
+    return eval_incremental(db, ts);
   auto reduction_fn = [this](const opt_table &tab1,
                              const opt_table &tab2) -> opt_table {
     assert(!tab1 || !tab1->empty());
@@ -558,126 +1009,298 @@ event_table_vec MState::MAnd::eval(database &db, const ts_list &ts) {
       return tab1->natural_join(*tab2, *join_ptr);
     }
   };
-  auto ret = apply_recursive_bin_reduction(reduction_fn, *l_state, *r_state,
-                                           buf, db, ts);
-  return ret;
+  return apply_recursive_run_reduction(reduction_fn, *l_state, *r_state, buf,
+                                       db, ts);
 }
 
-event_table_vec MState::MPrev::eval(database &db, const ts_list &ts) {
-  auto rec_tabs = state->eval(db, ts);
-  past_ts.insert(past_ts.end(), ts.begin(), ts.end());
-  if (rec_tabs.empty()) {
-    return rec_tabs;
-  }
-  event_table_vec res_tabs;
-  res_tabs.reserve(rec_tabs.size() + 1);
-  auto tabs_it = rec_tabs.begin();
-  if (is_first) {
-    res_tabs.emplace_back(std::nullopt);
-    is_first = false;
+event_table_runs MState::MAnd::eval_incremental(database &db,
+                                                const ts_list &ts) {
+  // Keep the evaluation order of the original formula
+  event_table_runs l_tabs;
+  std::vector<table_delta> r_deltas;
+  auto eval_l = [&]() { l_tabs = l_state->eval_runs(db, ts); };
+  auto eval_r = [&]() { r_deltas = r_state->eval_deltas(db, ts); };
+  if (swapped)
+    eval_siblings(*r_state, *l_state, eval_r, eval_l);
+  else
+    eval_siblings(*l_state, *r_state, eval_l, eval_r);
+  l_buf.append_runs(l_tabs.runs());
+  r_buf.insert(r_buf.end(), std::make_move_iterator(r_deltas.begin()),
+               std::make_move_iterator(r_deltas.end()));
+  event_table_runs res;
+  while (!l_buf.empty() && !r_buf.empty()) {
+    // Within a run of the left operand, the result only changes with the
+    // right operand
+    size_t n = std::min(l_buf.front_run_size(), r_buf.size());
+    const auto &tab = l_buf.front();
+    for (size_t i = 0; i < n; ++i, r_buf.pop_front()) {
+      bool r_changed = !r_buf.front().empty();
+      r_index->apply(r_buf.front());
+      if (i > 0 && !r_changed) {
+        res.repeat_back();
+      } else if (const auto *anti_join_ptr =
+                   var2::get_if<anti_join_info>(&op_info)) {
+        res.push_back(r_index->anti_join(tab, *anti_join_ptr));
+      } else {
+        const auto *join_ptr = var2::get_if<join_info>(&op_info);
+        res.push_back(r_index->natural_join(tab, *join_ptr));
+      }
+    }
+    l_buf.pop_front(n);
   }
+  return res;
+}
 
-  if (past_ts.size() >= 2) {
-    if (buf) {
-      std::optional<opt_table> taken_val;
-      buf.swap(taken_val);
-      assert(past_ts[1] >= past_ts[0]);
-      if (inter.contains(past_ts[1] - past_ts[0]))
-        res_tabs.push_back(std::move(*taken_val));
-      else
-        res_tabs.emplace_back(std::nullopt);
-      past_ts.pop_front();
+// Evaluates states[lo, hi) into rec_tabs, the two halves of the range in
+// parallel if both are heavy enough
+void MState::MMultiAnd::eval_states(vector<event_table_vec> &rec_tabs,
+                                    size_t lo, size_t hi, database &db,
+                                    const ts_list &ts) {
+  if (hi - lo == 1) {
+    rec_tabs[lo] = states[lo]->eval(db, ts);
+    return;
+  }
+  size_t mid = lo + (hi - lo) / 2;
+  auto worth_forking = [this](size_t from, size_t to) {
+    size_t weight = 0;
+    for (size_t i = from; i < to; ++i) {
+      if (states[i]->contains_let)
+        return false;
+      weight += states[i]->eval_weight;
     }
-    for (auto rec_tabs_end = rec_tabs.end();
-         past_ts.size() >= 2 && tabs_it != rec_tabs_end;
-         past_ts.pop_front(), ++tabs_it) {
-      assert(past_ts[1] >= past_ts[0]);
-      if (inter.contains(past_ts[1] - past_ts[0]))
-        res_tabs.push_back(std::move(*tabs_it));
-      else
-        res_tabs.push_back(std::nullopt);
+    return weight >= MIN_FORK_WEIGHT;
+  };
+  fork_join(
+    worth_forking(lo, mid) && worth_forking(mid, hi),
+    [&]() { eval_states(rec_tabs, lo, mid, db, ts); },
+    [&]() { eval_states(rec_tabs, mid, hi, db, ts); });
+}
+
+event_table_vec MState::MMultiAnd::eval(database &db, const ts_list &ts) {
+  vector<event_table_vec> rec_tabs(states.size());
+  eval_states(rec_tabs, 0, states.size(), db, ts);
+  return buf.update_and_reduce(
+    rec_tabs, [this](vector<opt_table> &tabs) { return join_tables(tabs); });
+}
+
+static bool shares_var(const table_layout &l1, const table_layout &l2) {
+  return std::any_of(l1.cbegin(), l1.cend(), [&l2](size_t var) {
+    return std::find(l2.cbegin(), l2.cend(), var) != l2.cend();
+  });
+}
+
+// Greedy left-deep join: start with the smallest table and repeatedly join
+// the smallest remaining table that shares a variable with the intermediate
+// result. Cartesian products are only formed if no such table is left.
+opt_table MState::MMultiAnd::join_tables(vector<opt_table> &tabs) const {
+  size_t n = tabs.size();
+  if (std::any_of(tabs.cbegin(), tabs.cend(),
+                  [](const opt_table &tab) { return !tab; }))
+    return {};
+  vector<bool> used(n, false);
+  size_t first = 0;
+  for (size_t i = 1; i < n; ++i)
+    if (tabs[i]->tab_size() < tabs[first]->tab_size())
+      first = i;
+  used[first] = true;
+  event_table acc = std::move(*tabs[first]);
+  table_layout acc_layout = layouts[first];
+  for (size_t step = 1; step < n; ++step) {
+    size_t best = n;
+    bool best_shares = false;
+    for (size_t i = 0; i < n; ++i) {
+      if (used[i])
+        continue;
+      bool shares = shares_var(acc_layout, layouts[i]);
+      if (best == n || (shares && !best_shares) ||
+          (shares == best_shares &&
+           tabs[i]->tab_size() < tabs[best]->tab_size())) {
+        best = i;
+        best_shares = shares;
+      }
     }
+    used[best] = true;
+    auto info = get_join_info(acc_layout, layouts[best]);
+    auto joined = acc.natural_join(*tabs[best], info);
+    if (!joined)
+      return {};
+    acc = std::move(*joined);
+    acc_layout = std::move(info.result_layout);
   }
+  if (acc_layout == res_layout)
+    return acc;
+  event_table res(res_layout.size());
+  res.t_union_in_place(acc, find_permutation(res_layout, acc_layout));
+  return res;
+}
 
-  if (tabs_it != rec_tabs.end()) {
-    assert(!buf);
-    buf.emplace(std::move(*tabs_it));
-    tabs_it++;
+// Appends the first n tps of a run of tab to res. The i-th of them keeps tab
+// if the difference of past_ts[i + 1] and past_ts[i] is in inter, otherwise
+// its table is empty. tab is moved from if take is set.
+static void push_run_in_interval(event_table_runs &res, opt_table &tab,
+                                 size_t n, bool take, const Interval &inter,
+                                 const devector<size_t> &past_ts) {
+  size_t num_kept = 0;
+  for (size_t i = 0; i < n; ++i) {
+    assert(past_ts.size() > i + 1 && past_ts[i] <= past_ts[i + 1]);
+    if (inter.contains(past_ts[i + 1] - past_ts[i])) {
+      num_kept++;
+      continue;
+    }
+    if (num_kept > 0)
+      res.push_run(num_kept, opt_table(tab));
+    num_kept = 0;
+    res.push_back(std::nullopt);
   }
-
-  assert(tabs_it == rec_tabs.end());
-  return res_tabs;
+  if (num_kept > 0)
+    res.push_run(num_kept, take ? std::move(tab) : opt_table(tab));
 }
 
-event_table_vec MState::MNext::eval(database &db, const ts_list &ts) {
-  auto rec_tabs = state->eval(db, ts);
+event_table_runs MState::MPrev::eval_runs(database &db, const ts_list &ts) {
+  auto rec_tabs = state->eval_runs(db, ts);
   past_ts.insert(past_ts.end(), ts.begin(), ts.end());
   if (rec_tabs.empty())
     return rec_tabs;
-  auto tabs_it = rec_tabs.begin();
+  event_table_runs res_tabs;
   if (is_first) {
-    tabs_it++;
+    res_tabs.push_back(std::nullopt);
     is_first = false;
   }
-  event_table_vec res_tabs;
-  res_tabs.reserve(rec_tabs.size());
-  for (; tabs_it != rec_tabs.end(); past_ts.pop_front(), ++tabs_it) {
-    assert(past_ts.size() > 1 && past_ts[0] <= past_ts[1]);
+
+  if (buf) {
+    assert(past_ts.size() >= 2 && past_ts[1] >= past_ts[0]);
+    std::optional<opt_table> taken_val;
+    buf.swap(taken_val);
     if (inter.contains(past_ts[1] - past_ts[0]))
-      res_tabs.push_back(std::move(*tabs_it));
+      res_tabs.push_back(std::move(*taken_val));
     else
-      res_tabs.emplace_back(std::nullopt);
+      res_tabs.push_back(std::nullopt);
+    past_ts.pop_front();
+  }
+  // Only the table of the last tp has to wait for the next timestamp
+  for (auto &[n, tab] : rec_tabs.runs()) {
+    size_t num_out = std::min(n, past_ts.size() - 1);
+    push_run_in_interval(res_tabs, tab, num_out, num_out == n, inter,
+                         past_ts);
+    past_ts.erase(past_ts.begin(),
+                  past_ts.begin() + static_cast<std::ptrdiff_t>(num_out));
+    if (num_out < n) {
+      assert(!buf && num_out + 1 == n);
+      buf.emplace(std::move(tab));
+    }
   }
-  assert(!past_ts.empty() && tabs_it == rec_tabs.end());
   return res_tabs;
 }
 
-event_table_vec MState::MUntil::eval(database &db, const ts_list &ts) {
+event_table_runs MState::MNext::eval_runs(database &db, const ts_list &ts) {
+  auto rec_tabs = state->eval_runs(db, ts);
+  past_ts.insert(past_ts.end(), ts.begin(), ts.end());
+  event_table_runs res_tabs;
+  for (auto &[n, tab] : rec_tabs.runs()) {
+    size_t num_out = n;
+    if (is_first) {
+      num_out--;
+      is_first = false;
+    }
+    push_run_in_interval(res_tabs, tab, num_out, true, inter, past_ts);
+    past_ts.erase(past_ts.begin(),
+                  past_ts.begin() + static_cast<std::ptrdiff_t>(num_out));
+  }
+  assert(!past_ts.empty());
+  return res_tabs;
+}
+
+event_table_runs MState::MUntil::eval_runs(database &db, const ts_list &ts) {
   ts_buf.insert(ts_buf.end(), ts.begin(), ts.end());
-  auto reduction_fn = [this](opt_table &tab_l,
-                             opt_table &tab_r) -> event_table_vec {
-    assert(!ts_buf.empty());
-    size_t new_ts = ts_buf.front();
-    ts_buf.pop_front();
-    impl.add_tables(tab_l, tab_r, new_ts);
-    new_ts = ts_buf.empty() ? new_ts : ts_buf.front();
-    return impl.eval(new_ts);
-  };
-  auto ret = apply_recursive_bin_reduction(reduction_fn, *l_state, *r_state,
-                                           buf, db, ts);
-  return ret;
+  event_table_runs l_rec_tabs, r_rec_tabs, res_tabs;
+  eval_siblings(
+    *l_state, *r_state, [&]() { l_rec_tabs = l_state->eval_runs(db, ts); },
+    [&]() { r_rec_tabs = r_state->eval_runs(db, ts); });
+  buf.update_and_visit_runs(
+    l_rec_tabs, r_rec_tabs,
+    [this, &res_tabs](size_t n, opt_table &tab_l, opt_table &tab_r) {
+      for (size_t i = 1; i <= n; ++i) {
+        assert(!ts_buf.empty());
+        size_t new_ts = ts_buf.front();
+        ts_buf.pop_front();
+        auto l = take_run_elem(tab_l, i == n),
+             r = take_run_elem(tab_r, i == n);
+        impl.add_tables(l, r, new_ts);
+        new_ts = ts_buf.empty() ? new_ts : ts_buf.front();
+        for (auto &tab : impl.eval(new_ts))
+          res_tabs.push_back(std::move(tab));
+      }
+    });
+  return res_tabs;
 }
 
-event_table_vec MState::MEventually::eval(database &db, const ts_list &ts) {
+event_table_runs MState::MEventually::eval_runs(database &db,
+                                                const ts_list &ts) {
   ts_buf.insert(ts_buf.end(), ts.begin(), ts.end());
-  auto rec_tabs = r_state->eval(db, ts);
-  event_table_vec res_tabs;
-  res_tabs.reserve(rec_tabs.size());
-  for (auto &tab : rec_tabs) {
-    assert(!ts_buf.empty());
-    size_t new_ts = ts_buf.front();
-    ts_buf.pop_front();
-    impl.add_right_table(tab, new_ts);
-    new_ts = ts_buf.empty() ? new_ts : ts_buf.front();
-    auto res_tabs_part = impl.eval(new_ts);
-    res_tabs.insert(res_tabs.end(),
-                    std::make_move_iterator(res_tabs_part.begin()),
-                    std::make_move_iterator(res_tabs_part.end()));
+  auto rec_tabs = r_state->eval_runs(db, ts);
+  event_table_runs res_tabs;
+  for (auto &[n, tab] : rec_tabs.runs()) {
+    for (size_t i = 1; i <= n; ++i) {
+      assert(!ts_buf.empty());
+      size_t new_ts = ts_buf.front();
+      ts_buf.pop_front();
+      auto r = take_run_elem(tab, i == n);
+      impl.add_right_table(r, new_ts);
+      new_ts = ts_buf.empty() ? new_ts : ts_buf.front();
+      for (auto &res_tab : impl.eval(new_ts))
+        res_tabs.push_back(std::move(res_tab));
+    }
   }
   return res_tabs;
 }
 
-event_table_vec MState::MAgg::eval(database &db, const ts_list &ts) {
-  auto rec_tabs = state->eval(db, ts);
-  event_table_vec res_tabs;
-  res_tabs.reserve(rec_tabs.size());
-  std::transform(rec_tabs.begin(), rec_tabs.end(), std::back_inserter(res_tabs),
-                 [this](auto &tab) { return impl.eval(tab); });
+event_table_runs MState::MAgg::eval_runs(database &db, const ts_list &ts) {
+  if (inc_impl)
+    return eval_incremental(db, ts);
+  auto rec_tabs = state->eval_runs(db, ts);
+  // The aggregation of a table does not depend on the other tps
+  event_table_runs res_tabs;
+  res_tabs.reserve(rec_tabs.runs().size());
+  for (auto &[n, tab] : rec_tabs.runs())
+    res_tabs.push_run(n, impl.eval(tab));
   return res_tabs;
 }
 
-event_table_vec MState::MLet::eval(database &db, const ts_list &ts) {
-  auto l_tabs = phi_state->eval(db, ts);
+event_table_runs MState::MAgg::eval_incremental(database &db,
+                                                const ts_list &ts) {
+  auto rec_deltas = state->eval_deltas(db, ts);
+  event_table_runs res_tabs;
+  for (const auto &delta : rec_deltas) {
+    if (delta.empty() && !res_tabs.empty()) {
+      res_tabs.repeat_back();
+      continue;
+    }
+    for (const auto &[row, inserted] : delta) {
+      if (inserted) {
+        inc_impl->add_result(*row);
+        inc_rows++;
+      } else {
+        inc_impl->remove_result(*row);
+        inc_rows--;
+      }
+    }
+    if (inc_rows == 0) {
+      // Yields the default value if there are no group variables
+      opt_table empty;
+      res_tabs.push_back(impl.eval(empty));
+    } else {
+      res_tabs.push_back(inc_impl->finalize_table());
+    }
+  }
+  return res_tabs;
+}
+
+event_table_runs MState::MShared::eval_runs(database &, const ts_list &) {
+  return *res;
+}
+
+event_table_runs MState::MLet::eval_runs(database &db, const ts_list &ts) {
+  auto l_tabs = phi_state->eval_runs(db, ts);
 
   // TODO: maybe it is better not to do a hard fork and rollback changes instead
   std::optional<database::mapped_type> old_db_ent;
@@ -688,19 +1311,19 @@ event_table_vec MState::MLet::eval(database &db, const ts_list &ts) {
   }
 
   database::mapped_type db_ent;
-  const size_t n_l_tabs = l_tabs.size();
-  db_ent.reserve(n_l_tabs);
-  for (const auto &l_tab : l_tabs) {
+  db_ent.reserve(l_tabs.size());
+  for (const auto &[n, l_tab] : l_tabs.runs()) {
     parse::database_elem new_tab;
     if (l_tab) {
       new_tab.reserve(l_tab->tab_size());
       for (const auto &e : *l_tab)
         new_tab.push_back(filter_row(projection_mask, e));
     }
+    db_ent.insert(db_ent.end(), n - 1, new_tab);
     db_ent.push_back(std::move(new_tab));
   }
   db.emplace(pred_id, std::move(db_ent));
-  auto res = psi_state->eval(db, ts);
+  auto res = psi_state->eval_runs(db, ts);
   db.erase(pred_id);
   if (old_db_ent)
     db.emplace(pred_id, std::move(old_db_ent.value()));
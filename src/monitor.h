@@ -11,13 +11,18 @@
 #include <buffers.h>
 #include <event_data.h>
 #include <formula.h>
+#include <functional>
 #include <iterator>
+#include <join_index.h>
+#include <memory>
 #include <monitor_types.h>
 #include <optional>
+#include <pred_filter.h>
 #include <since_impl.h>
 #include <stdexcept>
 #include <string_view>
 #include <table.h>
+#include <task_pool.h>
 #include <temporal_aggregation_impl.h>
 #include <traceparser.h>
 #include <tuple>
@@ -44,52 +49,133 @@ namespace detail {
   using fo::fv_set;
   using fo::Interval;
   using fo::name;
-  using fo::ptr_type;
   using fo::Term;
 
   class monitor;
+  class multi_monitor;
+  struct shared_subformulas;
+
+  // Selects rows of the state of a monitor by the values of two free
+  // variables of its formula. pred(x, y) is called for the rows that have a
+  // column for var, with its value and the value of sub_var (nullptr if the
+  // row has no column for it).
+  struct row_filter {
+    size_t var;
+    std::optional<size_t> sub_var;
+    std::function<bool(const event_data &, const event_data *)> pred;
+
+    struct row_pred {
+      const row_filter *filter;
+      size_t col;
+      std::optional<size_t> sub_col;
+
+      template<typename Row>
+      bool operator()(const Row &row) const {
+        return filter->pred(row[col], sub_col ? &row[*sub_col] : nullptr);
+      }
+    };
+    // The predicate on rows with the layout, in which num_bound_vars more
+    // variables are bound than in the formula. nullopt if they have no column
+    // for var.
+    [[nodiscard]] std::optional<row_pred>
+    for_layout(const table_layout &layout, size_t num_bound_vars) const;
+  };
 
-  template<typename F, typename T>
-  event_table_vec
-  apply_recursive_bin_reduction(F f, T &t1, T &t2, binary_buffer &buf,
-                                database &db, const ts_list &ts) {
-    auto l_rec_tabs = t1.eval(db, ts), r_rec_tabs = t2.eval(db, ts);
-    auto res = buf.template update_and_reduce(l_rec_tabs, r_rec_tabs, f);
-    if constexpr (std::is_same_v<decltype(res), event_table_vec>) {
-      return res;
-    } else {
-      static_assert(
-        std::is_same_v<decltype(res), std::vector<event_table_vec>>);
-      event_table_vec acc;
-      size_t total_size = 0;
-      for (const auto &elem : res)
-        total_size += elem.size();
-      acc.reserve(total_size);
-      for (auto &elem : res)
-        acc.insert(acc.end(), std::make_move_iterator(elem.begin()),
-                   std::make_move_iterator(elem.end()));
-      return acc;
+  // Owning pointer that copies the pointee when it is copied, so that a tree
+  // of states can be duplicated as a whole
+  template<typename T>
+  class clone_ptr {
+  public:
+    clone_ptr() = default;
+    clone_ptr(std::unique_ptr<T> ptr) : ptr_(std::move(ptr)) {}
+    clone_ptr(const clone_ptr &other) : ptr_(copy(other.ptr_)) {}
+    clone_ptr(clone_ptr &&other) noexcept = default;
+    clone_ptr &operator=(const clone_ptr &other) {
+      if (this != &other)
+        ptr_ = copy(other.ptr_);
+      return *this;
     }
+    clone_ptr &operator=(clone_ptr &&other) noexcept = default;
+
+    T &operator*() const { return *ptr_; }
+    T *operator->() const { return ptr_.get(); }
+    T *get() const { return ptr_.get(); }
+    explicit operator bool() const { return ptr_ != nullptr; }
+
+  private:
+    static std::unique_ptr<T> copy(const std::unique_ptr<T> &ptr) {
+      return ptr ? std::unique_ptr<T>(new T(*ptr)) : nullptr;
+    }
+
+    std::unique_ptr<T> ptr_;
+  };
+
+  // The element of a run for one of its tps, the last one takes it
+  inline opt_table take_run_elem(opt_table &elem, bool last) {
+    return last ? std::move(elem) : elem;
+  }
+
+  // Appends the result of a temporal operator impl that advanced by one tp
+  // to res. If it did not change, the previous result is repeated.
+  template<typename Impl>
+  void push_temporal_result(Impl &impl, event_table_runs &res) {
+    if (impl.take_result_changed() || res.empty())
+      res.push_back(impl.produce_result());
+    else
+      res.repeat_back();
+  }
+
+  // Evaluates t1 and t2 and combines their results tp by tp, keeping them
+  // as runs. f must be a pure function of its arguments.
+  template<typename F, typename T>
+  event_table_runs apply_recursive_run_reduction(F f, T &t1, T &t2,
+                                                 binary_buffer &buf,
+                                                 database &db,
+                                                 const ts_list &ts) {
+    event_table_runs l_rec_tabs, r_rec_tabs;
+    T::eval_siblings(
+      t1, t2, [&]() { l_rec_tabs = t1.eval_runs(db, ts); },
+      [&]() { r_rec_tabs = t2.eval_runs(db, ts); });
+    return buf.update_and_reduce_runs(l_rec_tabs, r_rec_tabs, f);
   }
 
 
   class MState {
     friend class monitor;
+    friend class multi_monitor;
+    friend struct shared_subformulas;
 
     template<typename F, typename T>
-    friend event_table_vec
-    apply_recursive_bin_reduction(F, T &, T &, binary_buffer &, database &,
+    friend event_table_runs
+    apply_recursive_run_reduction(F, T &, T &, binary_buffer &, database &,
                                   ts_list const &);
 
+    template<typename>
+    friend class clone_ptr;
+
     MState() = default;
+    MState(const MState &other) = default;
+    MState(MState &&other) = default;
+    MState &operator=(const MState &other) = default;
     MState &operator=(MState &&other) = default;
 
 
   private:
     event_table_vec eval(database &db, const ts_list &ts);
+    // Same results as eval. Most operators produce and combine them as runs,
+    // so that stretches of empty tables are handled in O(1), and operators
+    // whose result did not change repeat it as a run; MMultiAnd and
+    // MFusedUnaryOps produce one table per tp.
+    event_table_runs eval_runs(database &db, const ts_list &ts);
+    std::vector<table_delta> eval_deltas(database &db, const ts_list &ts);
+    // See monitor::erase_rows_if, num_bound_vars is the number of variables
+    // bound above this state
+    void erase_rows_if(const row_filter &filter, size_t num_bound_vars);
+    [[nodiscard]] bool has_rows(const row_filter &filter,
+                                size_t num_bound_vars) const;
     struct MRel {
       opt_table tab;
-      event_table_vec eval(database &db, const ts_list &ts);
+      event_table_runs eval_runs(database &db, const ts_list &ts);
     };
 
     struct MPred {
@@ -99,22 +185,26 @@ namespace detail {
       vector<Term> pred_args;
       vector<vector<size_t>> var_pos;
       vector<pair<size_t, event_data>> pos_2_cst;
-      event_table_vec eval(database &db, const ts_list &ts);
+      pred_filter filter;
+      event_table_runs eval_runs(database &db, const ts_list &ts);
       void match(const event &event_args, event_table &acc_tab) const;
+      event project(const event &event_args) const;
       void print_state();
     };
 
     struct MFusedUnaryOps {
+      // Rows of a batch stored column by column
+      using column_batch = vector<vector<event_data>>;
+
       struct AndAssign {
-        vector<size_t> var_2_idx;
-        fo::Term t;
+        fo::compiled_term t;
         size_t nfvs;
 
         std::optional<parse::database_tuple> eval(parse::database_tuple &row);
+        void eval_batch(column_batch &batch, size_t &nrows);
       };
       struct AndRel {
-        vector<size_t> var_2_idx;
-        fo::Term l, r;
+        fo::compiled_term l, r;
         enum cst_type_t
         {
           CST_EQ,
@@ -123,39 +213,74 @@ namespace detail {
         } cst_type;
         bool cst_neg;
 
+        bool holds(const event_data &l_res, const event_data &r_res) const;
         std::optional<parse::database_tuple> eval(parse::database_tuple &row);
+        void eval_batch(column_batch &batch, size_t &nrows);
       };
       struct Exists {
         optional<size_t> drop_idx;
 
         std::optional<parse::database_tuple> eval(parse::database_tuple &row);
+        void eval_batch(column_batch &batch, size_t &nrows);
       };
+      // Tables with fewer rows are evaluated row by row
+      static constexpr size_t MIN_BATCH_ROWS = 16;
+      static constexpr size_t BATCH_ROWS = 1024;
+
       event_table_vec eval(database &db, const ts_list &ts);
+      void eval_rows(const event_table &tab, event_table &new_tab);
+      void eval_batches(const event_table &tab, event_table &new_tab);
       using elem_t = var2::variant<AndAssign, AndRel, Exists>;
 
-      ptr_type<MState> state;
+      clone_ptr<MState> state;
       std::vector<elem_t> un_ops;
       size_t nfvs;
     };
 
     struct MAnd {
       binary_buffer buf;
-      ptr_type<MState> l_state, r_state;
+      clone_ptr<MState> l_state, r_state;
       variant<join_info, anti_join_info> op_info;
+      // Only used if the right operand is a temporal operator producing deltas
+      std::optional<join_index> r_index = {};
+      bool swapped = false;
+      common::run_length_queue<opt_table> l_buf = {};
+      devector<table_delta> r_buf = {};
+      event_table_runs eval_runs(database &db, const ts_list &ts);
+      event_table_runs eval_incremental(database &db, const ts_list &ts);
+    };
+
+    // Conjunction of three or more positive subformulas. The join order is
+    // chosen for every time point based on the sizes of the operand tables.
+    struct MMultiAnd {
+      nary_buffer buf;
+      vector<clone_ptr<MState>> states;
+      vector<table_layout> layouts;
+      table_layout res_layout;
       event_table_vec eval(database &db, const ts_list &ts);
+      void eval_states(vector<event_table_vec> &rec_tabs, size_t lo,
+                       size_t hi, database &db, const ts_list &ts);
+      opt_table join_tables(vector<opt_table> &tabs) const;
     };
 
     struct MOr {
-      ptr_type<MState> l_state, r_state;
+      clone_ptr<MState> l_state, r_state;
       vector<size_t> r_layout_permutation;
       size_t nfvs_l;
       binary_buffer buf;
-      event_table_vec eval(database &db, const ts_list &ts);
+      // Only used if both operands produce deltas, i.e. below a conjunction
+      // or aggregation that consumes them. Counts in how many of the
+      // operands' results a row currently is; the union needs these counts to
+      // tell whether a row left its result.
+      common::binary_buffer<table_delta> delta_buf = {};
+      common::hash_cached_map<event, size_t> row_counts = {};
+      event_table_runs eval_runs(database &db, const ts_list &ts);
+      std::vector<table_delta> eval_deltas(database &db, const ts_list &ts);
     };
 
     struct MNeg {
-      ptr_type<MState> state;
-      event_table_vec eval(database &db, const ts_list &ts);
+      clone_ptr<MState> state;
+      event_table_runs eval_runs(database &db, const ts_list &ts);
     };
 
     struct MPrev {
@@ -163,69 +288,113 @@ namespace detail {
       size_t num_fvs;
       std::optional<opt_table> buf;
       devector<size_t> past_ts;
-      ptr_type<MState> state;
+      clone_ptr<MState> state;
       bool is_first;
-      event_table_vec eval(database &db, const ts_list &ts);
+      event_table_runs eval_runs(database &db, const ts_list &ts);
     };
 
     struct MNext {
       Interval inter;
       size_t num_fvs;
       devector<size_t> past_ts;
-      ptr_type<MState> state;
+      clone_ptr<MState> state;
       bool is_first;
-      event_table_vec eval(database &db, const ts_list &ts);
+      event_table_runs eval_runs(database &db, const ts_list &ts);
     };
 
     template<typename Impl>
     struct MSince {
       binary_buffer buf;
       devector<size_t> ts_buf;
-      ptr_type<MState> l_state, r_state;
+      clone_ptr<MState> l_state, r_state;
       Impl impl;
+      // Free variables of the tuples in impl, and the number of variables
+      // bound by the aggregation fused into impl, if any
+      table_layout layout = {};
+      size_t num_bound_vars = 0;
 
-      event_table_vec eval(database &db, const ts_list &ts) {
+      // See MOnce::eval_runs
+      event_table_runs eval_runs(database &db, const ts_list &ts) {
         ts_buf.insert(ts_buf.end(), ts.begin(), ts.end());
-        auto reduction_fn = [this](opt_table &tab_l,
-                                   opt_table &tab_r) -> opt_table {
-          assert(!tab_l || !tab_l->empty());
-          assert(!tab_r || !tab_r->empty());
-          assert(!ts_buf.empty());
-          size_t new_ts = ts_buf.front();
-          ts_buf.pop_front();
-          // fmt::print("calling impl with tabl: {}, tabr: {}, ts: {}\n", tab_l,
-          // tab_r, new_ts);
-          auto ret = impl.eval(tab_l, tab_r, new_ts);
-          /*fmt::print("state after call:\n");
-          impl.print_state();*/
-          return ret;
-        };
-        auto ret = apply_recursive_bin_reduction(reduction_fn, *l_state,
-                                                 *r_state, buf, db, ts);
-        return ret;
+        event_table_runs l_rec_tabs, r_rec_tabs, res;
+        eval_siblings(
+          *l_state, *r_state, [&]() { l_rec_tabs = l_state->eval_runs(db, ts); },
+          [&]() { r_rec_tabs = r_state->eval_runs(db, ts); });
+        buf.update_and_visit_runs(
+          l_rec_tabs, r_rec_tabs,
+          [this, &res](size_t n, opt_table &tab_l, opt_table &tab_r) {
+            assert(!tab_l || !tab_l->empty());
+            assert(!tab_r || !tab_r->empty());
+            for (size_t i = 1; i <= n; ++i) {
+              assert(!ts_buf.empty());
+              size_t new_ts = ts_buf.front();
+              ts_buf.pop_front();
+              auto l = take_run_elem(tab_l, i == n),
+                   r = take_run_elem(tab_r, i == n);
+              impl.advance(l, r, new_ts);
+              push_temporal_result(impl, res);
+            }
+          });
+        return res;
+      }
+
+      std::vector<table_delta> eval_deltas(database &db, const ts_list &ts) {
+        ts_buf.insert(ts_buf.end(), ts.begin(), ts.end());
+        event_table_vec l_rec_tabs, r_rec_tabs;
+        eval_siblings(
+          *l_state, *r_state, [&]() { l_rec_tabs = l_state->eval(db, ts); },
+          [&]() { r_rec_tabs = r_state->eval(db, ts); });
+        return buf.update_and_reduce(
+          l_rec_tabs, r_rec_tabs,
+          [this](opt_table &tab_l, opt_table &tab_r) -> table_delta {
+            assert(!ts_buf.empty());
+            size_t new_ts = ts_buf.front();
+            ts_buf.pop_front();
+            return impl.eval_delta(tab_l, tab_r, new_ts);
+          });
       }
     };
 
     template<typename Impl>
     struct MOnce {
       devector<size_t> ts_buf;
-      ptr_type<MState> r_state;
+      clone_ptr<MState> r_state;
       Impl impl;
+      // See MSince
+      table_layout layout = {};
+      size_t num_bound_vars = 0;
+
+      // Same results as eval. A result that did not change since the
+      // previous tp is repeated as a run instead of being produced again, so
+      // that e.g. the state of an operator over [0, ∞) is only copied when it
+      // changed.
+      event_table_runs eval_runs(database &db, const ts_list &ts) {
+        ts_buf.insert(ts_buf.end(), ts.begin(), ts.end());
+        auto rec_tabs = r_state->eval_runs(db, ts);
+        event_table_runs res;
+        for (auto &[n, tab] : rec_tabs.runs()) {
+          for (size_t i = 1; i <= n; ++i) {
+            assert(!ts_buf.empty());
+            size_t new_ts = ts_buf.front();
+            ts_buf.pop_front();
+            auto r = take_run_elem(tab, i == n);
+            impl.advance(r, new_ts);
+            push_temporal_result(impl, res);
+          }
+        }
+        return res;
+      }
 
-      event_table_vec eval(database &db, const ts_list &ts) {
+      std::vector<table_delta> eval_deltas(database &db, const ts_list &ts) {
         ts_buf.insert(ts_buf.end(), ts.begin(), ts.end());
         auto rec_tabs = r_state->eval(db, ts);
-        event_table_vec res;
+        std::vector<table_delta> res;
         res.reserve(rec_tabs.size());
         for (auto &tab : rec_tabs) {
           assert(!ts_buf.empty());
           size_t new_ts = ts_buf.front();
           ts_buf.pop_front();
-          // fmt::print("calling impl with tabl: {}, ts: {}\n", tab, new_ts);
-          auto ret = impl.eval(tab, new_ts);
-          /*fmt::print("state after call:\n");
-          impl.print_state();*/
-          res.push_back(std::move(ret));
+          res.push_back(impl.eval_delta(tab, new_ts));
         }
         return res;
       }
@@ -234,39 +403,62 @@ namespace detail {
     struct MUntil {
       binary_buffer buf;
       devector<size_t> ts_buf;
-      ptr_type<MState> l_state, r_state;
+      clone_ptr<MState> l_state, r_state;
       until_impl impl;
+      // Free variables of the tuples of the right and the left operand in impl
+      table_layout layout = {}, l_layout = {};
 
-      event_table_vec eval(database &db, const ts_list &ts);
+      event_table_runs eval_runs(database &db, const ts_list &ts);
     };
 
     struct MEventually {
       devector<size_t> ts_buf;
-      ptr_type<MState> r_state;
+      clone_ptr<MState> r_state;
       eventually_impl impl;
+      table_layout layout = {};
 
-      event_table_vec eval(database &db, const ts_list &ts);
+      event_table_runs eval_runs(database &db, const ts_list &ts);
     };
 
     struct MAgg {
-      ptr_type<MState> state;
+      clone_ptr<MState> state;
       agg_base::aggregation_impl impl;
-
-      event_table_vec eval(database &db, const ts_list &ts);
+      // Only used if the subformula produces deltas: the groups are then kept
+      // across time points and updated with the deltas. They hold the values
+      // aggregated per group, not the rows of the subformula.
+      std::optional<agg_temporal::temporal_aggregation_impl> inc_impl = {};
+      size_t inc_rows = 0;
+      size_t num_bound_vars = 0;
+
+      event_table_runs eval_runs(database &db, const ts_list &ts);
+      event_table_runs eval_incremental(database &db, const ts_list &ts);
     };
 
     struct MLet {
       std::vector<size_t> projection_mask;
       pred_id_t pred_id;
-      ptr_type<MState> phi_state, psi_state;
+      clone_ptr<MState> phi_state, psi_state;
 
-      event_table_vec eval(database &db, const ts_list &ts);
+      event_table_runs eval_runs(database &db, const ts_list &ts);
+    };
+
+    // Occurrence of a subformula that is shared between the formulas of a
+    // multi_monitor. The shared state is evaluated once per step, before the
+    // formulas, and every occurrence returns a copy of its result runs, i.e.
+    // one copy per changed result rather than per tp. Shared states never
+    // produce deltas (see enable_deltas), so a conjunction or aggregation
+    // above an occurrence evaluates the full result at every tp where the
+    // unshared formula would apply the changes.
+    struct MShared {
+      std::shared_ptr<event_table_runs> res;
+      event_table_runs eval_runs(database &db, const ts_list &ts);
     };
 
     using val_type =
-      variant<MRel, MPred, MOr, MPrev, MNext, MNeg, MAnd, MFusedUnaryOps,
+      variant<MRel, MPred, MOr, MPrev, MNext, MNeg, MAnd, MMultiAnd,
+              MFusedUnaryOps,
               MSince<since_agg_impl>, MSince<since_impl>, MOnce<once_agg_impl>,
-              MOnce<once_impl>, MUntil, MEventually, MAgg, MLet>;
+              MOnce<once_impl>, MUntil, MEventually, MAgg, MLet, MShared>;
     using init_pair = pair<val_type, table_layout>;
 
     explicit MState(val_type &&state);
@@ -300,11 +492,28 @@ namespace detail {
 
     static init_pair init_and_state(const fo::Formula::and_t &arg);
 
+    // Whether the state can produce deltas: since/once without aggregation
+    // and disjunctions of such states
+    static bool supports_deltas(const val_type &state);
+
+    // Switches a state to producing deltas, returns false if it does not
+    // support them. MShared does not, as other occurrences of the shared
+    // state may need its full result.
+    static bool enable_deltas(val_type &state);
+
     static init_pair init_and_join_state(const fo::Formula &phil,
                                          const fo::Formula &phir,
                                          bool right_negated);
     static init_pair init_and_rel_state(const fo::Formula::and_t &arg);
 
+    static bool is_positive_join(const fo::Formula::and_t &arg);
+
+    static void collect_join_operands(const fo::Formula &formula,
+                                      vector<const fo::Formula *> &operands);
+
+    static init_pair
+    init_multi_and_state(const vector<const fo::Formula *> &operands);
+
     static init_pair init_and_safe_assign(const fo::Formula &phil,
                                           const fo::Formula &phir);
 
@@ -342,15 +551,17 @@ namespace detail {
           auto agg_layout = agg_impl.get_layout();
           auto impl =
             ImplTrue(r_layout.size(), arg.inter, std::forward<Agg>(agg_impl));
-          return {StTrue{{}, uniq(std::move(r_state)), std::move(impl)},
+          return {StTrue{{}, uniq(std::move(r_state)), std::move(impl),
+                         std::move(r_layout)},
                   agg_layout};
         } else {
           auto impl = ImplTrue(r_layout.size(), arg.inter);
-          return {StTrue{{}, uniq(std::move(r_state)), std::move(impl)},
+          return {StTrue{{}, uniq(std::move(r_state)), std::move(impl),
+                         r_layout},
                   r_layout};
         }
       }
-      ptr_type<MState> l_state;
+      clone_ptr<MState> l_state;
       table_layout l_layout;
       bool left_negated = false;
       if (const auto *neg_inner = arg.phil->inner_if_neg()) {
@@ -372,31 +583,175 @@ namespace detail {
                    {},
                    std::move(l_state),
                    uniq(std::move(r_state)),
-                   std::move(impl)},
+                   std::move(impl),
+                   std::move(r_layout)},
                 std::move(agg_layout)};
       } else {
         auto info = get_join_info(l_layout, r_layout);
         Impl impl(left_negated, r_layout.size(), std::move(info.comm_idx2),
                   arg.inter);
-        return {St{binary_buffer(),
-                   {},
-                   std::move(l_state),
-                   uniq(std::move(r_state)),
-                   std::move(impl)},
-                std::move(r_layout)};
+        St st{binary_buffer(), {}, std::move(l_state), uniq(std::move(r_state)),
+              std::move(impl), r_layout};
+        if constexpr (std::is_same_v<St, MUntil>)
+          st.l_layout = std::move(l_layout);
+        return {std::move(st), std::move(r_layout)};
       }
     }
 
     static init_pair init_mstate(const Formula &formula);
+    static init_pair init_unshared_state(const Formula &formula);
+    static init_pair init_shared_state(const Formula &formula);
+
+    // Counts the occurrences of the subformulas that may be shared, which
+    // excludes atoms and everything inside of lets
+    static void count_subformulas(const Formula &formula,
+                                  shared_subformulas &shared);
+
+    // Calls f(child) for every direct subtree
+    template<typename F>
+    void for_each_child(F &&f) const {
+      var2::visit(
+        [&f](const auto &arg) {
+          if constexpr (requires { arg.states; }) {
+            for (const auto &child : arg.states)
+              f(*child);
+          }
+          if constexpr (requires { arg.state; })
+            f(*arg.state);
+          if constexpr (requires { arg.phi_state; })
+            f(*arg.phi_state);
+          if constexpr (requires { arg.l_state; })
+            f(*arg.l_state);
+          if constexpr (requires { arg.r_state; })
+            f(*arg.r_state);
+          if constexpr (requires { arg.psi_state; })
+            f(*arg.psi_state);
+        },
+        state);
+    }
+
+    // Calls f(child, n) for every direct subtree in which n more variables
+    // are bound than in this state. Let definitions are skipped, their
+    // variables are unrelated to those of the state.
+    template<typename Self, typename F>
+    static void for_each_scoped_child(Self &self, F &&f) {
+      var2::visit(
+        [&f](auto &arg) {
+          using T = std::decay_t<decltype(arg)>;
+          size_t n = 0;
+          if constexpr (std::is_same_v<T, MFusedUnaryOps>) {
+            n = static_cast<size_t>(
+              std::count_if(arg.un_ops.cbegin(), arg.un_ops.cend(),
+                            [](const auto &op) {
+                              return var2::holds_alternative<
+                                MFusedUnaryOps::Exists>(op);
+                            }));
+          } else if constexpr (requires { arg.num_bound_vars; }) {
+            n = arg.num_bound_vars;
+          }
+          if constexpr (requires { arg.states; }) {
+            for (auto &child : arg.states)
+              f(*child, n);
+          }
+          if constexpr (requires { arg.state; })
+            f(*arg.state, n);
+          if constexpr (requires { arg.l_state; })
+            f(*arg.l_state, n);
+          if constexpr (requires { arg.r_state; })
+            f(*arg.r_state, n);
+          if constexpr (requires { arg.psi_state; })
+            f(*arg.psi_state, n);
+        },
+        self.state);
+    }
+
+    // Subtrees lighter than this are not worth a task of their own
+    static constexpr size_t MIN_FORK_WEIGHT = 4;
+
+    // Runs f1 and f2, in parallel if a task pool is configured and both are
+    // worth a task of their own
+    template<typename F1, typename F2>
+    static void fork_join(bool worth_forking, F1 &&f1, F2 &&f2) {
+      common::task_pool *pool = common::task_pool::global();
+      if (pool && worth_forking) {
+        pool->fork_join(f1, f2);
+      } else {
+        f1();
+        f2();
+      }
+    }
+
+    // Runs f1 and f2, which evaluate the subtrees s1 and s2
+    template<typename F1, typename F2>
+    static void eval_siblings(const MState &s1, const MState &s2, F1 &&f1,
+                              F2 &&f2) {
+      fork_join(s1.worth_forking() && s2.worth_forking(), f1, f2);
+    }
+
+    [[nodiscard]] bool worth_forking() const {
+      return !contains_let && eval_weight >= MIN_FORK_WEIGHT;
+    }
+
     val_type state;
+    // Rough estimate of the work needed to evaluate the subtree per time
+    // point: predicates count 1, temporal operators 4
+    size_t eval_weight = 0;
+    // MLet modifies the database while evaluating its subformula, so subtrees
+    // containing one are never evaluated concurrently with others
+    bool contains_let = false;
+
+    // Set while the formulas of a multi_monitor are initialized
+    static inline thread_local shared_subformulas *sharing_ = nullptr;
+  };
+
+  struct formula_ptr_hash {
+    size_t operator()(const Formula *f) const {
+      return absl::Hash<Formula>{}(*f);
+    }
+  };
+
+  struct formula_ptr_eq {
+    bool operator()(const Formula *f1, const Formula *f2) const {
+      return *f1 == *f2;
+    }
+  };
+
+  // Hash-conses the subformulas of the formulas of a multi_monitor: every
+  // subformula that occurs more than once gets a single state. The formulas
+  // must outlive the initialization of their states.
+  struct shared_subformulas {
+    struct entry {
+      MState state;
+      std::shared_ptr<event_table_runs> res;
+      table_layout layout;
+    };
+
+    explicit shared_subformulas(const vector<Formula> &formulas);
+
+    template<typename V>
+    using formula_map =
+      flat_hash_map<const Formula *, V, formula_ptr_hash, formula_ptr_eq>;
+    formula_map<size_t> num_occurrences;
+    formula_map<size_t> entry_idx;
+    // Inner subformulas come before the subformulas containing them
+    vector<entry> entries;
   };
 
   class monitor {
+    friend class multi_monitor;
+
   public:
     monitor() = default;
     explicit monitor(const Formula &formula);
     satisfactions step(database &db, const ts_list &ts);
     satisfactions last_step();
+    // Erases the rows selected by filter from the tuples kept by the temporal
+    // operators, as if the tuples they were derived from had never occurred.
+    // No verdict that the caller relies on may depend on them.
+    void erase_rows_if(const row_filter &filter);
+    [[nodiscard]] bool has_rows(const row_filter &filter) const;
+    // Number of time points whose verdicts have been output
+    [[nodiscard]] size_t num_verdict_tps() const { return curr_tp_; }
 
   private:
     MState state_;
@@ -406,9 +761,30 @@ namespace detail {
     size_t max_tp_{};
   };
 
+  // Monitors several formulas on the same trace, the verdicts of each formula
+  // are returned separately. Subformulas that occur more than once, also
+  // across formulas, are evaluated only once.
+  class multi_monitor {
+  public:
+    multi_monitor() = default;
+    explicit multi_monitor(const vector<Formula> &formulas);
+    // One list of satisfactions per formula, in the order of the formulas
+    vector<satisfactions> step(database &db, const ts_list &ts);
+    vector<satisfactions> last_step();
+    [[nodiscard]] size_t num_formulas() const { return monitors_.size(); }
+
+  private:
+    vector<shared_subformulas::entry> shared_;
+    vector<monitor> monitors_;
+    // The formulas are stepped in parallel unless one of them contains a let,
+    // which modifies the database
+    bool contains_let_ = false;
+  };
+
 }// namespace detail
 
 using detail::monitor;
+using detail::multi_monitor;
 
 }// namespace monitor
 
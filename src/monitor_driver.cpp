@@ -1,15 +1,58 @@
+#include <atomic>
+#include <cstdint>
+#include <exception>
 #include <monitor_driver.h>
+#include <SPSCQueue.h>
+#include <thread>
+
+formula_monitor::formula_monitor(const std::vector<fo::Formula> &formulas,
+                                 size_t num_slices) {
+  if (formulas.size() == 1) {
+    mon_.emplace<monitor::sliced_monitor>(formulas[0], num_slices);
+    return;
+  }
+  if (num_slices > 1)
+    throw std::invalid_argument(
+      "several formulas cannot be monitored with slicing");
+  mon_.emplace<monitor::multi_monitor>(formulas);
+}
+
+std::vector<monitor::satisfactions>
+formula_monitor::step(monitor::database &db, const monitor::ts_list &ts) {
+  if (auto *sliced = std::get_if<monitor::sliced_monitor>(&mon_))
+    return make_vector(sliced->step(db, ts));
+  return std::get<monitor::multi_monitor>(mon_).step(db, ts);
+}
+
+std::vector<monitor::satisfactions> formula_monitor::last_step() {
+  if (auto *sliced = std::get_if<monitor::sliced_monitor>(&mon_))
+    return make_vector(sliced->last_step());
+  return std::get<monitor::multi_monitor>(mon_).last_step();
+}
 
 verdict_printer::verdict_printer(std::optional<std::string> file_name) {
   if (file_name)
     ofile_.emplace(fmt::output_file(std::move(*file_name)));
 }
 
-void verdict_printer::print_verdict(monitor::satisfactions &sats) {
+void verdict_printer::print_verdict(
+  std::vector<monitor::satisfactions> &formula_sats) {
+  if (formula_sats.size() == 1) {
+    print_sats(formula_sats[0], std::nullopt);
+    return;
+  }
+  for (size_t i = 0; i < formula_sats.size(); ++i)
+    print_sats(formula_sats[i], i);
+}
+
+void verdict_printer::print_sats(monitor::satisfactions &sats,
+                                 std::optional<size_t> formula_id) {
   for (auto &[ts, tp, tbl] : sats) {
     if (tbl.empty())
       continue;
     std::sort(tbl.begin(), tbl.end());
+    if (formula_id)
+      print("[formula {}] ", *formula_id);
     print("@{} (time point {}):", ts, tp);
     if (tbl.size() == 1 && tbl[0].empty()) {
       print(" true\n");
@@ -20,3 +63,156 @@ void verdict_printer::print_verdict(monitor::satisfactions &sats) {
     }
   }
 }
+
+namespace {
+// Bounded queue between two pipeline stages, nullopt marks the end of the
+// stream. A stage that waits for the other end blocks until it is notified.
+// Both ends give up once the queue is cancelled.
+template<typename T>
+class pipeline_queue {
+public:
+  static constexpr size_t CAPACITY = 64;
+
+  pipeline_queue() : queue_(CAPACITY) {}
+
+  // Returns false if the queue was cancelled
+  bool push(std::optional<T> &&elem) {
+    while (true) {
+      // read before trying, so that a pop in between ends the wait
+      auto seen = popped_.load(std::memory_order_acquire);
+      if (cancelled_.load(std::memory_order_relaxed))
+        return false;
+      if (queue_.try_push(std::move(elem)))
+        break;
+      popped_.wait(seen, std::memory_order_acquire);
+    }
+    pushed_.fetch_add(1, std::memory_order_release);
+    pushed_.notify_one();
+    return true;
+  }
+
+  // Returns nullopt at the end of the stream or if the queue was cancelled
+  std::optional<T> pop() {
+    std::optional<T> *front;
+    while (true) {
+      auto seen = pushed_.load(std::memory_order_acquire);
+      if (cancelled_.load(std::memory_order_relaxed))
+        return std::nullopt;
+      if ((front = queue_.front()))
+        break;
+      pushed_.wait(seen, std::memory_order_acquire);
+    }
+    std::optional<T> res = std::move(*front);
+    queue_.pop();
+    popped_.fetch_add(1, std::memory_order_release);
+    popped_.notify_one();
+    return res;
+  }
+
+  // Wakes up both ends, which return right away from now on
+  void cancel() {
+    cancelled_.store(true, std::memory_order_relaxed);
+    pushed_.fetch_add(1, std::memory_order_release);
+    popped_.fetch_add(1, std::memory_order_release);
+    pushed_.notify_all();
+    popped_.notify_all();
+  }
+
+private:
+  rigtorp::SPSCQueue<std::optional<T>> queue_;
+  std::atomic<bool> cancelled_{false};
+  // Number of pushes and pops so far, waited on when the queue is empty or
+  // full
+  std::atomic<uint64_t> pushed_{0}, popped_{0};
+};
+
+// Input of one step; no input means the last step. The latency markers were
+// read before the input.
+struct step_input {
+  std::optional<monitor_input> input;
+  std::vector<int64_t> latency_markers;
+};
+
+// Verdicts of one step, printed after the latency markers are answered
+struct step_output {
+  std::vector<int64_t> latency_markers;
+  std::vector<monitor::satisfactions> sats;
+};
+}// namespace
+
+void run_pipelined(const pipeline_source &source, formula_monitor &mon,
+                   verdict_printer &printer,
+                   const std::function<void()> &before_last_step) {
+  std::atomic<bool> cancelled{false};
+  pipeline_queue<step_input> inputs;
+  pipeline_queue<step_output> verdicts;
+  std::exception_ptr producer_error, printer_error;
+  auto cancel = [&] {
+    if (cancelled.exchange(true))
+      return;
+    inputs.cancel();
+    verdicts.cancel();
+    if (source.cancel)
+      source.cancel();
+  };
+
+  std::thread producer([&] {
+    try {
+      while (true) {
+        step_input next;
+        next.input = source.produce(next.latency_markers);
+        bool is_last = !next.input;
+        if (!inputs.push(std::move(next)) || is_last)
+          return;
+      }
+    } catch (...) {
+      // errors caused by cancelling the input are not reported
+      if (!cancelled)
+        producer_error = std::current_exception();
+    }
+    inputs.push(std::nullopt);
+  });
+  std::thread printer_thread([&] {
+    try {
+      while (auto out = verdicts.pop()) {
+        for (auto lm : out->latency_markers)
+          source.echo_marker(lm);
+        printer.print_verdict(out->sats);
+      }
+    } catch (...) {
+      printer_error = std::current_exception();
+      cancel();
+    }
+  });
+
+  try {
+    while (!cancelled) {
+      auto next = inputs.pop();
+      // like the sequential drivers, a failing producer skips the last step
+      if (!next)
+        break;
+      step_output out{std::move(next->latency_markers), {}};
+      if (!next->input) {
+        if (before_last_step)
+          before_last_step();
+        out.sats = mon.last_step();
+        verdicts.push(std::move(out));
+        break;
+      }
+      out.sats = mon.step(next->input->first, next->input->second);
+      verdicts.push(std::move(out));
+    }
+    verdicts.push(std::nullopt);
+  } catch (...) {
+    cancel();
+    producer.join();
+    printer_thread.join();
+    throw;
+  }
+  producer.join();
+  printer_thread.join();
+  if (printer_error)
+    std::rethrow_exception(printer_error);
+  if (producer_error)
+    std::rethrow_exception(producer_error);
+}
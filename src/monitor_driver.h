@@ -1,17 +1,44 @@
 #ifndef CPPMON_MONITOR_DRIVER_H
 #define CPPMON_MONITOR_DRIVER_H
+#include <cstdint>
+#include <database.h>
 #include <fmt/format.h>
 #include <fmt/os.h>
+#include <functional>
 #include <monitor.h>
 #include <optional>
+#include <slicer.h>
 #include <stdexcept>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Monitors a single formula with a sliced_monitor, or several formulas that
+// share their subformulas with a multi_monitor
+class formula_monitor {
+public:
+  formula_monitor() = default;
+  formula_monitor(const std::vector<fo::Formula> &formulas, size_t num_slices);
+  // One list of satisfactions per formula, in the order of the formulas
+  std::vector<monitor::satisfactions> step(monitor::database &db,
+                                           const monitor::ts_list &ts);
+  std::vector<monitor::satisfactions> last_step();
+
+private:
+  std::variant<monitor::sliced_monitor, monitor::multi_monitor> mon_;
+};
 
 class verdict_printer {
 public:
   explicit verdict_printer(std::optional<std::string> file_name);
-  void print_verdict(monitor::satisfactions &sats);
+  // The verdicts are tagged with the index of their formula if there are
+  // several formulas
+  void print_verdict(std::vector<monitor::satisfactions> &formula_sats);
 
 private:
+  void print_sats(monitor::satisfactions &sats,
+                  std::optional<size_t> formula_id);
+
   template<typename... Args>
   void print(fmt::format_string<Args...> fmt, Args &&...args) {
     if (ofile_)
@@ -22,6 +49,33 @@ private:
   std::optional<fmt::ostream> ofile_;
 };
 
+using monitor_input = std::pair<monitor::database, monitor::ts_list>;
+
+// Input stage of run_pipelined
+struct pipeline_source {
+  // Returns the input of the next step, nullopt at the end of the input.
+  // Latency markers read before that input are appended to the vector
+  // instead of being answered right away.
+  std::function<std::optional<monitor_input>(std::vector<int64_t> &)> produce;
+  // Answers a latency marker, called by the printer thread once the verdicts
+  // of all steps before the marker are printed. May be empty if produce never
+  // returns markers.
+  std::function<void(int64_t)> echo_marker;
+  // Called from another thread if the pipeline fails, must make a produce
+  // call that is blocked on its input return or throw. May be empty if
+  // produce never blocks indefinitely.
+  std::function<void()> cancel;
+};
+
+// Runs the producer of the databases (parser or deserializer), the monitor and
+// the verdict printer on three threads, connected by bounded queues. produce
+// is called until it returns nullopt, then before_last_step is called (if not
+// empty) and the monitor does its last step. Exceptions of the producer and
+// the printer are rethrown by this function.
+void run_pipelined(const pipeline_source &source, formula_monitor &mon,
+                   verdict_printer &printer,
+                   const std::function<void()> &before_last_step = {});
+
 class monitor_driver {
 public:
   virtual void do_monitor() = 0;
@@ -3,24 +3,40 @@
 
 #include <absl/container/flat_hash_map.h>
 #include <buffers.h>
+#include <config.h>
 #include <event_data.h>
+#include <hash_cache.h>
 #include <limits>
 #include <string>
 #include <table.h>
+#ifdef USE_COLUMNAR_TABLES
+#include <columnar_storage.h>
+#endif
 #include <traceparser.h>
 #include <utility>
 #include <vector>
 #include <optional>
 
 namespace monitor {
+#ifdef USE_COLUMNAR_TABLES
+using event_table = table<common::event_data, columnar_storage>;
+#else
 using event_table = table<common::event_data>;
+#endif
 using opt_table = std::optional<event_table>;
 using event_table_vec = std::vector<opt_table>;
+// One opt_table per tp, stored as runs of equal tables
+using event_table_runs = common::run_length_vec<opt_table>;
 // (ts, tp, data)
-using satisfactions = std::vector<
-  std::tuple<size_t, size_t, std::vector<std::vector<common::event_data>>>>;
-using event = std::vector<common::event_data>;
+using event = parse::database_tuple;
+using satisfactions =
+  std::vector<std::tuple<size_t, size_t, std::vector<event>>>;
+using hashed_event = common::hash_cached<event>;
+// Changes of the result of an operator from one time point to the next, in the
+// order in which they happened (true = insertion, false = deletion)
+using table_delta = std::vector<std::pair<hashed_event, bool>>;
 using binary_buffer = common::binary_buffer<opt_table>;
+using nary_buffer = common::nary_buffer<opt_table>;
 using ts_list = std::vector<size_t>;
 inline constexpr size_t MAXIMUM_TIMESTAMP = std::numeric_limits<size_t>::max();
 }// namespace monitor
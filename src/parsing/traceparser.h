@@ -36,7 +36,7 @@ enum arg_types
 
 using signature = absl::flat_hash_map<std::string, std::vector<arg_types>>;
 
-using database_tuple = std::vector<common::event_data>;
+using database_tuple = inline_tuple<common::event_data>;
 using database_elem = std::vector<database_tuple>;
 using database = absl::flat_hash_map<pred_id_t, database_elem>;
 using timestamped_database = std::pair<size_t, database>;
@@ -192,7 +192,7 @@ private:
 
     template<typename Context, typename Reader>
     static void parse_event(lexy::rule_scanner<Context, Reader> &scanner,
-                            std::vector<common::event_data> &tup,
+                            database_tuple &tup,
                             arg_types ty) {
       if (ty == INT_TYPE || ty == FLOAT_TYPE) {
         auto maybe_lexeme = scanner.capture(
@@ -237,7 +237,7 @@ private:
 
     template<typename Context, typename Reader>
     static void parse_tuple(lexy::rule_scanner<Context, Reader> &scanner,
-                            std::vector<common::event_data> &tup,
+                            database_tuple &tup,
                             const std::vector<arg_types> &tys) {
       scanner.parse(dsl::lit_c<'('>);
       if (!scanner)
@@ -304,7 +304,7 @@ private:
         dsl::peek_not(dsl::ascii::alpha_digit_underscore / dsl::semicolon))) {
         if (!scanner)
           return lexy::scan_failed;
-        std::vector<common::event_data> tup;
+        database_tuple tup;
         tup.reserve(n_args);
         parse_tuple(scanner, tup, it->second);
         if (!scanner)
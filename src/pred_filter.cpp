@@ -0,0 +1,295 @@
+#include <absl/container/flat_hash_map.h>
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <pred_filter.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CPPMON_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace monitor::detail {
+namespace {
+  constexpr size_t BLOCK = 256;
+  constexpr size_t WORDS = BLOCK / 64;
+  constexpr std::uint8_t FLOAT_TAG = 1;
+  // Tag of gathered NaNs, which are not equal to anything
+  constexpr std::uint8_t NAN_TAG = 3;
+
+  // All kernels process a full block and AND their result into mask
+  using eq_const_fn = void (*)(const std::uint64_t *bits,
+                               const std::uint8_t *tags, std::uint64_t cst_bits,
+                               std::uint8_t cst_tag, std::uint64_t *mask);
+  using eq_cols_fn = void (*)(const std::uint64_t *bits1,
+                              const std::uint8_t *tags1,
+                              const std::uint64_t *bits2,
+                              const std::uint8_t *tags2, std::uint64_t *mask);
+
+  void eq_const_scalar(const std::uint64_t *bits, const std::uint8_t *tags,
+                       std::uint64_t cst_bits, std::uint8_t cst_tag,
+                       std::uint64_t *mask) {
+    for (size_t w = 0; w < WORDS; ++w) {
+      std::uint64_t m = 0;
+      for (size_t j = 0; j < 64; ++j) {
+        size_t i = w * 64 + j;
+        m |= std::uint64_t{bits[i] == cst_bits && tags[i] == cst_tag} << j;
+      }
+      mask[w] &= m;
+    }
+  }
+
+  void eq_cols_scalar(const std::uint64_t *bits1, const std::uint8_t *tags1,
+                      const std::uint64_t *bits2, const std::uint8_t *tags2,
+                      std::uint64_t *mask) {
+    for (size_t w = 0; w < WORDS; ++w) {
+      std::uint64_t m = 0;
+      for (size_t j = 0; j < 64; ++j) {
+        size_t i = w * 64 + j;
+        m |= std::uint64_t{bits1[i] == bits2[i] && tags1[i] == tags2[i]} << j;
+      }
+      mask[w] &= m;
+    }
+  }
+
+#ifdef CPPMON_X86_KERNELS
+  __attribute__((target("avx2"))) void
+  eq_const_avx2(const std::uint64_t *bits, const std::uint8_t *tags,
+                std::uint64_t cst_bits, std::uint8_t cst_tag,
+                std::uint64_t *mask) {
+    const __m256i vb = _mm256_set1_epi64x(static_cast<long long>(cst_bits));
+    const __m256i vt = _mm256_set1_epi8(static_cast<char>(cst_tag));
+    for (size_t w = 0; w < WORDS; ++w) {
+      std::uint64_t mb = 0, mt = 0;
+      for (size_t j = 0; j < 64; j += 4) {
+        __m256i v = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(bits + w * 64 + j));
+        auto eq = _mm256_castsi256_pd(_mm256_cmpeq_epi64(v, vb));
+        mb |= std::uint64_t{static_cast<unsigned>(_mm256_movemask_pd(eq))} << j;
+      }
+      for (size_t j = 0; j < 64; j += 32) {
+        __m256i t = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(tags + w * 64 + j));
+        auto eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(t, vt));
+        mt |= std::uint64_t{static_cast<std::uint32_t>(eq)} << j;
+      }
+      mask[w] &= mb & mt;
+    }
+  }
+
+  __attribute__((target("avx2"))) void
+  eq_cols_avx2(const std::uint64_t *bits1, const std::uint8_t *tags1,
+               const std::uint64_t *bits2, const std::uint8_t *tags2,
+               std::uint64_t *mask) {
+    for (size_t w = 0; w < WORDS; ++w) {
+      std::uint64_t mb = 0, mt = 0;
+      for (size_t j = 0; j < 64; j += 4) {
+        __m256i v1 = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(bits1 + w * 64 + j));
+        __m256i v2 = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(bits2 + w * 64 + j));
+        auto eq = _mm256_castsi256_pd(_mm256_cmpeq_epi64(v1, v2));
+        mb |= std::uint64_t{static_cast<unsigned>(_mm256_movemask_pd(eq))} << j;
+      }
+      for (size_t j = 0; j < 64; j += 32) {
+        __m256i t1 = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(tags1 + w * 64 + j));
+        __m256i t2 = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(tags2 + w * 64 + j));
+        auto eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(t1, t2));
+        mt |= std::uint64_t{static_cast<std::uint32_t>(eq)} << j;
+      }
+      mask[w] &= mb & mt;
+    }
+  }
+
+  __attribute__((target("sse4.1"))) void
+  eq_const_sse(const std::uint64_t *bits, const std::uint8_t *tags,
+               std::uint64_t cst_bits, std::uint8_t cst_tag,
+               std::uint64_t *mask) {
+    const __m128i vb = _mm_set1_epi64x(static_cast<long long>(cst_bits));
+    const __m128i vt = _mm_set1_epi8(static_cast<char>(cst_tag));
+    for (size_t w = 0; w < WORDS; ++w) {
+      std::uint64_t mb = 0, mt = 0;
+      for (size_t j = 0; j < 64; j += 2) {
+        __m128i v =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(bits + w * 64 + j));
+        auto eq = _mm_castsi128_pd(_mm_cmpeq_epi64(v, vb));
+        mb |= std::uint64_t{static_cast<unsigned>(_mm_movemask_pd(eq))} << j;
+      }
+      for (size_t j = 0; j < 64; j += 16) {
+        __m128i t =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(tags + w * 64 + j));
+        auto eq = _mm_movemask_epi8(_mm_cmpeq_epi8(t, vt));
+        mt |= std::uint64_t{static_cast<unsigned>(eq)} << j;
+      }
+      mask[w] &= mb & mt;
+    }
+  }
+
+  __attribute__((target("sse4.1"))) void
+  eq_cols_sse(const std::uint64_t *bits1, const std::uint8_t *tags1,
+              const std::uint64_t *bits2, const std::uint8_t *tags2,
+              std::uint64_t *mask) {
+    for (size_t w = 0; w < WORDS; ++w) {
+      std::uint64_t mb = 0, mt = 0;
+      for (size_t j = 0; j < 64; j += 2) {
+        __m128i v1 = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(bits1 + w * 64 + j));
+        __m128i v2 = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(bits2 + w * 64 + j));
+        auto eq = _mm_castsi128_pd(_mm_cmpeq_epi64(v1, v2));
+        mb |= std::uint64_t{static_cast<unsigned>(_mm_movemask_pd(eq))} << j;
+      }
+      for (size_t j = 0; j < 64; j += 16) {
+        __m128i t1 = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(tags1 + w * 64 + j));
+        __m128i t2 = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(tags2 + w * 64 + j));
+        auto eq = _mm_movemask_epi8(_mm_cmpeq_epi8(t1, t2));
+        mt |= std::uint64_t{static_cast<unsigned>(eq)} << j;
+      }
+      mask[w] &= mb & mt;
+    }
+  }
+#endif
+
+  struct kernels {
+    eq_const_fn eq_const;
+    eq_cols_fn eq_cols;
+  };
+
+  const kernels &best_kernels() {
+    static const kernels k = []() -> kernels {
+#ifdef CPPMON_X86_KERNELS
+      if (pred_filter::supported(pred_filter::isa::avx2))
+        return {eq_const_avx2, eq_cols_avx2};
+      if (pred_filter::supported(pred_filter::isa::sse41))
+        return {eq_const_sse, eq_cols_sse};
+#endif
+      return {eq_const_scalar, eq_cols_scalar};
+    }();
+    return k;
+  }
+
+  kernels get_kernels(pred_filter::isa isa) {
+    switch (isa) {
+#ifdef CPPMON_X86_KERNELS
+      case pred_filter::isa::avx2:
+        return {eq_const_avx2, eq_cols_avx2};
+      case pred_filter::isa::sse41:
+        return {eq_const_sse, eq_cols_sse};
+#endif
+      case pred_filter::isa::scalar:
+        return {eq_const_scalar, eq_cols_scalar};
+      default:
+        return best_kernels();
+    }
+  }
+
+  // Floats are normalized such that equal values have equal payloads: -0.0
+  // becomes 0.0 and NaNs get a tag of their own and a payload that differs
+  // between columns
+  void gather(const common::event_data &val, size_t col, std::uint64_t &bits,
+              std::uint8_t &tag) {
+    tag = val.type_tag();
+    bits = val.raw_bits();
+    if (tag == FLOAT_TAG) {
+      double d = *val.get_if_float();
+      if (d == 0.0) {
+        bits = 0;
+      } else if (d != d) {
+        tag = NAN_TAG;
+        bits = col;
+      }
+    }
+  }
+}// namespace
+
+bool pred_filter::supported(isa kernels) {
+  switch (kernels) {
+    case isa::best:
+    case isa::scalar:
+      return true;
+#ifdef CPPMON_X86_KERNELS
+    case isa::sse41:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("sse4.1");
+    case isa::avx2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+pred_filter::pred_filter(
+  const std::vector<std::pair<size_t, common::event_data>> &pos_2_cst,
+  const std::vector<std::vector<size_t>> &var_pos) {
+  absl::flat_hash_map<size_t, size_t> pos_2_col;
+  auto col_of = [this, &pos_2_col](size_t pos) {
+    auto [it, inserted] = pos_2_col.try_emplace(pos, cols_.size());
+    if (inserted)
+      cols_.push_back(pos);
+    return it->second;
+  };
+  for (const auto &[pos, cst] : pos_2_cst) {
+    std::uint64_t bits;
+    std::uint8_t tag;
+    gather(cst, 0, bits, tag);
+    if (tag == NAN_TAG)
+      unsatisfiable_ = true;
+    csts_.push_back({col_of(pos), bits, tag, cst});
+  }
+  for (const auto &poss : var_pos) {
+    for (size_t i = 1; i < poss.size(); ++i)
+      eqs_.push_back({col_of(poss[0]), col_of(poss[i])});
+  }
+}
+
+void pred_filter::select(const std::vector<event> &events,
+                         std::vector<std::uint32_t> &sel, isa kernels) const {
+  assert(supported(kernels));
+  if (unsatisfiable_)
+    return;
+  if (trivial()) {
+    for (size_t i = 0; i < events.size(); ++i)
+      sel.push_back(static_cast<std::uint32_t>(i));
+    return;
+  }
+  auto k = get_kernels(kernels);
+  size_t ncols = cols_.size();
+  std::vector<std::uint64_t> bits(ncols * BLOCK);
+  std::vector<std::uint8_t> tags(ncols * BLOCK);
+  for (size_t base = 0; base < events.size(); base += BLOCK) {
+    size_t n = std::min(BLOCK, events.size() - base);
+    for (size_t i = 0; i < n; ++i) {
+      const auto &ev = events[base + i];
+      for (size_t c = 0; c < ncols; ++c)
+        gather(ev[cols_[c]], c, bits[c * BLOCK + i], tags[c * BLOCK + i]);
+    }
+    // Lanes past the end of the events hold stale values and start out unset
+    std::uint64_t mask[WORDS];
+    for (size_t w = 0; w < WORDS; ++w) {
+      size_t lanes = n > w * 64 ? std::min<size_t>(n - w * 64, 64) : 0;
+      mask[w] = lanes == 64 ? ~std::uint64_t{0}
+                            : (std::uint64_t{1} << lanes) - 1;
+    }
+    for (const auto &cst : csts_)
+      k.eq_const(bits.data() + cst.col * BLOCK, tags.data() + cst.col * BLOCK,
+                 cst.bits, cst.tag, mask);
+    for (const auto &eq : eqs_)
+      k.eq_cols(bits.data() + eq.col1 * BLOCK, tags.data() + eq.col1 * BLOCK,
+                bits.data() + eq.col2 * BLOCK, tags.data() + eq.col2 * BLOCK,
+                mask);
+    for (size_t w = 0; w < WORDS; ++w) {
+      for (std::uint64_t m = mask[w]; m != 0; m &= m - 1) {
+        auto lane = static_cast<size_t>(std::countr_zero(m));
+        sel.push_back(static_cast<std::uint32_t>(base + w * 64 + lane));
+      }
+    }
+  }
+}
+}// namespace monitor::detail
@@ -0,0 +1,63 @@
+#ifndef CPPMON_PRED_FILTER_H
+#define CPPMON_PRED_FILTER_H
+
+#include <cstdint>
+#include <event_data.h>
+#include <monitor_types.h>
+#include <utility>
+#include <vector>
+
+namespace monitor::detail {
+// Filters the events of a predicate by the constants and repeated variables in
+// its arguments. Events are processed in blocks: the argument columns that are
+// constrained are gathered into contiguous arrays of type tags and payloads,
+// every constraint is evaluated over whole columns into a bitmask (with AVX2
+// or SSE4.1 if the CPU supports it) and the surviving event indexes are
+// written to a selection vector.
+class pred_filter {
+public:
+  // Kernels that evaluate the constraints, best is the fastest one the CPU
+  // supports
+  enum class isa
+  {
+    best,
+    scalar,
+    sse41,
+    avx2
+  };
+
+  pred_filter() = default;
+  pred_filter(
+    const std::vector<std::pair<size_t, common::event_data>> &pos_2_cst,
+    const std::vector<std::vector<size_t>> &var_pos);
+
+  [[nodiscard]] bool trivial() const { return csts_.empty() && eqs_.empty(); }
+  // Whether the kernels are compiled in and supported by the CPU
+  static bool supported(isa kernels);
+
+  // Appends the indexes of the events that satisfy all constraints to sel
+  void select(const std::vector<event> &events, std::vector<std::uint32_t> &sel,
+              isa kernels = isa::best) const;
+
+private:
+  struct cst_check {
+    size_t col;
+    std::uint64_t bits;
+    std::uint8_t tag;
+    // Keeps an interned string constant, and hence its address, alive
+    common::event_data cst;
+  };
+  struct eq_check {
+    size_t col1, col2;
+  };
+
+  // Argument positions that are gathered, indexed by column
+  std::vector<size_t> cols_;
+  std::vector<cst_check> csts_;
+  std::vector<eq_check> eqs_;
+  // Some constant can never be equal to an argument (NaN)
+  bool unsatisfiable_ = false;
+};
+}// namespace monitor::detail
+
+#endif// CPPMON_PRED_FILTER_H
@@ -2,31 +2,107 @@
 #define CPPMON_SINCE_IMPL_H
 
 #include <absl/container/flat_hash_map.h>
+#include <algorithm>
 #include <boost/container/devector.hpp>
+#include <cassert>
 #include <event_data.h>
 #include <formula.h>
 #include <monitor_types.h>
 #include <table.h>
+#include <task_pool.h>
 #include <temporal_aggregation_impl.h>
+#include <utility>
 #include <vector>
 
 namespace monitor::detail {
-using tuple_buf = absl::flat_hash_map<std::vector<common::event_data>, size_t>;
+struct since_entry {
+  // ts since which the tuple satisfies the since formula
+  size_t since_ts;
+  // latest ts at which the tuple occurred in the right operand; the entry is
+  // dropped once the data of that ts leaves the window
+  size_t last_ts;
+};
+}// namespace monitor::detail
+
+template<>
+struct [[maybe_unused]] fmt::formatter<monitor::detail::since_entry> {
+  constexpr auto parse [[maybe_unused]] (format_parse_context &ctx)
+  -> decltype(auto) {
+    auto it = ctx.begin();
+    if (it != ctx.end() && *it != '}')
+      throw format_error("invalid format - only empty format strings are "
+                         "accepted for since_entry");
+    return it;
+  }
+
+  template<typename FormatContext>
+  auto format [[maybe_unused]] (const monitor::detail::since_entry &val,
+                                FormatContext &ctx) const
+  -> decltype(ctx.out()) {
+    return format_to(ctx.out(), "(since: {}, last: {})", val.since_ts,
+                     val.last_ts);
+  }
+};
+
+namespace monitor::detail {
+using tuple_buf = common::hash_cached_map<event, size_t>;
+using since_buf = common::hash_cached_map<event, since_entry>;
+
+// Maps with at least this many entries are filtered in parallel
+constexpr size_t PARALLEL_FILTER_MIN_ENTRIES = 8192;
+constexpr size_t PARALLEL_FILTER_GRAIN = 2048;
+
+// Calls erase(it) for every entry it of map for which pred holds. For large
+// maps, pred is evaluated on all entries in parallel first, so it must not
+// modify anything, and the marked entries are erased afterwards through the
+// iterators collected with them (erasing from a flat_hash_map does not
+// invalidate the iterators to other entries).
+template<typename Map, typename Pred, typename Erase>
+void erase_entries_if(Map &map, Pred pred, Erase erase) {
+  if (!common::task_pool::global() ||
+      map.size() < PARALLEL_FILTER_MIN_ENTRIES) {
+    for (auto it = map.begin(); it != map.end();) {
+      auto curr = it++;
+      if (pred(*curr))
+        erase(curr);
+    }
+    return;
+  }
+  std::vector<typename Map::iterator> entries;
+  entries.reserve(map.size());
+  for (auto it = map.begin(); it != map.end(); ++it)
+    entries.push_back(it);
+  std::vector<char> marks(entries.size());
+  common::parallel_for(entries.size(), PARALLEL_FILTER_GRAIN,
+                       [&entries, &marks, &pred](size_t lo, size_t hi) {
+                         for (size_t i = lo; i < hi; ++i)
+                           marks[i] = pred(*entries[i]);
+                       });
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (marks[i])
+      erase(entries[i]);
+  }
+}
 
 template<typename SinceBase>
 class shared_agg_base {
 public:
   opt_table produce_result() { return temporal_agg_.finalize_table(); }
 
+  // Whether the result may have changed since the last call, see
+  // MOnce::eval_runs
+  bool take_result_changed() { return std::exchange(result_changed_, false); }
+
 protected:
   shared_agg_base(agg_temporal::temporal_aggregation_impl temporal_agg)
       : temporal_agg_(std::move(temporal_agg)) {}
 
-  void tuple_in_update(const event &e, size_t ts) {
+  void tuple_in_update(const hashed_event &e, size_t ts) {
     auto &tuple_in = static_cast<SinceBase *>(this)->tuple_in;
     auto it = tuple_in.find(e);
     if (it == tuple_in.end()) {
-      temporal_agg_.add_result(e);
+      temporal_agg_.add_result(*e);
+      result_changed_ = true;
       tuple_in.emplace(e, ts);
     } else {
       it->second = ts;
@@ -34,7 +110,8 @@ protected:
   }
 
   void tuple_in_erase(tuple_buf::iterator it) {
-    temporal_agg_.remove_result(it->first);
+    temporal_agg_.remove_result(*it->first);
+    result_changed_ = true;
     static_cast<SinceBase *>(this)->tuple_in.erase(it);
   }
 
@@ -42,7 +119,8 @@ protected:
   void tuple_in_erase_if(Pred pred) {
     auto combined_pred = [&pred, this](const tuple_buf::value_type &e) {
       if (pred(e)) {
-        temporal_agg_.remove_result(e.first);
+        temporal_agg_.remove_result(*e.first);
+        result_changed_ = true;
         return true;
       }
       return false;
@@ -50,8 +128,25 @@ protected:
     absl::erase_if(static_cast<SinceBase *>(this)->tuple_in, combined_pred);
   }
 
+  void tuple_in_clear() {
+    auto &tuple_in = static_cast<SinceBase *>(this)->tuple_in;
+    result_changed_ = result_changed_ || !tuple_in.empty();
+    tuple_in.clear();
+  }
+
+  void tuple_set_inserted(const hashed_event &e) {
+    temporal_agg_.add_result(*e);
+    result_changed_ = true;
+  }
+
+  void tuple_set_erased(const event &e) {
+    temporal_agg_.remove_result(e);
+    result_changed_ = true;
+  }
+
 private:
   agg_temporal::temporal_aggregation_impl temporal_agg_;
+  bool result_changed_ = true;
 };
 
 template<typename SinceBase>
@@ -59,6 +154,8 @@ class shared_no_agg {
 public:
   opt_table produce_result() {
     auto *base = static_cast<SinceBase *>(this);
+    if (base->zero_inf)
+      return base->tuple_set.empty() ? opt_table() : opt_table(base->tuple_set);
     auto &tuple_in = base->tuple_in;
     size_t nfvs = base->nfvs;
 
@@ -68,12 +165,12 @@ public:
       auto nxt_it = it;
       nxt_it++;
       if (nxt_it != tuple_in.cend()) {
-        __builtin_prefetch(nxt_it->first.data());
-        __builtin_prefetch(nxt_it->first.data() + 4);
+        __builtin_prefetch(nxt_it->first->data());
+        __builtin_prefetch(nxt_it->first->data() + 4);
         auto nxt_nxt_it = nxt_it;
         nxt_nxt_it++;
         if (nxt_nxt_it != tuple_in.cend())
-          __builtin_prefetch(nxt_nxt_it->first.data());
+          __builtin_prefetch(nxt_nxt_it->first->data());
       }
       tab.add_row(it->first);
       it = nxt_it;
@@ -81,42 +178,144 @@ public:
     return tab.empty() ? opt_table() : std::move(tab);
   }
 
+  // Whether the result may have changed since the last call, see
+  // MOnce::eval_runs
+  bool take_result_changed() { return std::exchange(result_changed_, false); }
+
+  // Instead of materializing the result table at every time point, record the
+  // insertions into and deletions from tuple_in, see take_delta
+  void enable_deltas() { track_deltas_ = true; }
+
+  table_delta take_delta() {
+    table_delta res;
+    std::swap(res, delta_);
+    return res;
+  }
+
 protected:
   shared_no_agg() {}
 
-  void tuple_in_update(const event &e, size_t ts) {
-    static_cast<SinceBase *>(this)->tuple_in.insert_or_assign(e, ts);
+  void tuple_in_update(const hashed_event &e, size_t ts) {
+    auto inserted =
+      static_cast<SinceBase *>(this)->tuple_in.insert_or_assign(e, ts).second;
+    result_changed_ = result_changed_ || inserted;
+    if (track_deltas_ && inserted)
+      delta_.emplace_back(e, true);
   }
 
   void tuple_in_erase(tuple_buf::iterator it) {
+    result_changed_ = true;
+    if (track_deltas_)
+      delta_.emplace_back(it->first, false);
     static_cast<SinceBase *>(this)->tuple_in.erase(it);
   }
 
   template<typename Pred>
   void tuple_in_erase_if(Pred pred) {
-    absl::erase_if(static_cast<SinceBase *>(this)->tuple_in, pred);
+    auto &tuple_in = static_cast<SinceBase *>(this)->tuple_in;
+    absl::erase_if(tuple_in, [&pred, this](const tuple_buf::value_type &e) {
+      if (!pred(e))
+        return false;
+      result_changed_ = true;
+      if (track_deltas_)
+        delta_.emplace_back(e.first, false);
+      return true;
+    });
+  }
+
+  void tuple_in_clear() {
+    auto &tuple_in = static_cast<SinceBase *>(this)->tuple_in;
+    result_changed_ = result_changed_ || !tuple_in.empty();
+    if (track_deltas_) {
+      for (const auto &e : tuple_in)
+        delta_.emplace_back(e.first, false);
+    }
+    tuple_in.clear();
   }
+
+  void tuple_set_inserted(const hashed_event &e) {
+    result_changed_ = true;
+    if (track_deltas_)
+      delta_.emplace_back(e, true);
+  }
+
+  void tuple_set_erased(const event &e) {
+    result_changed_ = true;
+    if (track_deltas_)
+      delta_.emplace_back(e, false);
+  }
+
+private:
+  bool track_deltas_ = false;
+  table_delta delta_;
+  bool result_changed_ = true;
 };
 
 template<typename AggBase>
 class shared_base : public AggBase {
   friend AggBase;
 
+public:
+  // Drops the tuples for which drop holds from the whole state, as if they
+  // had never occurred in the right operand. The results derived from them
+  // (deltas, aggregations) are updated through the same hooks as when they
+  // leave the window.
+  template<typename Pred>
+  void erase_tuples_if(Pred drop) {
+    auto drop_entry = [&drop](const auto &entry) {
+      return drop(*entry.first);
+    };
+    this->tuple_in_erase_if(drop_entry);
+    absl::erase_if(tuple_since, drop_entry);
+    tuple_set.erase_rows_if([this, &drop](const event &e) {
+      if (!drop(e))
+        return false;
+      this->tuple_set_erased(e);
+      return true;
+    });
+    for (auto *buf : {&data_prev, &data_in}) {
+      for (auto &[ts, tab] : *buf) {
+        if (!tab)
+          continue;
+        tab->erase_rows_if(drop);
+        if (tab->empty())
+          tab.reset();
+      }
+    }
+  }
+
+  template<typename Pred>
+  [[nodiscard]] bool any_tuple(Pred pred) const {
+    auto pred_entry = [&pred](const auto &entry) { return pred(*entry.first); };
+    auto pred_row = [&pred](const auto &e) { return pred(*e); };
+    auto in_tab = [&pred_row](const auto &entry) {
+      return entry.second &&
+             std::any_of(entry.second->begin(), entry.second->end(), pred_row);
+    };
+    return std::any_of(tuple_in.begin(), tuple_in.end(), pred_entry) ||
+           std::any_of(tuple_since.begin(), tuple_since.end(), pred_entry) ||
+           std::any_of(tuple_set.begin(), tuple_set.end(), pred_row) ||
+           std::any_of(data_prev.begin(), data_prev.end(), in_tab) ||
+           std::any_of(data_in.begin(), data_in.end(), in_tab);
+  }
+
 protected:
   using table_buf = boost::container::devector<std::pair<size_t, opt_table>>;
 
   template<typename... Args>
   shared_base(size_t nfvs, fo::Interval inter, Args &&...args)
       : AggBase(std::forward<Args>(args)...), nfvs(nfvs), inter(inter),
-        interval_inf(!inter.is_bounded()) {}
-
-  void drop_tuple_from_all_data(const event &e) {
-    auto all_dat_it = all_data_counted.find(e);
-    assert(all_dat_it != all_data_counted.end() && all_dat_it->second > 0);
-    if ((--all_dat_it->second) == 0) {
-      tuple_since.erase(all_dat_it->first);
-      all_data_counted.erase(all_dat_it);
-    }
+        interval_inf(!inter.is_bounded()),
+        zero_inf(interval_inf && inter.contains(0)), tuple_set(nfvs) {}
+
+  // data_prev and data_in are ordered by ts and act as the expiry queue of
+  // tuple_since: the entry of a tuple can only go when the table holding its
+  // latest occurrence expires. Tables with equal ts always expire together.
+  template<typename Row>
+  void expire_from_since(const Row &e, size_t old_ts) {
+    auto since_it = tuple_since.find(e);
+    if (since_it != tuple_since.end() && since_it->second.last_ts == old_ts)
+      tuple_since.erase(since_it);
   }
 
   void drop_too_old(size_t ts) {
@@ -131,15 +330,16 @@ protected:
           auto in_it = tuple_in.find(e);
           if (in_it != tuple_in.end() && in_it->second == tab.first)
             this->tuple_in_erase(in_it);
-          drop_tuple_from_all_data(e);
+          expire_from_since(e, tab.first);
         }
       }
     }
     for (; !data_prev.empty() && inter.gt_upper(ts - data_prev.front().first);
          data_prev.pop_front()) {
-      if (data_prev.front().second) {
-        for (const auto &e : *data_prev.front().second)
-          drop_tuple_from_all_data(e);
+      auto &tab = data_prev.front();
+      if (tab.second) {
+        for (const auto &e : *tab.second)
+          expire_from_since(e, tab.first);
       }
     }
   }
@@ -156,7 +356,8 @@ protected:
       if (latest.second) {
         for (const auto &e : *latest.second) {
           auto since_it = tuple_since.find(e);
-          if (since_it != tuple_since.end() && since_it->second <= old_ts)
+          if (since_it != tuple_since.end() &&
+              since_it->second.since_ts <= old_ts)
             this->tuple_in_update(e, old_ts);
         }
       }
@@ -168,11 +369,22 @@ protected:
   }
 
   void add_new_table(opt_table &tab_r, size_t ts) {
+    if (zero_inf) {
+      if (tab_r) {
+        for (const auto &e : *tab_r) {
+          if (tuple_set.contains(e))
+            continue;
+          this->tuple_set_inserted(e);
+          tuple_set.add_row(e);
+        }
+      }
+      return;
+    }
     if (tab_r) {
       for (const auto &e : *tab_r) {
-        tuple_since.try_emplace(e, ts);
-        if (!interval_inf)
-          all_data_counted[e]++;
+        auto [since_it, inserted] = tuple_since.try_emplace(e, since_entry{ts, ts});
+        if (!inserted)
+          since_it->second.last_ts = ts;
       }
     }
     if (inter.contains(0)) {
@@ -193,18 +405,37 @@ protected:
   size_t nfvs;
   fo::Interval inter;
   bool interval_inf;
+  // For [0, ∞) a tuple holds from its occurrence on the right until the left
+  // operand drops it, so no timestamps are needed: the whole state is
+  // tuple_set, which grows (once) or is filtered by the left operand (since).
+  // The other buffers stay empty. The result only changes when tuple_set does,
+  // so it is emitted as deltas or repeated as a run (see MOnce::eval_runs)
+  // rather than copied at every tp.
+  bool zero_inf;
   table_buf data_prev, data_in;
-  tuple_buf tuple_in, tuple_since, all_data_counted;
+  tuple_buf tuple_in;
+  since_buf tuple_since;
+  event_table tuple_set;
 };
 
 template<typename SinceBase>
 class since_base : public SinceBase {
 public:
   opt_table eval(opt_table &tab_l, opt_table &tab_r, size_t new_ts) {
+    advance(tab_l, tab_r, new_ts);
+    return this->produce_result();
+  }
+
+  table_delta eval_delta(opt_table &tab_l, opt_table &tab_r, size_t new_ts) {
+    advance(tab_l, tab_r, new_ts);
+    return this->take_delta();
+  }
+
+  // Updates the state to the next tp without producing its result
+  void advance(opt_table &tab_l, opt_table &tab_r, size_t new_ts) {
     this->add_new_ts(new_ts);
     this->join(tab_l);
     this->add_new_table(tab_r, new_ts);
-    return this->produce_result();
   }
 
 protected:
@@ -214,6 +445,10 @@ protected:
         comm_idx_r(std::move(comm_idx_r)) {}
 
   void join(opt_table &tab_l) {
+    if (this->zero_inf) {
+      join_set(tab_l);
+      return;
+    }
     if (tab_l) {
       auto hash_set = event_table::hash_all_destructive(*tab_l);
       auto erase_cond = [this, &hash_set](const auto &tup) {
@@ -222,14 +457,33 @@ protected:
         else
           return !hash_set.contains(filter_row(comm_idx_r, tup.first));
       };
-      absl::erase_if(this->tuple_since, erase_cond);
-      this->tuple_in_erase_if(erase_cond);
+      erase_entries_if(this->tuple_since, erase_cond,
+                       [this](auto it) { this->tuple_since.erase(it); });
+      erase_entries_if(this->tuple_in, erase_cond,
+                       [this](auto it) { this->tuple_in_erase(it); });
     } else if (!left_negated) {
-      this->tuple_in.clear();
+      this->tuple_in_clear();
       this->tuple_since.clear();
     }
   }
 
+  void join_set(opt_table &tab_l) {
+    auto &tuple_set = this->tuple_set;
+    if (tab_l) {
+      auto hash_set = event_table::hash_all_destructive(*tab_l);
+      tuple_set.erase_rows_if([this, &hash_set](const event &e) {
+        if (hash_set.contains(filter_row(comm_idx_r, e)) != left_negated)
+          return false;
+        this->tuple_set_erased(e);
+        return true;
+      });
+    } else if (!left_negated) {
+      for (const auto &e : tuple_set)
+        this->tuple_set_erased(*e);
+      tuple_set = event_table(this->nfvs);
+    }
+  }
+
   bool left_negated;
   std::vector<size_t> comm_idx_r;
 };
@@ -238,9 +492,19 @@ template<typename OnceBase>
 class once_base : public OnceBase {
 public:
   opt_table eval(opt_table &tab_r, size_t new_ts) {
+    advance(tab_r, new_ts);
+    return this->produce_result();
+  }
+
+  table_delta eval_delta(opt_table &tab_r, size_t new_ts) {
+    advance(tab_r, new_ts);
+    return this->take_delta();
+  }
+
+  // Updates the state to the next tp without producing its result
+  void advance(opt_table &tab_r, size_t new_ts) {
     this->add_new_ts(new_ts);
     this->add_new_table(tab_r, new_ts);
-    return this->produce_result();
   }
 
 protected:
@@ -0,0 +1,181 @@
+#ifndef CPPMON_SKETCHES_H
+#define CPPMON_SKETCHES_H
+
+#include <absl/container/btree_map.h>
+#include <absl/container/flat_hash_map.h>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <event_data.h>
+#include <limits>
+
+// Approximate aggregation state with bounded memory. Unlike the usual
+// sketches, both support removing a value that was added before, so that they
+// can be used as the state of temporal aggregations. Note that this only bounds
+// the aggregation state: a temporal aggregation still stores the exact tuples
+// of its window, which it needs to know what to remove once they expire.
+namespace monitor::detail::sketch {
+
+// Deterministic 64 bit hash of a value. The hash of a string depends on its
+// contents and not on the address it is interned at, and unlike std::hash or
+// absl::Hash it is the same across platforms and runs (FNV-1a).
+inline uint64_t hash_value(const common::event_data &val) {
+  uint64_t x;
+  if (const std::string *s = val.get_if_string()) {
+    x = 0xcbf29ce484222325;
+    for (unsigned char c : *s)
+      x = (x ^ c) * 0x100000001b3;
+  } else
+    x = val.raw_bits() ^ (uint64_t(val.type_tag()) << 62);
+  // splitmix64 finalizer
+  x += 0x9e3779b97f4a7c15;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+// HyperLogLog distinct count with 2^10 registers (about 3% standard error).
+// Instead of the registers themselves, the number of values that hit each
+// (register, rank) pair is stored sparsely, so that values can be removed
+// again and small groups stay small.
+class distinct_count_sketch {
+public:
+  static constexpr unsigned PRECISION = 10;
+  static constexpr size_t NUM_REGISTERS = size_t(1) << PRECISION;
+
+  void add(const common::event_data &val) { counts_[key_of(val)]++; }
+
+  void remove(const common::event_data &val) {
+    auto it = counts_.find(key_of(val));
+    assert(it != counts_.end() && it->second > 0);
+    if (--it->second == 0)
+      counts_.erase(it);
+  }
+
+  int64_t estimate() const {
+    std::array<uint8_t, NUM_REGISTERS> registers{};
+    for (const auto &[key, cnt] : counts_) {
+      auto &reg = registers[key >> RANK_BITS];
+      reg = std::max(reg, static_cast<uint8_t>(key & RANK_MASK));
+    }
+    double inv_sum = 0.0;
+    size_t zeros = 0;
+    for (uint8_t reg : registers) {
+      inv_sum += std::ldexp(1.0, -static_cast<int>(reg));
+      zeros += reg == 0;
+    }
+    const auto m = static_cast<double>(NUM_REGISTERS);
+    double est = (0.7213 / (1.0 + 1.079 / m)) * m * m / inv_sum;
+    // linear counting for small cardinalities
+    if (est <= 2.5 * m && zeros > 0)
+      est = m * std::log(m / static_cast<double>(zeros));
+    return static_cast<int64_t>(std::llround(est));
+  }
+
+private:
+  static constexpr unsigned RANK_BITS = 6;
+  static constexpr uint16_t RANK_MASK = (1u << RANK_BITS) - 1;
+
+  static uint16_t key_of(const common::event_data &val) {
+    uint64_t h = hash_value(val);
+    auto reg = static_cast<uint16_t>(h >> (64 - PRECISION));
+    uint64_t rest = h << PRECISION;
+    auto rank = static_cast<uint16_t>(
+      rest == 0 ? 64 - PRECISION + 1 : unsigned(std::countl_zero(rest)) + 1);
+    return static_cast<uint16_t>(reg << RANK_BITS | rank);
+  }
+
+  absl::flat_hash_map<uint16_t, uint32_t> counts_;
+};
+
+// Quantiles with a relative error of 1%, by counting values in logarithmically
+// sized buckets (as in DDSketch). The number of buckets only depends on the
+// range of the values. NaNs and strings are ranked below all numbers, like
+// compat_less does.
+class quantile_sketch {
+public:
+  static constexpr double RELATIVE_ACCURACY = 0.01;
+
+  void add(const common::event_data &val) { update(val, 1); }
+
+  void remove(const common::event_data &val) { update(val, -1); }
+
+  // The value of rank floor(q * (n - 1)), approximately
+  common::event_data quantile(double q) const {
+    assert(count_ > 0);
+    auto rank = static_cast<uint64_t>(q * static_cast<double>(count_ - 1));
+    if (rank < nan_count_)
+      return common::event_data::nan();
+    rank -= nan_count_;
+    for (auto it = negative_.rbegin(); it != negative_.rend(); ++it) {
+      if (rank < it->second)
+        return common::event_data::Float(-bucket_value(it->first));
+      rank -= it->second;
+    }
+    if (rank < zero_count_)
+      return common::event_data::Float(0.0);
+    rank -= zero_count_;
+    for (const auto &[idx, cnt] : positive_) {
+      if (rank < cnt)
+        return common::event_data::Float(bucket_value(idx));
+      rank -= cnt;
+    }
+    assert(false);
+    return common::event_data::nan();
+  }
+
+private:
+  using bucket_map = absl::btree_map<int32_t, uint64_t>;
+
+  static double gamma() {
+    return (1.0 + RELATIVE_ACCURACY) / (1.0 - RELATIVE_ACCURACY);
+  }
+
+  static int32_t bucket_index(double x) {
+    return static_cast<int32_t>(std::ceil(std::log(x) / std::log(gamma())));
+  }
+
+  static double bucket_value(int32_t idx) {
+    return 2.0 * std::pow(gamma(), idx) / (gamma() + 1.0);
+  }
+
+  // Adds delta to a count, where only values that were added before can be
+  // removed, so a count never wraps around
+  static void add_count(uint64_t &cnt, int delta) {
+    assert(delta > 0 || cnt >= static_cast<uint64_t>(-int64_t(delta)));
+    cnt += static_cast<uint64_t>(delta);
+  }
+
+  static void update_bucket(bucket_map &buckets, int32_t idx, int delta) {
+    auto &cnt = buckets[idx];
+    add_count(cnt, delta);
+    if (cnt == 0)
+      buckets.erase(idx);
+  }
+
+  void update(const common::event_data &val, int delta) {
+    add_count(count_, delta);
+    double x = val.to_double();
+    if (std::isinf(x))
+      x = std::copysign(std::numeric_limits<double>::max(), x);
+    if (std::isnan(x))
+      add_count(nan_count_, delta);
+    else if (x == 0.0)
+      add_count(zero_count_, delta);
+    else if (x > 0.0)
+      update_bucket(positive_, bucket_index(x), delta);
+    else
+      update_bucket(negative_, bucket_index(-x), delta);
+  }
+
+  bucket_map positive_, negative_;
+  uint64_t zero_count_ = 0;
+  uint64_t nan_count_ = 0;
+  uint64_t count_ = 0;
+};
+
+}// namespace monitor::detail::sketch
+
+#endif// CPPMON_SKETCHES_H
@@ -0,0 +1,470 @@
+#include <absl/container/inlined_vector.h>
+#include <absl/hash/hash.h>
+#include <algorithm>
+#include <cassert>
+#include <slicer.h>
+#include <task_pool.h>
+#include <utility>
+
+namespace monitor::detail {
+slicer::slicer(const Formula &formula, size_t num_slices, size_t hot_window)
+    : hot_window_(hot_window) {
+  if (num_slices <= 1)
+    return;
+  prev_depth_ = max_prev_depth(formula);
+  auto fvs = formula.fvs();
+  std::vector<size_t> sorted_fvs(fvs.begin(), fvs.end());
+  std::sort(sorted_fvs.begin(), sorted_fvs.end());
+  // Pick the variable for which the fewest predicates are sent to all slices
+  size_t min_replicated = 0;
+  for (size_t i = 0; i < sorted_fvs.size(); ++i) {
+    pred_positions positions;
+    collect_positions(formula, sorted_fvs[i], 0, {}, false, positions);
+    auto replicated = static_cast<size_t>(
+      std::count_if(positions.cbegin(), positions.cend(),
+                    [](const auto &entry) { return entry.second.empty(); }));
+    if (!var_ || replicated < min_replicated) {
+      var_ = sorted_fvs[i];
+      verdict_col_ = i;
+      min_replicated = replicated;
+      positions_ = std::move(positions);
+    }
+  }
+  if (!var_)
+    return;
+  num_slices_ = num_monitors_ = num_slices;
+  // Hot keys are split on the variable that occurs together with the slicing
+  // variable in the most predicates
+  size_t max_shared = 0;
+  for (size_t i = 0; i < sorted_fvs.size(); ++i) {
+    if (sorted_fvs[i] == *var_)
+      continue;
+    pred_positions positions;
+    collect_positions(formula, sorted_fvs[i], 0, {}, false, positions);
+    auto shared = static_cast<size_t>(std::count_if(
+      positions.cbegin(), positions.cend(), [&](const auto &entry) {
+        auto pos_it = positions_.find(entry.first);
+        return !entry.second.empty() && !pos_it->second.empty();
+      }));
+    if (shared > max_shared) {
+      sub_var_ = sorted_fvs[i];
+      sub_verdict_col_ = i;
+      max_shared = shared;
+      sub_positions_ = std::move(positions);
+    }
+  }
+}
+
+void slicer::collect_positions(const Formula &formula, size_t var,
+                               size_t num_bound_vars,
+                               const std::vector<pred_id_t> &let_preds,
+                               bool in_let_def, pred_positions &positions) {
+  auto visitor = [&](auto &&arg) {
+    using T = std::decay_t<decltype(arg)>;
+    using std::is_same_v;
+    if constexpr (is_same_v<T, Formula::pred_t>) {
+      if (arg.is_builtin || std::find(let_preds.cbegin(), let_preds.cend(),
+                                      arg.pred_id) != let_preds.cend())
+        return;
+      std::vector<size_t> var_pos;
+      for (size_t i = 0; !in_let_def && i < arg.pred_args.size(); ++i) {
+        const size_t *arg_var = arg.pred_args[i].get_if_var();
+        if (arg_var && *arg_var == var + num_bound_vars)
+          var_pos.push_back(i);
+      }
+      auto [it, inserted] = positions.try_emplace(arg.pred_id, var_pos);
+      if (inserted || it->second.empty())
+        return;
+      if (var_pos.empty()) {
+        it->second.clear();
+      } else {
+        for (size_t pos : var_pos) {
+          if (std::find(it->second.cbegin(), it->second.cend(), pos) ==
+              it->second.cend())
+            it->second.push_back(pos);
+        }
+      }
+    } else if constexpr (any_type_equal_v<T, Formula::less_t,
+                                          Formula::less_eq_t, Formula::eq_t>) {
+      return;
+    } else if constexpr (any_type_equal_v<T, Formula::prev_t, Formula::next_t,
+                                          Formula::neg_t>) {
+      collect_positions(*arg.phi, var, num_bound_vars, let_preds, in_let_def,
+                        positions);
+    } else if constexpr (any_type_equal_v<T, Formula::and_t, Formula::or_t,
+                                          Formula::since_t, Formula::until_t>) {
+      collect_positions(*arg.phil, var, num_bound_vars, let_preds, in_let_def,
+                        positions);
+      collect_positions(*arg.phir, var, num_bound_vars, let_preds, in_let_def,
+                        positions);
+    } else if constexpr (is_same_v<T, Formula::exists_t>) {
+      collect_positions(*arg.phi, var, num_bound_vars + 1, let_preds,
+                        in_let_def, positions);
+    } else if constexpr (is_same_v<T, Formula::agg_t>) {
+      collect_positions(*arg.phi, var, num_bound_vars + arg.num_bound_vars,
+                        let_preds, in_let_def, positions);
+    } else if constexpr (is_same_v<T, Formula::let_t>) {
+      // The variables of the definition are unrelated to the slicing variable
+      collect_positions(*arg.phi, var, num_bound_vars, let_preds, true,
+                        positions);
+      auto psi_let_preds = let_preds;
+      psi_let_preds.push_back(arg.pred_id);
+      collect_positions(*arg.psi, var, num_bound_vars, psi_let_preds,
+                        in_let_def, positions);
+    } else {
+      static_assert(always_false_v<T>, "not exhaustive");
+    }
+  };
+  var2::visit(visitor, formula.val);
+}
+
+size_t slicer::max_prev_depth(const Formula &formula) {
+  auto visitor = [](auto &&arg) -> size_t {
+    using T = std::decay_t<decltype(arg)>;
+    using std::is_same_v;
+    if constexpr (any_type_equal_v<T, Formula::pred_t, Formula::less_t,
+                                   Formula::less_eq_t, Formula::eq_t>) {
+      return 0;
+    } else if constexpr (is_same_v<T, Formula::prev_t>) {
+      return 1 + max_prev_depth(*arg.phi);
+    } else if constexpr (any_type_equal_v<T, Formula::next_t, Formula::neg_t,
+                                          Formula::exists_t, Formula::agg_t>) {
+      return max_prev_depth(*arg.phi);
+    } else if constexpr (any_type_equal_v<T, Formula::and_t, Formula::or_t,
+                                          Formula::since_t, Formula::until_t>) {
+      return std::max(max_prev_depth(*arg.phil), max_prev_depth(*arg.phir));
+    } else if constexpr (is_same_v<T, Formula::let_t>) {
+      // The tables of the defined predicate may lag behind in the definition
+      // and again where they are used
+      return max_prev_depth(*arg.phi) + max_prev_depth(*arg.psi);
+    } else {
+      static_assert(always_false_v<T>, "not exhaustive");
+    }
+  };
+  return var2::visit(visitor, formula.val);
+}
+
+size_t slicer::slice_of(const common::event_data &val) const {
+  return absl::Hash<common::event_data>()(val) % num_slices_;
+}
+
+size_t slicer::sub_slice_of(const common::event_data &val,
+                            size_t num_parts) const {
+  // Salted, so that it does not correlate with the slice of the value
+  return absl::HashOf(size_t(0x9e3779b97f4a7c15), val) % num_parts;
+}
+
+void slicer::tuple_targets(const std::vector<size_t> &var_pos,
+                           const std::vector<size_t> *sub_pos,
+                           const parse::database_tuple &tuple,
+                           absl::InlinedVector<size_t, 4> &targets) const {
+  auto add_target = [&targets](size_t mon) {
+    if (std::find(targets.cbegin(), targets.cend(), mon) == targets.cend())
+      targets.push_back(mon);
+  };
+  targets.clear();
+  for (size_t pos : var_pos) {
+    auto hot_it =
+      hot_keys_.empty() ? hot_keys_.cend() : hot_keys_.find(tuple[pos]);
+    if (hot_it == hot_keys_.cend()) {
+      add_target(slice_of(tuple[pos]));
+      continue;
+    }
+    const auto &mons = hot_it->second.monitors;
+    if (!sub_pos || sub_pos->empty()) {
+      for (size_t mon : mons)
+        add_target(mon);
+    } else {
+      if (hot_it->second.draining)
+        add_target(mons[0]);
+      for (size_t sub : *sub_pos)
+        add_target(mons[sub_slice_of(tuple[sub], mons.size())]);
+    }
+  }
+}
+
+std::vector<database> slicer::split(database &db) {
+  std::vector<database> slice_dbs(num_monitors_);
+  for (auto &[pred, pred_dbs] : db) {
+    const auto pos_it = positions_.find(pred);
+    // The formula does not use the predicate
+    if (pos_it == positions_.cend())
+      continue;
+    const auto &var_pos = pos_it->second;
+    if (var_pos.empty()) {
+      for (auto &slice_db : slice_dbs)
+        slice_db.emplace(pred, pred_dbs);
+      continue;
+    }
+    const std::vector<size_t> *sub_pos = nullptr;
+    if (auto sub_it = sub_positions_.find(pred);
+        sub_it != sub_positions_.cend())
+      sub_pos = &sub_it->second;
+    const size_t n_tps = pred_dbs.size();
+    std::vector<std::vector<parse::database_elem> *> slice_pred_dbs;
+    slice_pred_dbs.reserve(num_monitors_);
+    for (auto &slice_db : slice_dbs) {
+      auto &slice_pred_db = slice_db[pred];
+      slice_pred_db.resize(n_tps);
+      slice_pred_dbs.push_back(&slice_pred_db);
+    }
+    absl::InlinedVector<size_t, 4> tuple_slices;
+    for (size_t i = 0; i < n_tps; ++i) {
+      for (auto &tuple : pred_dbs[i]) {
+        if (sub_var_)
+          count_key(tuple[var_pos[0]]);
+        tuple_targets(var_pos, sub_pos, tuple, tuple_slices);
+        for (size_t j = 1; j < tuple_slices.size(); ++j)
+          (*slice_pred_dbs[tuple_slices[j]])[i].push_back(tuple);
+        (*slice_pred_dbs[tuple_slices[0]])[i].push_back(std::move(tuple));
+      }
+    }
+  }
+  db.clear();
+  if (window_size_ >= hot_window_)
+    end_window();
+  return slice_dbs;
+}
+
+void slicer::count_key(const common::event_data &key) {
+  ++window_size_;
+  if (auto it = key_counts_.find(key); it != key_counts_.end()) {
+    ++it->second;
+  } else if (key_counts_.size() < HOT_COUNTERS) {
+    key_counts_.emplace(key, 1);
+  } else {
+    // Every counter is decremented at most as often as it was incremented,
+    // so this takes amortized constant time
+    for (auto it = key_counts_.begin(); it != key_counts_.end();) {
+      if (--it->second == 0)
+        key_counts_.erase(it++);
+      else
+        ++it;
+    }
+  }
+}
+
+void slicer::end_window() {
+  // The counts underestimate the frequencies, hence no key is split that
+  // is not hot. A key may cool down too early, it is split again if it is
+  // still hot.
+  for (auto &[key, hot] : hot_keys_) {
+    auto count_it = key_counts_.find(key);
+    size_t count = count_it == key_counts_.end() ? 0 : count_it->second;
+    if (hot.draining)
+      hot.draining = count * num_slices_ < HOT_SLICES * window_size_;
+    else
+      hot.draining = count * num_slices_ < window_size_;
+  }
+  for (const auto &[key, count] : key_counts_) {
+    if (count * num_slices_ < HOT_SLICES * window_size_ ||
+        hot_keys_.contains(key))
+      continue;
+    size_t num_parts = (count * num_slices_ + window_size_ - 1) / window_size_;
+    new_hot_keys_.emplace_back(key, std::min(num_parts, num_slices_));
+  }
+  key_counts_.clear();
+  window_size_ = 0;
+  window_ended_ = true;
+}
+
+std::vector<std::pair<common::event_data, size_t>>
+slicer::take_new_hot_keys() {
+  return std::exchange(new_hot_keys_, {});
+}
+
+void slicer::add_hot_key(const common::event_data &key,
+                         std::vector<size_t> monitors) {
+  assert(!monitors.empty() && monitors[0] == slice_of(key));
+  num_monitors_ += monitors.size() - 1;
+  hot_keys_.emplace(key, hot_key{std::move(monitors)});
+}
+
+row_filter slicer::other_keys(const common::event_data &key) const {
+  return {*var_, std::nullopt,
+          [key](const common::event_data &x, const common::event_data *) {
+            return x != key;
+          }};
+}
+
+row_filter slicer::foreign_rows(const common::event_data &key,
+                                size_t i) const {
+  assert(sub_var_);
+  size_t num_parts = hot_keys_.at(key).monitors.size();
+  // The slice of the key has all rows of the other keys, the other monitors
+  // only have rows of the key
+  return {*var_, sub_var_,
+          [this, key, i, num_parts](const common::event_data &x,
+                                    const common::event_data *y) {
+            if (x != key)
+              return i != 0;
+            return y && sub_slice_of(*y, num_parts) != i;
+          }};
+}
+
+row_filter slicer::split_rows(const common::event_data &key) const {
+  assert(sub_var_);
+  size_t num_parts = hot_keys_.at(key).monitors.size();
+  return {*var_, sub_var_,
+          [this, key, num_parts](const common::event_data &x,
+                                 const common::event_data *y) {
+            return x == key && y && sub_slice_of(*y, num_parts) != 0;
+          }};
+}
+
+std::vector<common::event_data> slicer::draining_keys() const {
+  std::vector<common::event_data> res;
+  for (const auto &[key, hot] : hot_keys_) {
+    if (hot.draining)
+      res.push_back(key);
+  }
+  return res;
+}
+
+void slicer::remove_hot_key(const common::event_data &key) {
+  auto node = hot_keys_.extract(key);
+  assert(node);
+  auto removed = std::move(node.mapped().monitors);
+  std::sort(removed.begin() + 1, removed.end());
+  for (auto &[other_key, hot] : hot_keys_) {
+    for (size_t &mon : hot.monitors) {
+      mon -= static_cast<size_t>(
+        std::lower_bound(removed.begin() + 1, removed.end(), mon) -
+        (removed.begin() + 1));
+    }
+  }
+  num_monitors_ -= removed.size() - 1;
+}
+
+bool slicer::owns(size_t mon, const event &verdict) const {
+  if (!var_)
+    return true;
+  const auto &val = verdict[verdict_col_];
+  if (!hot_keys_.empty()) {
+    if (auto it = hot_keys_.find(val); it != hot_keys_.cend()) {
+      const auto &mons = it->second.monitors;
+      return mons[sub_slice_of(verdict[sub_verdict_col_], mons.size())] == mon;
+    }
+  }
+  return slice_of(val) == mon;
+}
+
+sliced_monitor::sliced_monitor(const Formula &formula, size_t num_slices,
+                               size_t hot_window)
+    : slicer_(formula, num_slices, hot_window) {
+  monitors_.reserve(slicer_.num_slices());
+  for (size_t i = 0; i < slicer_.num_slices(); ++i)
+    monitors_.emplace_back(formula);
+}
+
+satisfactions sliced_monitor::step(database &db, const ts_list &ts) {
+  if (monitors_.size() == 1)
+    return monitors_[0].step(db, ts);
+  num_tps_ += ts.size();
+  auto slice_dbs = slicer_.split(db);
+  std::vector<satisfactions> slice_sats(monitors_.size());
+  common::parallel_for(monitors_.size(), 1, [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; ++i)
+      slice_sats[i] = monitors_[i].step(slice_dbs[i], ts);
+  });
+  auto res = merge(slice_sats);
+  if (slicer_.take_window_ended()) {
+    for (const auto &[key, num_parts] : slicer_.take_new_hot_keys())
+      split_hot_key(key, num_parts);
+    merge_drained_keys();
+  }
+  return res;
+}
+
+satisfactions sliced_monitor::last_step() {
+  if (monitors_.size() == 1)
+    return monitors_[0].last_step();
+  std::vector<satisfactions> slice_sats(monitors_.size());
+  common::parallel_for(monitors_.size(), 1, [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; ++i)
+      slice_sats[i] = monitors_[i].last_step();
+  });
+  return merge(slice_sats);
+}
+
+satisfactions
+sliced_monitor::merge(std::vector<satisfactions> &slice_sats) const {
+  // The progress of the monitors only depends on the time-stamps, which are
+  // the same for all slices
+  const size_t n = slice_sats[0].size();
+  satisfactions res;
+  res.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    std::vector<event> verdicts;
+    for (size_t mon = 0; mon < slice_sats.size(); ++mon) {
+      assert(slice_sats[mon].size() == n);
+      assert(std::get<1>(slice_sats[mon][i]) == std::get<1>(slice_sats[0][i]));
+      for (auto &verdict : std::get<2>(slice_sats[mon][i])) {
+        if (slicer_.owns(mon, verdict))
+          verdicts.push_back(std::move(verdict));
+      }
+    }
+    res.emplace_back(std::get<0>(slice_sats[0][i]),
+                     std::get<1>(slice_sats[0][i]), std::move(verdicts));
+  }
+  return res;
+}
+
+void sliced_monitor::split_hot_key(const common::event_data &key,
+                                   size_t num_parts) {
+  // The new monitors start with the rows of the key in the state of its
+  // slice, which has seen all tuples of the key so far. Every monitor of the
+  // key then drops the rows it is no longer responsible for.
+  const size_t slice = slicer_.slice_of(key);
+  monitor key_state = monitors_[slice];
+  key_state.erase_rows_if(slicer_.other_keys(key));
+  std::vector<size_t> parts{slice};
+  for (size_t i = 1; i < num_parts; ++i) {
+    parts.push_back(monitors_.size());
+    if (i + 1 < num_parts)
+      monitors_.push_back(key_state);
+    else
+      monitors_.push_back(std::move(key_state));
+  }
+  slicer_.add_hot_key(key, parts);
+  common::parallel_for(parts.size(), 1, [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; ++i)
+      monitors_[parts[i]].erase_rows_if(slicer_.foreign_rows(key, i));
+  });
+}
+
+void sliced_monitor::merge_drained_keys() {
+  // The slice of a draining key receives all of its tuples, but lacks the
+  // earlier ones of the other monitors. Tables buffered between operators
+  // belong to time points at most prev_depth before the next verdict, hence
+  // once all verdicts before the key started draining have been output, only
+  // the temporal state may still have rows depending on the missing tuples.
+  // If neither the slice nor the other monitors have such a row, the slice
+  // has the same rows of the key as they have.
+  absl::flat_hash_map<common::event_data, size_t> drain_tps;
+  for (const auto &key : slicer_.draining_keys()) {
+    auto it = drain_tps_.find(key);
+    drain_tps.emplace(key, it == drain_tps_.end() ? num_tps_ : it->second);
+  }
+  drain_tps_ = std::move(drain_tps);
+  for (auto it = drain_tps_.begin(); it != drain_tps_.end();) {
+    const auto &[key, drain_tp] = *it;
+    const auto &parts = slicer_.hot_key_monitors(key);
+    auto filter = slicer_.split_rows(key);
+    if (monitors_[parts[0]].num_verdict_tps() <
+          drain_tp + slicer_.prev_depth() ||
+        std::any_of(parts.cbegin(), parts.cend(), [&](size_t mon) {
+          return monitors_[mon].has_rows(filter);
+        })) {
+      ++it;
+      continue;
+    }
+    std::vector<size_t> removed(parts.begin() + 1, parts.end());
+    std::sort(removed.rbegin(), removed.rend());
+    for (size_t mon : removed)
+      monitors_.erase(monitors_.begin() + static_cast<std::ptrdiff_t>(mon));
+    slicer_.remove_hot_key(key);
+    drain_tps_.erase(it++);
+  }
+}
+}// namespace monitor::detail
@@ -0,0 +1,172 @@
+#ifndef CPPMON_SLICER_H
+#define CPPMON_SLICER_H
+
+#include <absl/container/flat_hash_map.h>
+#include <absl/container/inlined_vector.h>
+#include <database.h>
+#include <event_data.h>
+#include <formula.h>
+#include <monitor.h>
+#include <monitor_types.h>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace monitor::detail {
+// Parametric trace slicing on one free variable of the formula. A tuple of a
+// predicate is sent to the slice of the value at every position at which the
+// variable occurs as an argument of the predicate. Predicates that also occur
+// without the variable, or in the definition of a let, are sent to all
+// slices. A slice thus has all tuples needed to evaluate the formula for the
+// values of the variable that are mapped to it, but not for the others.
+//
+// A value that occurs in a large share of the tuples (a hot key) is split
+// further on a second free variable across several monitors, which start
+// with the part of the state of the key's slice that they are responsible
+// for. Each of them receives the tuples of the key whose value of the second
+// variable is mapped to it, and all tuples of the key of predicates that also
+// occur without the second variable.
+//
+// Once a hot key has cooled down, its slice receives all of its tuples again
+// while the other monitors of the key keep producing its verdicts (the key
+// drains). The key is merged back into its slice as soon as the monitors have
+// output the verdicts of all time points before it started draining, and no
+// monitor of the key has a row of it that depends on the second variable in
+// its temporal state, see sliced_monitor::merge_drained_keys.
+class slicer {
+public:
+  // Keys are counted over windows of this many tuples
+  static constexpr size_t DEFAULT_HOT_WINDOW = size_t(1) << 16;
+
+  slicer() = default;
+  slicer(const Formula &formula, size_t num_slices,
+         size_t hot_window = DEFAULT_HOT_WINDOW);
+
+  // 1 if the formula has no free variable
+  [[nodiscard]] size_t num_slices() const { return num_slices_; }
+  // Number of slices plus the additional monitors of hot keys
+  [[nodiscard]] size_t num_monitors() const { return num_monitors_; }
+  [[nodiscard]] std::optional<size_t> slicing_var() const { return var_; }
+  // Maximum number of nested PREV operators, a table buffered by one of them
+  // belongs to a time point at most this many before the next verdict
+  [[nodiscard]] size_t prev_depth() const { return prev_depth_; }
+  [[nodiscard]] size_t slice_of(const common::event_data &val) const;
+  // Splits the tuples of db into one database per monitor, db is left empty
+  std::vector<database> split(database &db);
+  // Whether the monitor is responsible for the verdict
+  [[nodiscard]] bool owns(size_t mon, const event &verdict) const;
+
+  // Keys that were detected to be hot since the last call, with the number
+  // of monitors they should be split across
+  std::vector<std::pair<common::event_data, size_t>> take_new_hot_keys();
+  // Whether a window of keys has ended since the last call, hot keys are only
+  // detected and cool down at the end of a window
+  bool take_window_ended() { return std::exchange(window_ended_, false); }
+  // Splits the key across the given monitors from now on, the first one is
+  // the slice of the key, the others must be new
+  void add_hot_key(const common::event_data &key, std::vector<size_t> monitors);
+  // The rows of other keys than the given one
+  [[nodiscard]] row_filter other_keys(const common::event_data &key) const;
+  // The rows of the state of the i-th monitor of a hot key that none of its
+  // verdicts depends on
+  [[nodiscard]] row_filter foreign_rows(const common::event_data &key,
+                                        size_t i) const;
+  // The rows of a hot key that depend on tuples which its slice did not
+  // receive while the key was split
+  [[nodiscard]] row_filter split_rows(const common::event_data &key) const;
+  // Hot keys that have cooled down and drain into their slice
+  [[nodiscard]] std::vector<common::event_data> draining_keys() const;
+  // The monitors of a hot key, the first one is its slice
+  [[nodiscard]] const std::vector<size_t> &
+  hot_key_monitors(const common::event_data &key) const {
+    return hot_keys_.at(key).monitors;
+  }
+  // Sends the tuples of the key to its slice only, the other monitors of the
+  // key must be removed. The monitors after them are renumbered.
+  void remove_hot_key(const common::event_data &key);
+
+private:
+  // Positions of the slicing variable for every predicate of the trace that
+  // occurs in the formula, empty if the predicate is sent to all slices
+  using pred_positions = absl::flat_hash_map<pred_id_t, std::vector<size_t>>;
+
+  // Keys are counted with this many counters (Misra-Gries), a key is hot if
+  // it has at least HOT_SLICES times the average share of a slice, and cools
+  // down once it has less than the average share
+  static constexpr size_t HOT_COUNTERS = 64;
+  static constexpr size_t HOT_SLICES = 2;
+
+  struct hot_key {
+    std::vector<size_t> monitors;
+    bool draining = false;
+  };
+
+  static void collect_positions(const Formula &formula, size_t var,
+                                size_t num_bound_vars,
+                                const std::vector<pred_id_t> &let_preds,
+                                bool in_let_def, pred_positions &positions);
+  static size_t max_prev_depth(const Formula &formula);
+  [[nodiscard]] size_t sub_slice_of(const common::event_data &val,
+                                    size_t num_parts) const;
+  // The monitors a tuple of a predicate whose slicing and split variable
+  // positions are given is sent to
+  void tuple_targets(const std::vector<size_t> &var_pos,
+                     const std::vector<size_t> *sub_pos,
+                     const parse::database_tuple &tuple,
+                     absl::InlinedVector<size_t, 4> &targets) const;
+  void count_key(const common::event_data &key);
+  void end_window();
+
+  size_t num_slices_ = 1;
+  size_t num_monitors_ = 1;
+  std::optional<size_t> var_;
+  // Column of the slicing variable in the verdicts
+  size_t verdict_col_ = 0;
+  pred_positions positions_;
+  size_t prev_depth_ = 0;
+
+  // Variable hot keys are split on, nullopt if no variable occurs together
+  // with the slicing variable
+  std::optional<size_t> sub_var_;
+  size_t sub_verdict_col_ = 0;
+  pred_positions sub_positions_;
+  absl::flat_hash_map<common::event_data, hot_key> hot_keys_;
+  absl::flat_hash_map<common::event_data, size_t> key_counts_;
+  size_t hot_window_ = DEFAULT_HOT_WINDOW;
+  size_t window_size_ = 0;
+  bool window_ended_ = false;
+  std::vector<std::pair<common::event_data, size_t>> new_hot_keys_;
+};
+
+// Monitors every slice of the trace with its own monitor, in parallel on the
+// global task pool, and merges their verdicts. Hot keys are split and merged
+// back between two steps, when all monitors are at the same time point.
+class sliced_monitor {
+public:
+  sliced_monitor() = default;
+  sliced_monitor(const Formula &formula, size_t num_slices,
+                 size_t hot_window = slicer::DEFAULT_HOT_WINDOW);
+  satisfactions step(database &db, const ts_list &ts);
+  satisfactions last_step();
+  [[nodiscard]] size_t num_monitors() const { return monitors_.size(); }
+
+private:
+  satisfactions merge(std::vector<satisfactions> &slice_sats) const;
+  void split_hot_key(const common::event_data &key, size_t num_parts);
+  void merge_drained_keys();
+
+  slicer slicer_;
+  std::vector<monitor> monitors_;
+  // Number of time points received so far
+  size_t num_tps_ = 0;
+  // The draining keys with the first time point whose tuples their slice
+  // received in full
+  absl::flat_hash_map<common::event_data, size_t> drain_tps_;
+};
+}// namespace monitor::detail
+
+namespace monitor {
+using detail::sliced_monitor;
+}// namespace monitor
+
+#endif// CPPMON_SLICER_H
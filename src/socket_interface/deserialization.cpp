@@ -1,29 +1,40 @@
 #include <array>
 #include <deserialization.h>
+#include <stdexcept>
+#include <sys/socket.h>
 #include <unistd.h>
 #include <util.h>
 
 namespace ipc::serialization {
 deserializer::deserializer(std::string socket_path, pred_map_t pred_map)
     : path_(std::move(socket_path)), acceptor_(ctx_), sock_(ctx_, 5000),
-      pred_map_(std::move(pred_map)) {
+      write_sock_(ctx_), pred_map_(std::move(pred_map)) {
   ::unlink(path_.c_str());
   acceptor_.open();
   acceptor_.bind(path_.c_str());
   acceptor_.listen();
   acceptor_.accept(sock_.lowest_layer());
+  sock_fd_ = sock_.lowest_layer().native_handle();
+  int write_fd = ::dup(sock_fd_);
+  if (write_fd < 0)
+    throw std::runtime_error("could not duplicate the socket descriptor");
+  write_sock_.assign(boost::asio::local::stream_protocol(), write_fd);
 }
 
 deserializer::~deserializer() { ::unlink(path_.c_str()); }
 
 std::string deserializer::read_string() {
+  std::string res;
+  read_string(res);
+  return res;
+}
+
+void deserializer::read_string(std::string &res) {
   // fmt::print("reading string\n");
   auto str_len = static_cast<size_t>(read_primitive<int32_t>());
   // fmt::print("string length is {}\n", str_len);
-  std::string res;
-  res.insert(0, str_len, ' ');
+  res.resize(str_len);
   boost::asio::read(sock_, boost::asio::buffer(res.data(), str_len));
-  return res;
 }
 
 common::event_data deserializer::read_event_data() {
@@ -36,7 +47,8 @@ common::event_data deserializer::read_event_data() {
     return common::event_data::Float(read_primitive<double>());
   } else if (ev_ty == TY_STRING) {
     // fmt::print("reading string event data\n");
-    return common::event_data::String(read_string());
+    read_string(str_buf_);
+    return common::event_data::String(str_buf_);
   } else
     throw std::runtime_error("invalid type, expected int|float|string");
 }
@@ -88,10 +100,25 @@ void deserializer::send_latency_marker(int64_t lm) {
 
 void deserializer::send_eof() {
   send_primitive(CTRL_EOF);
-  sock_.next_layer().shutdown(boost::asio::socket_base::shutdown_send);
+  write_sock_.shutdown(boost::asio::socket_base::shutdown_send);
+}
+
+void deserializer::cancel() {
+  // Errors are ignored, the reader fails anyway once the socket is gone
+  ::shutdown(sock_fd_, SHUT_RD);
 }
 
 std::optional<ts_database> deserializer::read_database() {
+  return read_database_impl(nullptr);
+}
+
+std::optional<ts_database>
+deserializer::read_database(std::vector<int64_t> &latency_markers) {
+  return read_database_impl(&latency_markers);
+}
+
+std::optional<ts_database>
+deserializer::read_database_impl(std::vector<int64_t> *latency_markers) {
   while (true) {
     std::optional<ts_database> opt_db;
     auto nxt_ctrl = read_primitive<control_bits>();
@@ -106,7 +133,10 @@ std::optional<ts_database> deserializer::read_database() {
       return opt_db;
     } else if (nxt_ctrl == CTRL_LATENCY_MARKER) {
       int64_t lm = read_primitive<int64_t>();
-      send_latency_marker(lm);
+      if (latency_markers)
+        latency_markers->push_back(lm);
+      else
+        send_latency_marker(lm);
     } else {
       throw std::runtime_error("expected database");
     }
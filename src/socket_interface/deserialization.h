@@ -18,6 +18,7 @@
 #include <traceparser.h>
 #include <util.h>
 #include <utility>
+#include <vector>
 
 namespace ipc::serialization {
 using database =
@@ -27,12 +28,24 @@ using ts_database = std::pair<database, std::vector<size_t>>;
 class deserializer {
 public:
   deserializer(std::string socket_path, pred_map_t pred_map);
+  // Latency markers read before the database are answered right away
   std::optional<ts_database> read_database();
+  // Latency markers read before the database are appended to latency_markers
+  // and must be answered with send_latency_marker
+  std::optional<ts_database>
+  read_database(std::vector<int64_t> &latency_markers);
+  // May be called while read_database is running in another thread
+  void send_latency_marker(int64_t lm);
   void send_eof();
+  // Makes a read_database call that is blocked in another thread throw. The
+  // socket can no longer be read afterwards. May be called while
+  // send_latency_marker is running in a third thread.
+  void cancel();
   ~deserializer();
 
 private:
-  void send_latency_marker(int64_t lm);
+  std::optional<ts_database>
+  read_database_impl(std::vector<int64_t> *latency_markers);
   template<typename T>
   T read_primitive() {
     T t{};
@@ -46,10 +59,12 @@ private:
   void send_primitive(T t) {
     char snd_buf[sizeof(T)];
     std::memcpy(snd_buf, &t, sizeof(T));
-    boost::asio::write(sock_, boost::asio::const_buffer(snd_buf, sizeof(T)));
+    boost::asio::write(write_sock_,
+                       boost::asio::const_buffer(snd_buf, sizeof(T)));
   }
 
   std::string read_string();
+  void read_string(std::string &res);
   common::event_data read_event_data();
   void read_tuple(database &db);
   void read_tuple_list(database &db);
@@ -59,7 +74,15 @@ private:
   boost::asio::local::stream_protocol::acceptor acceptor_;
   boost::asio::buffered_read_stream<boost::asio::local::stream_protocol::socket>
     sock_;
+  // Writes go through their own socket object on a duplicate of the
+  // descriptor of sock_, asio sockets must not be used by two threads at once
+  boost::asio::local::stream_protocol::socket write_sock_;
+  // Descriptor of sock_, shut down by cancel without touching the socket
+  // object that is read from
+  int sock_fd_ = -1;
   pred_map_t pred_map_;
+  // Reused for string arguments, which are interned and never stored here
+  std::string str_buf_;
 };
 }// namespace ipc::serialization
 
@@ -9,9 +9,11 @@
 #include <fmt/core.h>
 #include <fmt/format.h>
 #include <fmt/ranges.h>
+#include <hash_cache.h>
 #include <iterator>
 #include <memory>
 #include <optional>
+#include <task_pool.h>
 #include <tuple>
 #include <type_traits>
 #include <util.h>
@@ -22,6 +24,8 @@
 
 namespace detail {
 template<typename T>
+class row_set_storage;
+template<typename T, typename Storage = row_set_storage<T>>
 class table;
 }
 /*
@@ -55,9 +59,9 @@ anti_join_info get_anti_join_info(const table_layout &l1,
 vector<size_t> find_permutation(const table_layout &l1, const table_layout &l2);
 vector<size_t> id_permutation(size_t n);
 
-template<typename T>
-vector<T> filter_row(const vector<size_t> &keep_idxs, const vector<T> &row) {
-  vector<T> filtered_row;
+template<typename Row>
+Row filter_row(const vector<size_t> &keep_idxs, const Row &row) {
+  Row filtered_row;
   filtered_row.reserve(keep_idxs.size());
   std::transform(keep_idxs.cbegin(), keep_idxs.cend(),
                  std::back_inserter(filtered_row),
@@ -65,52 +69,158 @@ vector<T> filter_row(const vector<size_t> &keep_idxs, const vector<T> &row) {
   return filtered_row;
 }
 
+template<typename Row>
+Row filter_row(const vector<size_t> &keep_idxs,
+               const common::hash_cached<Row> &row) {
+  return filter_row(keep_idxs, *row);
+}
+
+// Default row storage: every row is a separately allocated vector inside a
+// hash set. Works for any hashable cell type. Rows carry their hash, so copying
+// them into other tables or into the state of temporal operators never rehashes
+// them.
 template<typename T>
+class row_set_storage {
+public:
+  using row_type = inline_tuple<T>;
+  using hashed_row = common::hash_cached<row_type>;
+  using data_t = common::hash_cached_set<row_type>;
+  using handle = typename data_t::const_pointer;
+  using key_type = row_type;
+  using iterator = typename data_t::const_iterator;
+  using const_iterator = typename data_t::const_iterator;
+
+  row_set_storage() = default;
+  explicit row_set_storage(size_t) {}
+
+  const_iterator begin() const { return data_.begin(); }
+  const_iterator end() const { return data_.end(); }
+  const_iterator cbegin() const { return data_.cbegin(); }
+  const_iterator cend() const { return data_.cend(); }
+
+  [[nodiscard]] size_t size() const { return data_.size(); }
+  [[nodiscard]] bool empty() const { return data_.empty(); }
+  void reserve(size_t n) { data_.reserve(n); }
+  bool contains(const row_type &row) const { return data_.contains(row); }
+  bool contains(const hashed_row &row) const { return data_.contains(row); }
+  void insert(const row_type &row) { data_.emplace(row); }
+  void insert(row_type &&row) { data_.emplace(std::move(row)); }
+  void insert(const hashed_row &row) { data_.insert(row); }
+  void insert(hashed_row &&row) { data_.insert(std::move(row)); }
+
+  void insert_copy(const row_set_storage &, handle h) { data_.insert(*h); }
+
+  void insert_projected(const row_set_storage &, handle h,
+                        const vector<size_t> &idxs) {
+    data_.emplace(filter_row(idxs, *h));
+  }
+
+  void insert_concat(const row_set_storage &, handle h1,
+                     const row_set_storage &, handle h2,
+                     const vector<size_t> &keep_idx2) {
+    row_type new_row;
+    new_row.reserve((*h1)->size() + keep_idx2.size());
+    new_row.insert(new_row.end(), (*h1)->cbegin(), (*h1)->cend());
+    for (size_t idx : keep_idx2)
+      new_row.push_back((**h2)[idx]);
+    data_.emplace(std::move(new_row));
+  }
+
+  const row_type &get(handle h) const { return **h; }
+
+  row_type project(handle h, const vector<size_t> &idxs) const {
+    return filter_row(idxs, *h);
+  }
+
+  key_type key(handle h, const vector<size_t> &idxs) const {
+    return filter_row(idxs, *h);
+  }
+
+  // Same as key(h1, idxs1) == other.key(h2, idxs2) without materializing the
+  // keys
+  bool key_equal(handle h1, const vector<size_t> &idxs1,
+                 const row_set_storage &, handle h2,
+                 const vector<size_t> &idxs2) const {
+    for (size_t i = 0; i < idxs1.size(); ++i) {
+      if (!((**h1)[idxs1[i]] == (**h2)[idxs2[i]]))
+        return false;
+    }
+    return true;
+  }
+
+  // Hash of key(h, idxs) without materializing the key. Keys that are equal
+  // by key_equal have equal hashes, also across storages.
+  size_t key_hash(handle h, const vector<size_t> &idxs) const {
+    auto state = absl::HashOf(idxs.size());
+    for (size_t idx : idxs)
+      state = absl::HashOf(state, (**h)[idx]);
+    return state;
+  }
+
+  // Moves all rows of other, none of which may be in this storage, into it
+  void splice(row_set_storage &&other) {
+    if (data_.empty())
+      data_ = std::move(other.data_);
+    else
+      data_.merge(other.data_);
+  }
+
+  template<typename F>
+  void for_each_handle(F f) const {
+    for (const auto &row : data_)
+      f(&row);
+  }
+
+  template<typename Pred>
+  void erase_if(Pred pred) {
+    absl::erase_if(data_, [&pred](const hashed_row &row) { return pred(&row); });
+  }
+
+  data_t take_all() { return std::move(data_); }
+
+private:
+  data_t data_;
+};
+
+template<typename T, typename Storage>
 class table {
   // friend struct fmt::formatter<table<T>>;
 
 public:
-  // Forward the iterators of the raw hashset
-  using iterator = typename flat_hash_set<vector<T>>::iterator;
-  using const_iterator = typename flat_hash_set<vector<T>>::const_iterator;
-  using data_t = flat_hash_set<vector<T>>;
-  using data_t_ptr = typename data_t::const_pointer;
-  using join_hash_map = flat_hash_map<vector<T>, vector<data_t_ptr>>;
-  using join_hash_set = flat_hash_set<vector<T>>;
-
-  static join_hash_map compute_join_hash_map(const table<T> &tab,
+  using storage_t = Storage;
+  using row_type = typename Storage::row_type;
+  using hashed_row = typename Storage::hashed_row;
+  using handle = typename Storage::handle;
+  using key_type = typename Storage::key_type;
+  // Forward the iterators of the storage
+  using iterator = typename Storage::iterator;
+  using const_iterator = typename Storage::const_iterator;
+  using join_hash_map = flat_hash_map<key_type, vector<handle>>;
+  using join_hash_set = flat_hash_set<key_type>;
+
+  static join_hash_map compute_join_hash_map(const table &tab,
                                              const vector<size_t> &idxs) {
     join_hash_map res;
     res.reserve(tab.data_.size());
-    for (const auto &row : tab.data_) {
-      auto col_vals = filter_row(idxs, row);
-      res[col_vals].push_back(&row);
-    }
+    tab.data_.for_each_handle([&res, &tab, &idxs](handle h) {
+      res[tab.data_.key(h, idxs)].push_back(h);
+    });
     return res;
   }
 
-  static join_hash_set compute_join_hash_set(const table<T> &tab,
+  static join_hash_set compute_join_hash_set(const table &tab,
                                              const vector<size_t> &idxs) {
     join_hash_set res;
     res.reserve(tab.data_.size());
-    for (const auto &row : tab.data_) {
-      auto col_vals = filter_row(idxs, row);
-      res.insert(std::move(col_vals));
-    }
+    tab.data_.for_each_handle(
+      [&res, &tab, &idxs](handle h) { res.insert(tab.data_.key(h, idxs)); });
     return res;
   }
 
-  static join_hash_set hash_all_destructive(table<T> &tab) {
-    join_hash_set res;
-    res.reserve(tab.data_.size());
-    for (auto &row : tab.data_) {
-      res.insert(std::move(row));
-    }
-    return res;
+  static common::hash_cached_set<row_type> hash_all_destructive(table &tab) {
+    return tab.data_.take_all();
   }
 
-  iterator begin() { return data_.begin(); }
-  iterator end() { return data_.end(); }
   const_iterator begin() const { return data_.begin(); }
   const_iterator end() const { return data_.end(); }
   const_iterator cbegin() const { return data_.cbegin(); }
@@ -118,9 +228,10 @@ public:
 
   table() = default;
 
-  explicit table(size_t n_cols) : ncols_(n_cols) {}
+  explicit table(size_t n_cols) : ncols_(n_cols), data_(n_cols) {}
 
-  explicit table(size_t n_cols, vector<vector<T>> data) : ncols_(n_cols) {
+  explicit table(size_t n_cols, vector<row_type> data)
+      : ncols_(n_cols), data_(n_cols) {
 #ifndef NDEBUG
     bool table_match =
       std::all_of(data.cbegin(), data.cend(),
@@ -128,146 +239,283 @@ public:
     if (!table_match)
       fmt::print(FMT_STRING("data row with wrong length"), data);
 #endif
-    data_.template insert(std::make_move_iterator(data.begin()),
-                          std::make_move_iterator(data.end()));
+    data_.reserve(data.size());
+    for (auto &row : data)
+      data_.insert(std::move(row));
   }
 
-  /*explicit table(size_t n_cols, vector<vector<T>> &&data) : ncols_(n_cols) {
-#ifndef NDEBUG
-    bool table_match =
-      std::all_of(data.cbegin(), data.cend(),
-                  [n_cols](const auto &row) { return row.size() == n_cols; });
-    if (!table_match)
-      fmt::print(FMT_STRING("data row with wrong length"), data);
-#endif
-    data_.template insert(std::make_move_iterator(data.begin()),
-                          std::make_move_iterator(data.end()));
-  }*/
-
-  [[nodiscard]] static table<T> empty_table() { return table(0, {}); };
+  [[nodiscard]] static table empty_table() { return table(0, {}); };
 
-  [[nodiscard]] static table<T> unit_table() { return table(0, {{}}); }
+  [[nodiscard]] static table unit_table() { return table(0, {{}}); }
 
-  [[nodiscard]] static table<T> singleton_table(T value) {
+  [[nodiscard]] static table singleton_table(T value) {
     return table(1, {{value}});
   }
   [[nodiscard]] bool empty() const { return data_.empty(); }
 
   [[nodiscard]] size_t tab_size() const { return data_.size(); }
 
-  bool equal_to(const table<T> &other,
+  bool equal_to(const table &other,
                 const vector<size_t> &other_permutation) const {
     assert((ncols_ == other.ncols_) && (ncols_ == other_permutation.size()));
     if (tab_size() != other.tab_size())
       return false;
-    for (const auto &row : other.data_) {
-      auto permuted_row = filter_row(other_permutation, row);
-      if (!data_.contains(permuted_row))
-        return false;
-    }
-    return true;
+    bool equal = true;
+    other.data_.for_each_handle([this, &other, &other_permutation,
+                                 &equal](handle h) {
+      if (equal && !data_.contains(other.data_.project(h, other_permutation)))
+        equal = false;
+    });
+    return equal;
   }
 
-  bool contains(const typename data_t::key_type &row) const {
-    return data_.contains(row);
-  }
+  bool contains(const row_type &row) const { return data_.contains(row); }
+  bool contains(const hashed_row &row) const { return data_.contains(row); }
 
   void reserve(size_t n) { data_.reserve(n); }
 
-  void add_row(const vector<T> &row) {
+  void add_row(const row_type &row) {
     assert(row.size() == ncols_);
     data_.insert(row);
   }
 
-  void add_row(vector<T> &&row) {
+  void add_row(row_type &&row) {
     assert(row.size() == ncols_);
     data_.insert(std::move(row));
   }
 
-  vector<vector<T>> make_verdicts(const vector<size_t> &permutation) {
+  void add_row(const hashed_row &row) {
+    assert(row->size() == ncols_);
+    data_.insert(row);
+  }
+
+  void add_row(hashed_row &&row) {
+    assert(row->size() == ncols_);
+    data_.insert(std::move(row));
+  }
+
+  vector<row_type> make_verdicts(const vector<size_t> &permutation) {
     assert(permutation.size() == ncols_);
-    vector<vector<T>> verdicts;
+    vector<row_type> verdicts;
     verdicts.reserve(tab_size());
-    for (const auto &row : data_) {
-      assert(row.size() == ncols_);
-      verdicts.push_back(filter_row(permutation, row));
-    }
+    data_.for_each_handle([this, &verdicts, &permutation](handle h) {
+      verdicts.push_back(data_.project(h, permutation));
+    });
     return verdicts;
   }
 
-  std::optional<table<T>> natural_join(const table<T> &tab,
-                                       const join_info &info) const {
-    auto hash_map = compute_join_hash_map(tab, info.comm_idx2);
-    table<T> new_tab(info.result_layout.size());
-    for (const auto &row : this->data_) {
-      auto col_vals = filter_row(info.comm_idx1, row);
-      const auto it = hash_map.find(col_vals);
-      if (it == hash_map.end())
-        continue;
-      for (const auto &row2_ptr : it->second) {
-        vector<T> new_row = row;
-        new_row.reserve(new_row.size() + info.keep_idx2.size());
-        auto snd_part = filter_row(info.keep_idx2, *row2_ptr);
-        new_row.insert(new_row.cend(), snd_part.cbegin(), snd_part.cend());
-        new_tab.data_.insert(std::move(new_row));
-      }
+  // Joins with at most this many row pairs are evaluated with a nested loop,
+  // as building a hash table does not pay off for them
+  static constexpr size_t NESTED_LOOP_MAX_PAIRS = 256;
+  // Joins of at least this many rows in total are split into partitions that
+  // are joined in parallel, if a task pool is configured
+  static constexpr size_t PARALLEL_JOIN_MIN_ROWS = 8192;
+
+  std::optional<table> natural_join(const table &tab,
+                                    const join_info &info) const {
+    if (empty() || tab.empty())
+      return std::nullopt;
+    table new_tab(info.result_layout.size());
+    size_t n1 = tab_size(), n2 = tab.tab_size();
+    if (info.comm_idx1.empty()) {
+      cartesian_join(tab, info, new_tab);
+    } else if (n1 * n2 <= NESTED_LOOP_MAX_PAIRS) {
+      data_.for_each_handle([this, &tab, &info, &new_tab](handle h) {
+        tab.data_.for_each_handle([this, &tab, &info, &new_tab, h](handle h2) {
+          if (data_.key_equal(h, info.comm_idx1, tab.data_, h2, info.comm_idx2))
+            new_tab.data_.insert_concat(data_, h, tab.data_, h2,
+                                        info.keep_idx2);
+        });
+      });
+    } else if (common::task_pool::global() &&
+               n1 + n2 >= PARALLEL_JOIN_MIN_ROWS) {
+      partitioned_join(tab, info, new_tab);
+    } else if (n2 <= n1) {
+      // Build on the right table, probe with the left one
+      auto hash_map = compute_join_hash_map(tab, info.comm_idx2);
+      data_.for_each_handle([this, &tab, &info, &hash_map, &new_tab](handle h) {
+        const auto it = hash_map.find(data_.key(h, info.comm_idx1));
+        if (it == hash_map.end())
+          return;
+        for (handle h2 : it->second)
+          new_tab.data_.insert_concat(data_, h, tab.data_, h2, info.keep_idx2);
+      });
+    } else {
+      // Build on the left table, probe with the right one
+      auto hash_map = compute_join_hash_map(*this, info.comm_idx1);
+      tab.data_.for_each_handle([this, &tab, &info, &hash_map,
+                                 &new_tab](handle h2) {
+        const auto it = hash_map.find(tab.data_.key(h2, info.comm_idx2));
+        if (it == hash_map.end())
+          return;
+        for (handle h : it->second)
+          new_tab.data_.insert_concat(data_, h, tab.data_, h2, info.keep_idx2);
+      });
     }
     return new_tab.empty() ? std::nullopt : std::optional(std::move(new_tab));
   }
 
-  std::optional<table<T>> anti_join(const table<T> &tab,
-                                    const anti_join_info &info) const {
-    auto hash_set = compute_join_hash_set(tab, info.comm_idx2);
-    table<T> new_tab(info.result_layout.size());
-    for (const auto &row : data_) {
-      auto filtered_row = filter_row(info.comm_idx1, row);
-      if (!hash_set.contains(filtered_row))
-        new_tab.data_.insert(row);
-    }
+  std::optional<table> anti_join(const table &tab,
+                                 const anti_join_info &info) const {
+    table new_tab(info.result_layout.size());
+    with_anti_join_matches(tab, info, [this, &new_tab](auto matches) {
+      data_.for_each_handle([this, &matches, &new_tab](handle h) {
+        if (!matches(h))
+          new_tab.data_.insert_copy(data_, h);
+      });
+    });
     return new_tab.empty() ? std::nullopt : std::optional(std::move(new_tab));
   }
 
 
-  void anti_join_in_place(const table<T> &tab, const anti_join_info &info) {
-    auto hash_set = compute_join_hash_set(tab, info.comm_idx2);
-    absl::erase_if(data_, [&info, &hash_set](const auto &row) {
-      auto filtered_row = filter_row(info.comm_idx1, row);
-      return hash_set.contains(filtered_row);
-    });
+  // Removes the rows for which pred(row) holds
+  template<typename Pred>
+  void erase_rows_if(Pred pred) {
+    data_.erase_if([this, &pred](handle h) { return pred(data_.get(h)); });
   }
 
-  table<T> t_union(const table<T> &tab,
-                   const vector<size_t> &other_permutation) const {
+  void anti_join_in_place(const table &tab, const anti_join_info &info) {
+    if (empty() || tab.empty())
+      return;
+    if (info.comm_idx1.empty()) {
+      data_ = Storage(ncols_);
+      return;
+    }
+    with_anti_join_matches(tab, info,
+                           [this](auto matches) { data_.erase_if(matches); });
+  }
+
+  table t_union(const table &tab,
+                const vector<size_t> &other_permutation) const {
     return t_union_impl(*this, tab, other_permutation);
   }
 
-  void t_union_in_place(const table<T> &tab,
+  void t_union_in_place(const table &tab,
                         const vector<size_t> &other_permutation) {
     t_union_impl(*this, tab, other_permutation);
   }
 
 private:
   size_t ncols_{};
-  data_t data_;
+  Storage data_;
+
+  void cartesian_join(const table &tab, const join_info &info,
+                      table &new_tab) const {
+    new_tab.reserve(tab_size() * tab.tab_size());
+    data_.for_each_handle([this, &tab, &info, &new_tab](handle h) {
+      tab.data_.for_each_handle([this, &tab, &info, &new_tab, h](handle h2) {
+        new_tab.data_.insert_concat(data_, h, tab.data_, h2, info.keep_idx2);
+      });
+    });
+  }
+
+  // Partitions both tables on the hash of the join key and joins the
+  // partitions in parallel. The results of different partitions differ in
+  // the key columns, so they are disjoint and can be spliced together.
+  void partitioned_join(const table &tab, const join_info &info,
+                        table &new_tab) const {
+    using hashed_handles = vector<pair<size_t, handle>>;
+    common::task_pool &pool = *common::task_pool::global();
+    const size_t n_parts = 4 * pool.num_threads();
+    auto partition = [n_parts](const table &t, const vector<size_t> &idxs) {
+      vector<hashed_handles> parts(n_parts);
+      t.data_.for_each_handle([&parts, &t, &idxs, n_parts](handle h) {
+        size_t hash = t.data_.key_hash(h, idxs);
+        // The low bits of the hash are used by the hash maps of the partitions
+        parts[(hash >> 48) % n_parts].emplace_back(hash, h);
+      });
+      return parts;
+    };
+    vector<hashed_handles> parts1, parts2;
+    pool.fork_join([&]() { parts1 = partition(*this, info.comm_idx1); },
+                   [&]() { parts2 = partition(tab, info.comm_idx2); });
+
+    vector<Storage> results(n_parts, Storage(new_tab.ncols_));
+    common::parallel_for(n_parts, 1, [&](size_t lo, size_t hi) {
+      for (size_t p = lo; p < hi; ++p) {
+        // Build on the smaller side of the partition. Rows with equal key
+        // hashes are only joined if their keys are equal.
+        const bool build_left = parts1[p].size() <= parts2[p].size();
+        const auto &build = build_left ? parts1[p] : parts2[p];
+        const auto &probe = build_left ? parts2[p] : parts1[p];
+        flat_hash_map<size_t, vector<handle>> hash_map;
+        hash_map.reserve(build.size());
+        for (const auto &[hash, h] : build)
+          hash_map[hash].push_back(h);
+        for (const auto &[hash, h] : probe) {
+          const auto it = hash_map.find(hash);
+          if (it == hash_map.end())
+            continue;
+          for (handle other : it->second) {
+            handle h1 = build_left ? other : h, h2 = build_left ? h : other;
+            if (data_.key_equal(h1, info.comm_idx1, tab.data_, h2,
+                                info.comm_idx2))
+              results[p].insert_concat(data_, h1, tab.data_, h2,
+                                       info.keep_idx2);
+          }
+        }
+      }
+    });
+
+    for (auto &part : results)
+      new_tab.data_.splice(std::move(part));
+  }
+
+  // Calls f with a predicate on the handles of this table that holds iff the
+  // row has a join partner in tab. Hashes whichever of the two tables is
+  // smaller.
+  template<typename F>
+  void with_anti_join_matches(const table &tab, const anti_join_info &info,
+                              F f) const {
+    if (empty() || tab.empty()) {
+      f([](handle) { return false; });
+    } else if (info.comm_idx1.empty()) {
+      f([](handle) { return true; });
+    } else if (tab_size() * tab.tab_size() <= NESTED_LOOP_MAX_PAIRS) {
+      f([this, &tab, &info](handle h) {
+        bool found = false;
+        tab.data_.for_each_handle([this, &tab, &info, h, &found](handle h2) {
+          found = found || data_.key_equal(h, info.comm_idx1, tab.data_, h2,
+                                           info.comm_idx2);
+        });
+        return found;
+      });
+    } else if (tab.tab_size() <= tab_size()) {
+      auto hash_set = compute_join_hash_set(tab, info.comm_idx2);
+      f([this, &info, &hash_set](handle h) {
+        return hash_set.contains(data_.key(h, info.comm_idx1));
+      });
+    } else {
+      // The right table is larger: only hash the keys of the left table and
+      // collect the handles of those that occur in the right table
+      auto hash_map = compute_join_hash_map(*this, info.comm_idx1);
+      flat_hash_set<handle> matched;
+      tab.data_.for_each_handle([&tab, &info, &hash_map, &matched](handle h2) {
+        if (hash_map.empty())
+          return;
+        auto it = hash_map.find(tab.data_.key(h2, info.comm_idx2));
+        if (it == hash_map.end())
+          return;
+        matched.insert(it->second.cbegin(), it->second.cend());
+        hash_map.erase(it);
+      });
+      f([&matched](handle h) { return matched.contains(h); });
+    }
+  }
 
   template<typename TAB1>
-  static auto t_union_impl(TAB1 &tab1, const table<T> &tab2,
+  static auto t_union_impl(TAB1 &tab1, const table &tab2,
                            const vector<size_t> &other_permutation) {
-    static_assert(std::is_same_v<std::remove_const_t<TAB1>, table<T>>,
+    static_assert(std::is_same_v<std::remove_const_t<TAB1>, table>,
                   "tables must have same type");
     if constexpr (std::is_const_v<TAB1>) {
-      table<T> new_tab(tab1.ncols_);
-      new_tab.data_ = tab1.data_;
-      for (const auto &row : tab2.data_) {
-        auto permuted_row = filter_row(other_permutation, row);
-        new_tab.add_row(std::move(permuted_row));
-      }
+      table new_tab(tab1);
+      new_tab.t_union_in_place(tab2, other_permutation);
       return new_tab;
     } else {
-      for (const auto &row : tab2.data_) {
-        auto permuted_row = filter_row(other_permutation, row);
-        tab1.add_row(std::move(permuted_row));
-      }
+      tab2.data_.for_each_handle([&tab1, &tab2, &other_permutation](handle h) {
+        tab1.data_.insert_projected(tab2.data_, h, other_permutation);
+      });
     }
   }
 };
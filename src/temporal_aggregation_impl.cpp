@@ -8,7 +8,7 @@ temporal_aggregation_impl::temporal_aggregation_impl(
   size_t num_bound_vars)
     : default_val_(std::move(default_val)), nfvs_(0),
       term_var_idx_(std::numeric_limits<size_t>::max()),
-      state_(grouped_state<min_group>()), all_bound_(true) {
+      state_(min_max_state<std::less<>>()), all_bound_(true) {
   const size_t *trm_var_ptr = agg_term.get_if_var();
   if (!trm_var_ptr)
     throw std::runtime_error(
@@ -32,13 +32,19 @@ temporal_aggregation_impl::temporal_aggregation_impl(
   if (ty == fo::agg_type::SUM)
     state_ = grouped_state<sum_group>();
   else if (ty == fo::agg_type::MAX)
-    state_ = grouped_state<max_group>();
+    state_ = min_max_state<std::greater<>>();
   else if (ty == fo::agg_type::MIN)
-    state_ = grouped_state<min_group>();
+    state_ = min_max_state<std::less<>>();
   else if (ty == fo::agg_type::CNT)
     state_ = grouped_state<count_group>();
   else if (ty == fo::agg_type::AVG)
     state_ = grouped_state<avg_group>();
+  else if (ty == fo::agg_type::MED)
+    state_ = med_state();
+  else if (ty == fo::agg_type::APPROX_DCNT)
+    state_ = grouped_state<approx_dcnt_group>();
+  else if (ty == fo::agg_type::APPROX_MED)
+    state_ = grouped_state<approx_med_group>();
   else
     throw std::runtime_error("unsupported operation");
 }
@@ -48,15 +54,17 @@ table_layout temporal_aggregation_impl::get_layout() const {
 }
 
 void temporal_aggregation_impl::add_result(const event &e) {
-  auto group = filter_row(group_var_idxs_, e);
+  hashed_event group(filter_row(group_var_idxs_, e));
   auto trm_var_val = e[term_var_idx_];
   boost::variant2::visit(
-    [&group, &trm_var_val](auto &&arg) { arg.add_result(group, trm_var_val); },
+    [&group, &trm_var_val](auto &&arg) {
+      arg.add_result(std::move(group), trm_var_val);
+    },
     state_);
 }
 
 void temporal_aggregation_impl::remove_result(const event &e) {
-  auto group = filter_row(group_var_idxs_, e);
+  hashed_event group(filter_row(group_var_idxs_, e));
   auto trm_var_val = e[term_var_idx_];
   boost::variant2::visit(
     [&group, &trm_var_val](auto &&arg) {
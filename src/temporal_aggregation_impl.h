@@ -1,69 +1,275 @@
 #ifndef CPPMON_TEMPORAL_AGGREGATION_IMPL_H
 #define CPPMON_TEMPORAL_AGGREGATION_IMPL_H
 
-#include <absl/container/btree_set.h>
+#include <absl/container/btree_map.h>
 #include <absl/container/flat_hash_map.h>
 #include <aggregation_impl.h>
 #include <boost/variant2/variant.hpp>
+#include <cmath>
+#include <cstdint>
 #include <event_data.h>
 #include <monitor_types.h>
+#include <order_statistic_tree.h>
 #include <utility>
 
 namespace monitor::detail::agg_temporal {
 
-template<typename Compare>
-class min_max_group {
+// Running sum that supports removals without drift: integers are summed
+// exactly and all other values with Neumaier compensation, and the latter part
+// is reset once no such value is left in the window.
+class window_sum {
 public:
-  min_max_group(const common::event_data &first_event) {
-    group_state_.insert(first_event);
+  void add(const common::event_data &val) { update(val, 1); }
+
+  void remove(const common::event_data &val) { update(val, -1); }
+
+  double to_double() const {
+    return static_cast<double>(int_sum_) + (float_sum_ + compensation_);
   }
 
-  template<typename H>
-  friend H AbslHashValue(H h, const min_max_group<Compare> &arg) {
-    return H::combine(std::move(h), arg.group_state_);
+  common::event_data value() const {
+    if (num_floats_ == 0)
+      return common::event_data::Int(int_sum_);
+    return common::event_data::Float(to_double());
+  }
+
+private:
+  void update(const common::event_data &val, int sign) {
+    if (const int64_t *i = val.get_if_int()) {
+      int_sum_ += sign * *i;
+      return;
+    }
+    if (sign < 0 && --num_floats_ == 0) {
+      float_sum_ = compensation_ = 0.0;
+      return;
+    }
+    if (sign > 0)
+      ++num_floats_;
+    double x = sign * val.to_double();
+    double t = float_sum_ + x;
+    if (std::abs(float_sum_) >= std::abs(x))
+      compensation_ += (float_sum_ - t) + x;
+    else
+      compensation_ += (x - t) + float_sum_;
+    float_sum_ = t;
+  }
+
+  int64_t int_sum_ = 0;
+  double float_sum_ = 0.0;
+  double compensation_ = 0.0;
+  size_t num_floats_ = 0;
+};
+
+class count_group;
+
+class sum_group {
+public:
+  sum_group(const common::event_data &first_event) { sum_.add(first_event); }
+
+  void add_event(const common::event_data &val) { sum_.add(val); }
+
+  void remove_event(const common::event_data &val) { sum_.remove(val); }
+
+  common::event_data finalize_group() const { return sum_.value(); }
+
+private:
+  window_sum sum_;
+};
+
+class avg_group {
+public:
+  avg_group(const common::event_data &first_event) : counter_(1) {
+    sum_.add(first_event);
   }
 
-  void add_event(const common::event_data &val) { group_state_.insert(val); }
+  void add_event(const common::event_data &val) {
+    sum_.add(val);
+    counter_++;
+  }
 
   void remove_event(const common::event_data &val) {
-    auto it = group_state_.find(val);
-    assert(it != group_state_.end());
-    group_state_.erase(it);
+    assert(counter_ > 0);
+    sum_.remove(val);
+    counter_--;
   }
 
   common::event_data finalize_group() const {
-    assert(!group_state_.empty());
-    return *group_state_.begin();
+    return common::event_data::Float(sum_.to_double() /
+                                     static_cast<double>(counter_));
   }
 
 private:
-  absl::btree_multiset<common::event_data, Compare> group_state_;
+  window_sum sum_;
+  size_t counter_;
 };
 
-class count_group;
+class approx_dcnt_group : public agg_base::approx_dcnt_group {
+public:
+  approx_dcnt_group(const common::event_data &first_event)
+      : agg_base::approx_dcnt_group(first_event) {}
 
-class sum_group : public agg_base::sum_group {
+  void remove_event(const common::event_data &val) { sketch_.remove(val); }
+};
+
+class approx_med_group : public agg_base::approx_med_group {
 public:
-  sum_group(const common::event_data &first_event)
-      : agg_base::sum_group(first_event) {}
+  approx_med_group(const common::event_data &first_event)
+      : agg_base::approx_med_group(first_event) {}
 
-  void remove_event(const common::event_data &val) { res_ = res_ - val; }
+  void remove_event(const common::event_data &val) { sketch_.remove(val); }
 };
 
-class avg_group : public agg_base::avg_group {
+// MIN/MAX over the windows of all groups. The values of all groups share one
+// ordered map keyed by (group id, value), so a group only costs a hash map
+// entry instead of its own btree, and every group caches its extreme to keep
+// finalizing constant time per group.
+template<typename Compare>
+class min_max_state {
 public:
-  avg_group(const common::event_data &first_value)
-      : agg_base::avg_group(first_value) {}
+  void add_result(hashed_event group, const common::event_data &val) {
+    auto [it, inserted] =
+      groups_.try_emplace(std::move(group), group_info{next_id_, 0, val});
+    auto &info = it->second;
+    if (inserted)
+      next_id_++;
+    else if (Compare()(val, info.extreme))
+      info.extreme = val;
+    info.count++;
+    values_[value_key{info.id, val}]++;
+  }
 
-  void remove_event(const common::event_data &val) {
-    assert(counter_ > 0);
-    sum_ = sum_ - val.to_double();
-    counter_--;
+  void remove_result(const hashed_event &group,
+                     const common::event_data &val) {
+    auto it = groups_.find(group);
+    assert(it != groups_.end());
+    auto &info = it->second;
+    assert(info.count > 0);
+    if (--info.count == 0) {
+      values_.erase(value_key{info.id, val});
+      groups_.erase(it);
+      return;
+    }
+    auto val_it = values_.find(value_key{info.id, val});
+    assert(val_it != values_.end());
+    if (--val_it->second > 0)
+      return;
+    auto next_it = values_.erase(val_it);
+    if (!Compare()(info.extreme, val)) {
+      // the extreme was removed, the group's next value takes its place
+      assert(next_it != values_.end() && next_it->first.group_id == info.id);
+      info.extreme = next_it->first.val;
+    }
+  }
+
+  opt_table finalize_table(size_t nfvs, bool clear_groups = true) {
+    event_table res(nfvs);
+    for (const auto &[group, info] : groups_) {
+      event group_cp;
+      group_cp.reserve(nfvs);
+      group_cp.insert(group_cp.end(), group->cbegin(), group->cend());
+      group_cp.push_back(info.extreme);
+      res.add_row(std::move(group_cp));
+    }
+    if (clear_groups) {
+      groups_.clear();
+      values_.clear();
+    }
+    return res.empty() ? opt_table() : std::move(res);
   }
+
+private:
+  struct group_info {
+    size_t id;
+    size_t count;
+    common::event_data extreme;
+  };
+  struct value_key {
+    size_t group_id;
+    common::event_data val;
+  };
+  struct value_key_less {
+    bool operator()(const value_key &a, const value_key &b) const {
+      if (a.group_id != b.group_id)
+        return a.group_id < b.group_id;
+      return Compare()(a.val, b.val);
+    }
+  };
+
+  common::hash_cached_map<event, group_info> groups_;
+  absl::btree_map<value_key, size_t, value_key_less> values_;
+  size_t next_id_ = 0;
 };
 
-using max_group = min_max_group<std::greater<>>;
-using min_group = min_max_group<std::less<>>;
+// MED over the windows of all groups, sharing one order statistic tree keyed
+// by (group id, value) in the same way as min_max_state. The median of a group
+// is found by rank, in O(log n).
+class med_state {
+public:
+  void add_result(hashed_event group, const common::event_data &val) {
+    auto [it, inserted] =
+      groups_.try_emplace(std::move(group), group_info{next_id_, 0});
+    if (inserted)
+      next_id_++;
+    it->second.count++;
+    values_.insert(value_key{it->second.id, val});
+  }
+
+  void remove_result(const hashed_event &group,
+                     const common::event_data &val) {
+    auto it = groups_.find(group);
+    assert(it != groups_.end() && it->second.count > 0);
+    values_.erase(value_key{it->second.id, val});
+    if (--it->second.count == 0)
+      groups_.erase(it);
+  }
+
+  opt_table finalize_table(size_t nfvs, bool clear_groups = true) {
+    event_table res(nfvs);
+    for (const auto &[group, info] : groups_) {
+      event group_cp;
+      group_cp.reserve(nfvs);
+      group_cp.insert(group_cp.end(), group->cbegin(), group->cend());
+      group_cp.push_back(median(info));
+      res.add_row(std::move(group_cp));
+    }
+    if (clear_groups) {
+      groups_.clear();
+      values_.clear();
+    }
+    return res.empty() ? opt_table() : std::move(res);
+  }
+
+private:
+  struct group_info {
+    size_t id;
+    size_t count;
+  };
+  struct value_key {
+    size_t group_id;
+    common::event_data val;
+  };
+  struct value_key_less {
+    bool operator()(const value_key &a, const value_key &b) const {
+      if (a.group_id != b.group_id)
+        return a.group_id < b.group_id;
+      return common::compat_less()(a.val, b.val);
+    }
+  };
+
+  common::event_data median(const group_info &info) const {
+    size_t start = values_.count_prefix(
+      [id = info.id](const value_key &k) { return k.group_id < id; });
+    size_t n = info.count;
+    double med = values_.nth(start + n / 2).val.to_double();
+    if (n % 2 == 0)
+      med = (med + values_.nth(start + n / 2 - 1).val.to_double()) / 2.0;
+    return common::event_data::Float(med);
+  }
+
+  common::hash_cached_map<event, group_info> groups_;
+  common::order_statistic_tree<value_key, value_key_less> values_;
+  size_t next_id_ = 0;
+};
 
 template<typename GroupType>
 class counted_group {
@@ -131,7 +337,8 @@ class grouped_state : public agg_base::grouped_state<counted_group<GroupType>> {
 public:
   grouped_state() : agg_base::grouped_state<counted_group<GroupType>>() {}
 
-  void remove_result(const event &group, const common::event_data &val) {
+  void remove_result(const hashed_event &group,
+                     const common::event_data &val) {
     auto it = this->groups_.find(group);
     assert(it != this->groups_.end());
     it->second.remove_event(val);
@@ -154,9 +361,12 @@ public:
 private:
   using state_t =
     boost::variant2::variant<grouped_state<count_group>,
-                             grouped_state<avg_group>, grouped_state<max_group>,
-                             grouped_state<min_group>,
-                             grouped_state<sum_group>>;
+                             grouped_state<avg_group>,
+                             min_max_state<std::greater<>>,
+                             min_max_state<std::less<>>,
+                             grouped_state<sum_group>, med_state,
+                             grouped_state<approx_dcnt_group>,
+                             grouped_state<approx_med_group>>;
   common::event_data default_val_;
   std::vector<size_t> group_var_idxs_;
   size_t nfvs_;
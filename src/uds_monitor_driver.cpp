@@ -1,19 +1,44 @@
 #include "uds_monitor_driver.h"
 #include "deserialization.h"
+#include <absl/cleanup/cleanup.h>
 #include <cstdio>
+#include <utility>
 
 uds_monitor_driver::uds_monitor_driver(
-  const std::filesystem::path &formula_path,
+  const std::vector<std::filesystem::path> &formula_paths,
   const std::filesystem::path &sig_path, const std::string &socket_path,
-  std::optional<std::string> verdict_path)
-    : printer_(std::move(verdict_path)) {
-  auto formula = fo::Formula(read_file(formula_path));
+  std::optional<std::string> verdict_path, bool pipelined, size_t num_slices)
+    : pipelined_(pipelined), printer_(std::move(verdict_path)) {
+  std::vector<fo::Formula> formulas;
+  formulas.reserve(formula_paths.size());
+  for (const auto &formula_path : formula_paths)
+    formulas.emplace_back(read_file(formula_path));
   sig_ = parse::signature_parser::parse(read_file(sig_path));
-  monitor_ = monitor::monitor(formula);
+  monitor_ = formula_monitor(formulas, num_slices);
   deser_.emplace(socket_path, fo::Formula::get_known_preds());
 }
 
 void uds_monitor_driver::do_monitor() {
+  if (pipelined_) {
+    pipeline_source source{
+      [this](std::vector<int64_t> &latency_markers) {
+        return deser_->read_database(latency_markers);
+      },
+      [this](int64_t lm) { deser_->send_latency_marker(lm); },
+      [this] { deser_->cancel(); }};
+    // The other end waits for the EOF also if the pipeline fails, the
+    // error of the pipeline is reported instead of one of sending it
+    absl::Cleanup eof_on_error = [this] {
+      try {
+        deser_->send_eof();
+      } catch (...) {
+      }
+    };
+    run_pipelined(source, monitor_, printer_);
+    std::move(eof_on_error).Cancel();
+    deser_->send_eof();
+    return;
+  }
   while (true) {
     auto opt_db = deser_->read_database();
     if (opt_db) {
@@ -7,22 +7,26 @@
 #include <formula.h>
 #include <monitor.h>
 #include <monitor_driver.h>
+#include <slicer.h>
 #include <traceparser.h>
 #include <type_traits>
 #include <util.h>
+#include <vector>
 
 
 class uds_monitor_driver : public monitor_driver {
 public:
-  uds_monitor_driver(const std::filesystem::path &formula_path,
+  uds_monitor_driver(const std::vector<std::filesystem::path> &formula_paths,
                      const std::filesystem::path &sig_path,
                      const std::string &socket_path,
-                     std::optional<std::string> verdict_path);
+                     std::optional<std::string> verdict_path,
+                     bool pipelined = false, size_t num_slices = 1);
   void do_monitor() override;
 
 private:
+  bool pipelined_;
   verdict_printer printer_;
-  monitor::monitor monitor_;
+  formula_monitor monitor_;
   parse::signature sig_;
   std::optional<ipc::serialization::deserializer> deser_;
 };
@@ -23,17 +23,17 @@ opt_table until_impl_base::table_from_map(const a2_elem_t &mapping) {
   return res_tab.empty() ? opt_table() : std::move(res_tab);
 }
 
-void until_impl_base::combine_max(a2_elem_t &mapping1, a2_elem_t &mapping2) {
-  for (const auto &entry : mapping1) {
-    auto mapping2_it = mapping2.find(entry.first);
-    if (mapping2_it == mapping2.end())
-      mapping2.insert(entry);
-    else
-      mapping2_it->second = std::max(mapping2_it->second, entry.second);
-  }
+// Merges a2_map[1] into a2_map[0] and moves the result to a2_map[1], so that
+// the work is proportional to the entries of the next tp rather than to all
+// accumulated entries
+void until_impl_base::merge_front() {
+  assert(a2_map.size() >= 2);
+  for (const auto &entry : a2_map[1])
+    update_a2_inner_map(0, entry.first, entry.second);
+  std::swap(a2_map[0], a2_map[1]);
 }
 
-void until_impl_base::update_a2_inner_map(size_t idx, const event &e,
+void until_impl_base::update_a2_inner_map(size_t idx, const hashed_event &e,
                                           size_t new_ts_tp) {
   assert(idx < a2_map.size());
   /*auto a2_it = a2_map.find(idx);
@@ -43,12 +43,15 @@ void until_impl_base::update_a2_inner_map(size_t idx, const event &e,
     a2_map.emplace(idx, std::move(nested_map));
   } else {*/
   auto &nest_map = a2_map[idx];
-  auto nest_it = nest_map.find(e);
-  if (nest_it == nest_map.end())
-    nest_map.emplace(e, new_ts_tp);
-  else
-    nest_it->second = std::max(nest_it->second, new_ts_tp);
+  auto [nest_it, inserted] = nest_map.try_emplace(e, new_ts_tp);
+  if (!inserted) {
+    if (new_ts_tp <= nest_it->second)
+      return;
+    nest_it->second = new_ts_tp;
+  }
   //}
+  if (idx == 0)
+    a2_expiry.emplace(new_ts_tp, e);
 }
 
 void until_impl_base::shift(size_t new_ts) {
@@ -59,14 +62,19 @@ void until_impl_base::shift(size_t new_ts) {
       break;
     assert(a2_map.size() >= 2);
     assert(curr_tp >= ts_buf.size());
-    auto erase_cond = [this, old_ts](const auto &entry) {
-      size_t tstp = entry.second;
-      return !((!contains_zero && old_ts < tstp) ||
-               (contains_zero && first_tp <= tstp));
-    };
-    absl::erase_if(a2_map[0], erase_cond);
-    res_acc.push_back(table_from_map(a2_map[0]));
-    combine_max(a2_map[0], a2_map[1]);
+    // Entries with a smaller ts/tp can no longer be satisfied. The bound only
+    // grows, so they are dropped for good.
+    size_t min_tstp = contains_zero ? first_tp : old_ts + 1;
+    auto &front_map = a2_map[0];
+    for (; !a2_expiry.empty() && a2_expiry.top().first < min_tstp;
+         a2_expiry.pop()) {
+      const auto &[tstp, e] = a2_expiry.top();
+      auto it = front_map.find(e);
+      if (it != front_map.end() && it->second == tstp)
+        front_map.erase(it);
+    }
+    res_acc.push_back(table_from_map(front_map));
+    merge_front();
   }
 }
 
@@ -83,6 +91,16 @@ void until_impl::print_state() {
              curr_tp, ts_buf, a1_map, a2_map, res_acc);
 }
 
+std::optional<size_t> until_impl::a2_override_idx(const hashed_event &e) const {
+  const auto a1_it = a1_map.find(filter_row(comm_idx_r, e));
+  if (a1_it == a1_map.end())
+    return left_negated ? std::optional<size_t>(0) : std::nullopt;
+  if (left_negated)
+    return a1_it->second + 1 <= first_tp ? 0 : a1_it->second + 1 - first_tp;
+  else
+    return a1_it->second <= first_tp ? 0 : a1_it->second - first_tp;
+}
+
 void until_impl::update_a2_map(size_t new_ts, const opt_table &tab_r) {
   size_t new_ts_tp;
   if (contains_zero)
@@ -90,28 +108,34 @@ void until_impl::update_a2_map(size_t new_ts, const opt_table &tab_r) {
   else
     new_ts_tp = new_ts - std::min((inter.get_lower() - 1), new_ts);
   assert(curr_tp >= ts_buf.size());
-  if (tab_r) {
-    for (const auto &e: *tab_r) {
-      if (contains_zero) {
-        assert(!a2_map.empty());
-        update_a2_inner_map(a2_map.size() - 1, e, new_ts_tp);
-      }
-      const auto a1_it = a1_map.find(filter_row(comm_idx_r, e));
-      size_t override_idx;
-      if (a1_it == a1_map.end()) {
-        if (left_negated)
-          override_idx = 0;
-        else
-          continue;
-      } else {
-        if (left_negated)
-          override_idx =
-            a1_it->second + 1 <= first_tp ? 0 : a1_it->second + 1 - first_tp;
-        else
-          override_idx = a1_it->second <= first_tp ? 0 : a1_it->second - first_tp;
-      }
-      update_a2_inner_map(override_idx, e, new_ts_tp);
+  auto update = [this, new_ts_tp](const hashed_event &e,
+                                  std::optional<size_t> override_idx) {
+    if (contains_zero) {
+      assert(!a2_map.empty());
+      update_a2_inner_map(a2_map.size() - 1, e, new_ts_tp);
     }
+    if (override_idx)
+      update_a2_inner_map(*override_idx, e, new_ts_tp);
+  };
+  if (tab_r && common::task_pool::global() &&
+      tab_r->tab_size() >= PARALLEL_LOOKUP_MIN_ROWS) {
+    // The lookups are independent, only a2_map is updated sequentially. The
+    // rows are referred to by their iterators instead of being copied.
+    std::vector<event_table::const_iterator> rows;
+    rows.reserve(tab_r->tab_size());
+    for (auto it = tab_r->begin(); it != tab_r->end(); ++it)
+      rows.push_back(it);
+    std::vector<std::optional<size_t>> override_idxs(rows.size());
+    common::parallel_for(rows.size(), PARALLEL_LOOKUP_GRAIN,
+                         [this, &rows, &override_idxs](size_t lo, size_t hi) {
+                           for (size_t i = lo; i < hi; ++i)
+                             override_idxs[i] = a2_override_idx(*rows[i]);
+                         });
+    for (size_t i = 0; i < rows.size(); ++i)
+      update(*rows[i], override_idxs[i]);
+  } else if (tab_r) {
+    for (const auto &e : *tab_r)
+      update(e, a2_override_idx(e));
   }
   a2_map.emplace_back();
 }
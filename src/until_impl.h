@@ -3,11 +3,16 @@
 
 #include <absl/container/flat_hash_map.h>
 #include <absl/container/node_hash_map.h>
+#include <algorithm>
 #include <boost/container/devector.hpp>
 #include <event_data.h>
 #include <formula.h>
 #include <monitor_types.h>
+#include <optional>
+#include <queue>
 #include <table.h>
+#include <task_pool.h>
+#include <utility>
 #include <vector>
 
 namespace monitor::detail {
@@ -16,23 +21,56 @@ class until_impl_base {
 public:
   event_table_vec eval(size_t new_ts);
 
+  // Drops the tuples of the right operand for which drop holds. Their
+  // entries in a2_expiry become stale.
+  template<typename Pred>
+  void erase_tuples_if(Pred drop) {
+    for (auto &map : a2_map)
+      absl::erase_if(map,
+                     [&drop](const auto &entry) { return drop(*entry.first); });
+  }
+
+  template<typename Pred>
+  [[nodiscard]] bool any_tuple(Pred pred) const {
+    return std::any_of(a2_map.begin(), a2_map.end(), [&pred](const auto &map) {
+      return std::any_of(map.begin(), map.end(), [&pred](const auto &entry) {
+        return pred(*entry.first);
+      });
+    });
+  }
+
 protected:
-  using tuple_t = std::vector<common::event_data>;
-  using a2_elem_t = absl::flat_hash_map<tuple_t, size_t>;
+  using tuple_t = event;
+  using a2_elem_t = common::hash_cached_map<tuple_t, size_t>;
   using a2_map_t = boost::container::devector<a2_elem_t>;
   using ts_buf_t = boost::container::devector<size_t>;
+  // (ts/tp, tuple) pairs of a2_map[0], smallest ts/tp first. Entries whose
+  // value has since been raised are stale and skipped when popped.
+  using expiry_elem_t = std::pair<size_t, hashed_event>;
+  struct expiry_later {
+    bool operator()(const expiry_elem_t &a, const expiry_elem_t &b) const {
+      return a.first > b.first;
+    }
+  };
+  using expiry_queue_t =
+    std::priority_queue<expiry_elem_t, std::vector<expiry_elem_t>,
+                        expiry_later>;
 
   until_impl_base(size_t nfvs, fo::Interval inter);
   opt_table table_from_map(const a2_elem_t &mapping);
-  void combine_max(a2_elem_t &mapping1, a2_elem_t &mapping2);
-  void update_a2_inner_map(size_t idx, const event &e, size_t new_ts_tp);
+  void merge_front();
+  void update_a2_inner_map(size_t idx, const hashed_event &e,
+                           size_t new_ts_tp);
   void shift(size_t new_ts);
 
   bool contains_zero;
   size_t first_tp, curr_tp, nfvs;
   fo::Interval inter;
   ts_buf_t ts_buf;
+  // a2_map[0] accumulates the entries of all earlier tps, the other maps
+  // only hold the entries added for their tp
   a2_map_t a2_map;
+  expiry_queue_t a2_expiry;
   event_table_vec res_acc;
 };
 
@@ -44,10 +82,30 @@ public:
   void add_tables(opt_table &tab_l, opt_table &tab_r, size_t new_ts);
   void print_state();
 
+  // Drops the tuples of the left operand for which drop holds
+  template<typename Pred>
+  void erase_left_tuples_if(Pred drop) {
+    absl::erase_if(a1_map,
+                   [&drop](const auto &entry) { return drop(*entry.first); });
+  }
+
+  template<typename Pred>
+  [[nodiscard]] bool any_left_tuple(Pred pred) const {
+    return std::any_of(a1_map.begin(), a1_map.end(),
+                       [&pred](const auto &entry) { return pred(*entry.first); });
+  }
+
 private:
-  using a1_map_t = absl::flat_hash_map<tuple_t, size_t>;
+  using a1_map_t = common::hash_cached_map<tuple_t, size_t>;
+
+  // Tables with at least this many rows are looked up in a1_map in parallel
+  static constexpr size_t PARALLEL_LOOKUP_MIN_ROWS = 8192;
+  static constexpr size_t PARALLEL_LOOKUP_GRAIN = 2048;
 
   void update_a2_map(size_t new_ts, const opt_table &tab_r);
+  // Index of the a2_map entry from which on the left operand held for e
+  // continuously, nullopt if it does not hold at the current tp
+  std::optional<size_t> a2_override_idx(const hashed_event &e) const;
   void update_a1_map(const opt_table &tab_l);
 
   bool left_negated;
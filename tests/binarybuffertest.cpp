@@ -1,5 +1,6 @@
 #include <buffers.h>
 #include <gtest/gtest.h>
+#include <optional>
 #include <utility>
 #include <vector>
 
@@ -140,4 +141,56 @@ TEST(BinaryBuffer, RandomInsert) {
                             {17, 17}}));
     // buffer is empty
   }
-}
\ No newline at end of file
+}
+
+TEST(BinaryBuffer, RunsMatchElementwise) {
+  using opt_int = std::optional<int>;
+  using runs = common::run_length_vec<opt_int>;
+  auto sum = [](const opt_int &l, const opt_int &r) -> opt_int {
+    if (!l || !r)
+      return {};
+    return *l + *r;
+  };
+  auto make_runs = [](std::vector<opt_int> elems) {
+    return runs(std::move(elems));
+  };
+  common::binary_buffer<opt_int> run_buf, elem_buf;
+  std::vector<std::pair<std::vector<opt_int>, std::vector<opt_int>>> steps{
+    {{{}, {}, 1, {}}, {}},
+    {{{}, {}}, {2, {}, {}, 3, 4}},
+    {{5, {}, {}, {}}, {{}, 6, 7}},
+    {{}, {{}, {}, {}, 8}},
+    {{9, {}}, {}}};
+  for (auto &[l, r] : steps) {
+    auto run_l = make_runs(l), run_r = make_runs(r);
+    auto run_res = run_buf.update_and_reduce_runs(run_l, run_r, sum);
+    auto elem_res = elem_buf.update_and_reduce(l, r, sum);
+    EXPECT_EQ(std::move(run_res).expand(), elem_res);
+  }
+}
+
+TEST(BinaryBuffer, EmptyRunsAreMerged) {
+  using opt_int = std::optional<int>;
+  common::run_length_vec<opt_int> l, r;
+  l.push_run(1000000, opt_int());
+  l.push_run(1000000, opt_int());
+  l.push_back(1);
+  r.push_run(500000, opt_int());
+  r.push_run(1500001, opt_int(2));
+  EXPECT_EQ(l.runs().size(), 2u);
+  EXPECT_EQ(l.size(), 2000001u);
+  common::binary_buffer<opt_int> buf;
+  size_t calls = 0;
+  auto res = buf.update_and_reduce_runs(
+    l, r, [&calls](const opt_int &a, const opt_int &b) -> opt_int {
+      ++calls;
+      if (!a || !b)
+        return {};
+      return *a * *b;
+    });
+  EXPECT_EQ(calls, 3u);
+  EXPECT_EQ(res.size(), 2000001u);
+  ASSERT_EQ(res.runs().size(), 2u);
+  EXPECT_EQ(res.runs()[0].first, 2000000u);
+  EXPECT_EQ(res.runs()[1], std::pair(size_t{1}, opt_int(2)));
+}
@@ -305,4 +305,48 @@ TEST(Formula, IsSafeFormula) {
     EXPECT_FALSE(f.is_safe_formula());
   }
   // TODO: Add tests for SINCE, UNTIL and AND
-}
\ No newline at end of file
+}
+
+TEST(Formula, CompiledTerm) {
+  using namespace fo;
+  // (x * 1000 + y) / z with x, y, z stored at positions 2, 0, 1
+  auto t = Term::Div(
+    Term::Plus(Term::Mult(Term::Var(0), Term::Const(event_data::Int(1000))),
+               Term::Var(1)),
+    Term::Var(2));
+  std::vector<size_t> var_2_idx{2, 0, 1};
+  compiled_term ct(t, var_2_idx);
+  inline_tuple<event_data> tup{event_data::Int(7), event_data::Int(1),
+                               event_data::Int(7)};
+  EXPECT_EQ(ct.eval(tup), t.eval(var_2_idx, tup));
+  EXPECT_EQ(ct.eval(tup), event_data::Int(7007));
+
+  std::vector<std::vector<event_data>> cols{
+    {event_data::Int(7), event_data::Int(5)},
+    {event_data::Int(1), event_data::Int(2)},
+    {event_data::Int(7), event_data::Int(1)}};
+  std::vector<event_data> out;
+  ct.eval_batch(cols, 2, out);
+  EXPECT_EQ(out, (std::vector{event_data::Int(7007), event_data::Int(502)}));
+
+  auto folded = Term::I2f(Term::Minus(Term::Const(event_data::Int(2)),
+                                     Term::Const(event_data::Int(5))));
+  compiled_term ct_folded(folded, {});
+  EXPECT_EQ(ct_folded.eval({}), event_data::Float(-3.0));
+
+  // x + 1 / 0 compiles, the division is only evaluated with the term
+  auto div_zero =
+    Term::Plus(Term::Var(0), Term::Div(Term::Const(event_data::Int(1)),
+                                       Term::Const(event_data::Int(0))));
+  compiled_term ct_div_zero(div_zero, {0});
+  auto mod_zero = Term::Mod(Term::Const(event_data::Int(3)),
+                            Term::Minus(Term::Const(event_data::Int(1)),
+                                        Term::Const(event_data::Int(1))));
+  compiled_term ct_mod_zero(mod_zero, {});
+  // Conversions of operands of the wrong type are not folded either
+  compiled_term ct_f2i(Term::F2i(Term::Const(event_data::Int(1))), {});
+  auto div_float = Term::Div(Term::Const(event_data::Float(1.0)),
+                             Term::Const(event_data::Float(4.0)));
+  compiled_term ct_div_float(div_float, {});
+  EXPECT_EQ(ct_div_float.eval({}), event_data::Float(0.25));
+}
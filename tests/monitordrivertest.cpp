@@ -0,0 +1,170 @@
+#include <condition_variable>
+#include <cstdint>
+#include <database.h>
+#include <event_data.h>
+#include <file_monitor_driver.h>
+#include <filesystem>
+#include <fmt/core.h>
+#include <formula.h>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <monitor_driver.h>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <util.h>
+#include <vector>
+
+using namespace fo;
+
+namespace {
+using ed = common::event_data;
+
+// Input of one step and the latency markers read before it, no input means
+// the end of the input
+struct fake_step {
+  std::optional<parse::database> db;
+  std::vector<int64_t> latency_markers;
+};
+
+Formula pred_p() { return Formula::Pred("P", {Term::Var(0)}, false); }
+
+parse::database p_db(int64_t val) {
+  parse::database db;
+  db[Formula::add_pred_to_map("P", 1)].push_back({ed::Int(val)});
+  return db;
+}
+
+void write_file(const std::filesystem::path &path, std::string_view content) {
+  std::ofstream(path) << content;
+}
+
+std::string read_whole_file(const std::filesystem::path &path) {
+  std::ifstream file(path);
+  return {std::istreambuf_iterator<char>(file),
+          std::istreambuf_iterator<char>()};
+}
+}// namespace
+
+TEST(MonitorDriver, PipelineAnswersMarkersAfterEarlierVerdicts) {
+  std::vector<fake_step> steps;
+  steps.push_back({p_db(0), {}});
+  steps.push_back({p_db(1), {10}});
+  steps.push_back({p_db(2), {20, 21}});
+  steps.push_back({std::nullopt, {30}});
+  size_t next_step = 0;
+  pipeline_source source{
+    [&](std::vector<int64_t> &latency_markers)
+      -> std::optional<monitor_input> {
+      auto &step = steps.at(next_step);
+      latency_markers = step.latency_markers;
+      size_t ts = next_step++;
+      if (!step.db)
+        return std::nullopt;
+      return monitor_input(
+        monitor::monitor_db_from_parser_db(std::move(*step.db)),
+        make_vector(ts));
+    },
+    // printed to the same stream as the verdicts
+    [](int64_t lm) { fmt::print("marker {}\n", lm); },
+    {}};
+  formula_monitor mon({pred_p()}, 1);
+  verdict_printer printer(std::nullopt);
+  testing::internal::CaptureStdout();
+  run_pipelined(source, mon, printer);
+  auto output = testing::internal::GetCapturedStdout();
+  EXPECT_EQ(output, "@0 (time point 0): (0)\n"
+                    "marker 10\n"
+                    "@1 (time point 1): (1)\n"
+                    "marker 20\n"
+                    "marker 21\n"
+                    "@2 (time point 2): (2)\n"
+                    "marker 30\n");
+  EXPECT_EQ(next_step, steps.size());
+}
+
+TEST(MonitorDriver, PipelineCancelsBlockedProducer) {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool cancelled = false;
+  size_t num_produced = 0;
+  pipeline_source source{
+    [&](std::vector<int64_t> &latency_markers)
+      -> std::optional<monitor_input> {
+      if (num_produced++ == 0) {
+        latency_markers.push_back(1);
+        return monitor_input({}, make_vector(size_t{0}));
+      }
+      // blocks like a read from a socket that receives nothing
+      std::unique_lock lock(mutex);
+      cv.wait(lock, [&] { return cancelled; });
+      throw std::runtime_error("input cancelled");
+    },
+    [](int64_t) { throw std::runtime_error("cannot answer marker"); },
+    [&] {
+      {
+        std::lock_guard lock(mutex);
+        cancelled = true;
+      }
+      cv.notify_all();
+    }};
+  formula_monitor mon({pred_p()}, 1);
+  verdict_printer printer(std::nullopt);
+  // The error of the printer is reported, not the one of the cancelled input
+  try {
+    run_pipelined(source, mon, printer);
+    FAIL() << "the pipeline did not fail";
+  } catch (const std::runtime_error &e) {
+    EXPECT_STREQ(e.what(), "cannot answer marker");
+  }
+  EXPECT_TRUE(cancelled);
+}
+
+TEST(MonitorDriver, FileDriverBatchesMatchSingleSteps) {
+  auto dir = std::filesystem::temp_directory_path() / "cppmon_driver_test";
+  std::filesystem::create_directories(dir);
+  // P(x) UNTIL [0,5] Q(x, y), and Q(x, y) AND PREV P(x)
+  write_file(
+    dir / "formula.json",
+    R"(["Or",
+         ["Until",
+           ["Pred","P",[["Var",["Nat",0]]]],
+           [["Nat",0],["Enat",["Nat",5]]],
+           ["Pred","Q",[["Var",["Nat",0]],["Var",["Nat",1]]]]],
+         ["And",
+           ["Pred","Q",[["Var",["Nat",0]],["Var",["Nat",1]]]],
+           ["Prev",[["Nat",0],["Infinity_enat"]],
+             ["Pred","P",[["Var",["Nat",0]]]]]]])");
+  write_file(dir / "formula.sig", "P(int)\nQ(int,int)\n");
+  // Some tps have no P, no Q or neither of them
+  std::string log;
+  for (size_t i = 0; i < 30; ++i) {
+    log += fmt::format("@{}", 2 * i + (i % 3 == 1 ? 1 : 0));
+    if (i % 4 != 3)
+      log += fmt::format(" P({})({})", i % 5, (i + 2) % 5);
+    if (i % 3 == 0)
+      log += fmt::format(" Q({},{})", (i + 1) % 5, i % 7);
+    log += ";\n";
+  }
+  write_file(dir / "log.txt", log);
+  auto verdicts = [&](size_t batch_size, size_t batch_bytes, bool pipelined) {
+    auto vpath = dir / "verdicts.txt";
+    {
+      file_monitor_driver driver({dir / "formula.json"}, dir / "formula.sig",
+                                 dir / "log.txt", vpath.string(), batch_size,
+                                 batch_bytes, pipelined);
+      driver.do_monitor();
+    }
+    return read_whole_file(vpath);
+  };
+  auto expected = verdicts(1, 0, false);
+  EXPECT_NE(expected, "");
+  EXPECT_EQ(verdicts(7, 0, false), expected);
+  EXPECT_EQ(verdicts(7, 0, true), expected);
+  // The byte budget ends the batches after two or three tps
+  EXPECT_EQ(verdicts(7, 30, false), expected);
+  std::filesystem::remove_all(dir);
+}
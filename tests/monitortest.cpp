@@ -1,4 +1,5 @@
 #include <absl/container/flat_hash_map.h>
+#include <algorithm>
 #include <database.h>
 #include <event_data.h>
 #include <fmt/core.h>
@@ -6,12 +7,78 @@
 #include <gtest/gtest.h>
 #include <hash_cache.h>
 #include <monitor.h>
+#include <pred_filter.h>
+#include <random>
+#include <slicer.h>
+#include <string>
+#include <task_pool.h>
+#include <tuple>
 #include <util.h>
 #include <vector>
 
 
 using namespace fo;
 
+namespace {
+using ed = common::event_data;
+using trace = std::vector<std::pair<parse::database, size_t>>;
+
+monitor::satisfactions sorted_sats(monitor::satisfactions sats) {
+  for (auto &sat : sats)
+    std::sort(std::get<2>(sat).begin(), std::get<2>(sat).end());
+  return sats;
+}
+
+std::vector<monitor::satisfactions>
+sorted_sats(std::vector<monitor::satisfactions> formula_sats) {
+  for (auto &sats : formula_sats)
+    sats = sorted_sats(std::move(sats));
+  return formula_sats;
+}
+
+// Monitors one time point of a trace, the verdicts of every time point are
+// sorted so that monitors can be compared
+template<typename M>
+auto sorted_step(M &mon, const parse::database &parser_db, size_t ts) {
+  auto db = monitor::monitor_db_from_parser_db(parse::database(parser_db));
+  return sorted_sats(mon.step(db, make_vector(size_t{ts})));
+}
+
+// Runs both monitors on the trace and expects the same verdicts at every step
+template<typename M1, typename M2>
+void expect_same_verdicts(M1 &mon1, M2 &mon2, const trace &steps) {
+  for (const auto &[parser_db, ts] : steps) {
+    EXPECT_EQ(sorted_step(mon1, parser_db, ts), sorted_step(mon2, parser_db, ts))
+      << "at ts " << ts;
+  }
+}
+
+size_t num_verdicts(const monitor::satisfactions &sats) {
+  size_t res = 0;
+  for (const auto &sat : sats)
+    res += std::get<2>(sat).size();
+  return res;
+}
+
+Formula pred(const char *name, std::vector<size_t> vars) {
+  std::vector<Term> args;
+  for (auto var : vars)
+    args.push_back(Term::Var(var));
+  return Formula::Pred(name, std::move(args), false);
+}
+
+pred_id_t pred_id(const char *name, size_t arity) {
+  return Formula::add_pred_to_map(name, arity);
+}
+
+parse::database_tuple int_tuple(std::initializer_list<int64_t> vals) {
+  parse::database_tuple res;
+  for (auto val : vals)
+    res.push_back(ed::Int(val));
+  return res;
+}
+}// namespace
+
 TEST(MState, DoesCompile) {
   using ev = common::event_data;
   table<ev> tab(
@@ -47,4 +114,511 @@ TEST(MState, Bla) {
 TEST(MState, HashCache) {
   using common::event_data;
   using common::hash_cached;
-}
\ No newline at end of file
+}
+
+TEST(MState, MultiMonitorSharesSubformulas) {
+  // P(x) S [0,3] Q(x) occurs in all formulas. Unshared, the last one joins
+  // with the changes of the since; shared, with its full result.
+  auto since = Formula::Since(Interval(0, 3), pred("P", {0}), pred("Q", {0}));
+  std::vector<Formula> formulas;
+  formulas.push_back(since);
+  formulas.push_back(Formula::And(since, pred("R", {0})));
+  formulas.push_back(Formula::And(pred("R", {0}), since));
+  auto multi_mon = monitor::multi_monitor(formulas);
+  std::vector<monitor::monitor> mons;
+  for (const auto &formula : formulas)
+    mons.emplace_back(formula);
+
+  auto p = pred_id("P", 1), q = pred_id("Q", 1), r = pred_id("R", 1);
+  trace steps;
+  steps.emplace_back(parse::database{{q, {int_tuple({1}), int_tuple({2})}}}, 1);
+  steps.emplace_back(parse::database{{p, {int_tuple({1})}},
+                                     {r, {int_tuple({1}), int_tuple({2})}}},
+                     2);
+  steps.emplace_back(parse::database{{r, {int_tuple({1})}}}, 9);
+  // The formulas are stepped as tasks of the pool
+  common::task_pool::set_global_threads(3);
+  for (const auto &[parser_db, ts] : steps) {
+    auto res = sorted_step(multi_mon, parser_db, ts);
+    ASSERT_EQ(res.size(), formulas.size());
+    for (size_t i = 0; i < formulas.size(); ++i) {
+      EXPECT_EQ(res[i], sorted_step(mons[i], parser_db, ts))
+        << "formula " << i << " at ts " << ts;
+    }
+  }
+  common::task_pool::set_global_threads(1);
+}
+
+TEST(MState, MultiwayJoinMatchesBinaryJoins) {
+  // MJ1(x, y) AND MJ2(y, z) AND MJ3(w): the disjunction keeps the binary
+  // conjunctions from being flattened into one multiway join
+  auto chain = Formula::And(pred("MJ1", {0, 1}), pred("MJ2", {1, 2}));
+  auto multi = Formula::And(chain, pred("MJ3", {3}));
+  auto binary = Formula::And(Formula::Or(chain, chain), pred("MJ3", {3}));
+  auto mon1 = monitor::monitor(multi);
+  auto mon2 = monitor::monitor(binary);
+  auto p1 = pred_id("MJ1", 2), p2 = pred_id("MJ2", 2), p3 = pred_id("MJ3", 1);
+  trace steps;
+  steps.emplace_back(
+    parse::database{{p1, {int_tuple({1, 2}), int_tuple({3, 4})}},
+                    {p2, {int_tuple({2, 5}), int_tuple({2, 6})}},
+                    {p3, {int_tuple({7}), int_tuple({8})}}},
+    1);
+  // MJ2 is empty
+  steps.emplace_back(parse::database{{p1, {int_tuple({1, 2})}},
+                                     {p3, {int_tuple({7})}}},
+                     2);
+  // The join of MJ1 and MJ2 becomes empty
+  steps.emplace_back(parse::database{{p1, {int_tuple({1, 2})}},
+                                     {p2, {int_tuple({3, 5})}},
+                                     {p3, {int_tuple({7})}}},
+                     3);
+  // The cartesian operand is the smallest
+  steps.emplace_back(
+    parse::database{{p1, {int_tuple({1, 2}), int_tuple({1, 3}),
+                          int_tuple({4, 3})}},
+                    {p2, {int_tuple({2, 5}), int_tuple({3, 6}),
+                          int_tuple({3, 7})}},
+                    {p3, {int_tuple({9})}}},
+    4);
+  expect_same_verdicts(mon1, mon2, steps);
+}
+
+TEST(PredFilter, KernelsMatchReference) {
+  using monitor::detail::pred_filter;
+  std::vector<ed> pool = {ed::Int(0),        ed::Int(1),   ed::Float(0.0),
+                          ed::Float(-0.0),   ed::nan(),    ed::Float(1.5),
+                          ed::String("pf-a"), ed::String("pf-b")};
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<size_t> pick(0, pool.size() - 1);
+  for (size_t n : {0u, 1u, 63u, 64u, 65u, 255u, 256u, 257u, 300u, 513u}) {
+    std::vector<monitor::event> events;
+    for (size_t i = 0; i < n; ++i)
+      events.push_back({pool[pick(gen)], pool[pick(gen)], pool[pick(gen)]});
+    for (const auto &cst : pool) {
+      // Argument 0 is the constant, arguments 1 and 2 are the same variable
+      pred_filter filter({{0, cst}}, {{1, 2}});
+      std::vector<std::uint32_t> expected;
+      for (size_t i = 0; i < n; ++i)
+        if (events[i][0] == cst && events[i][1] == events[i][2])
+          expected.push_back(static_cast<std::uint32_t>(i));
+      for (auto isa : {pred_filter::isa::scalar, pred_filter::isa::sse41,
+                       pred_filter::isa::avx2, pred_filter::isa::best}) {
+        if (!pred_filter::supported(isa))
+          continue;
+        std::vector<std::uint32_t> sel;
+        filter.select(events, sel, isa);
+        EXPECT_EQ(sel, expected)
+          << "kernels " << static_cast<int>(isa) << ", " << n << " events";
+      }
+    }
+  }
+}
+
+TEST(MState, ApproximateAggregationsFromJson) {
+  // y <- agg x; g. AP(g, x), directly and over ONCE [0,2]
+  auto agg_json = [](const char *agg, bool temporal) {
+    std::string phi = R"(["Pred","AP",[["Var",["Nat",1]],["Var",["Nat",0]]]])";
+    if (temporal)
+      phi = R"(["Since",["Eq",["Const",["EInt",0]],["Const",["EInt",0]]],)"
+            R"([["Nat",0],["Enat",["Nat",2]]],)" +
+            phi + "]";
+    return fmt::format(
+      R"(["Agg",["Nat",1],[["{}"],["EInt",0]],["Nat",1],["Var",["Nat",0]],{}])",
+      agg, phi);
+  };
+  auto ap = pred_id("AP", 2);
+  // Group g has the values 0 to 100 * (g + 1) at every time point, and two
+  // values of its own, so that every group has an odd number of values at
+  // every time point, and also over the once
+  trace steps;
+  for (size_t ts = 1; ts <= 4; ++ts) {
+    parse::database db;
+    auto own = 1000 * static_cast<int64_t>(ts);
+    for (int64_t g = 0; g < 3; ++g) {
+      for (int64_t x = 0; x <= 100 * (g + 1); ++x)
+        db[ap].push_back(int_tuple({g, x}));
+      db[ap].push_back(int_tuple({g, own}));
+      db[ap].push_back(int_tuple({g, own + 1}));
+    }
+    steps.emplace_back(std::move(db), ts);
+  }
+  // Group -> aggregation result of every verdict
+  auto results = [](monitor::satisfactions sats) {
+    std::vector<absl::flat_hash_map<int64_t, double>> res;
+    for (const auto &sat : sats) {
+      auto &by_group = res.emplace_back();
+      for (const auto &row : std::get<2>(sat))
+        by_group[*row[0].get_if_int()] = row[1].to_double();
+    }
+    return res;
+  };
+  for (bool temporal : {false, true}) {
+    for (auto [approx, exact, tolerance] :
+         {std::tuple("Agg_Approx_Dcnt", "Agg_Cnt", 0.1),
+          std::tuple("Agg_Approx_Med", "Agg_Med", 0.01)}) {
+      auto mon_approx = monitor::monitor(Formula(agg_json(approx, temporal)));
+      auto mon_exact = monitor::monitor(Formula(agg_json(exact, temporal)));
+      for (const auto &[parser_db, ts] : steps) {
+        auto res_approx = results(sorted_step(mon_approx, parser_db, ts));
+        auto res_exact = results(sorted_step(mon_exact, parser_db, ts));
+        ASSERT_EQ(res_exact.size(), 1u);
+        ASSERT_EQ(res_exact[0].size(), 3u);
+        ASSERT_EQ(res_approx.size(), 1u);
+        ASSERT_EQ(res_approx[0].size(), 3u);
+        for (const auto &[group, val] : res_exact[0])
+          EXPECT_NEAR(res_approx[0].at(group), val, tolerance * val)
+            << approx << (temporal ? " over once" : "") << ", group " << group
+            << ", ts " << ts;
+      }
+    }
+  }
+}
+
+TEST(MState, UnboundedPastMatchesBoundedInterval) {
+  // With at most 10 time units between the first and the last time point,
+  // [0, ∞) and [0, 100] must give the same verdicts
+  auto once = [](Interval inter) {
+    return Formula::Since(inter,
+                          Formula::Eq(Term::Const(ed::Int(0)),
+                                      Term::Const(ed::Int(0))),
+                          pred("UP", {0}));
+  };
+  auto since = [](Interval inter, bool left_negated) {
+    auto left = pred("UQ", {0});
+    return Formula::Since(inter, left_negated ? Formula::Neg(left) : left,
+                          pred("UP", {0}));
+  };
+  auto variants = [&](Interval inter) {
+    std::vector<Formula> res;
+    res.push_back(once(inter));
+    res.push_back(since(inter, false));
+    res.push_back(since(inter, true));
+    // Consumers that use the full result instead of the changes
+    res.push_back(Formula::Exists(Formula::And(pred("UR", {0, 1}),
+                                               Formula::Neg(since(inter, false)))));
+    res.push_back(Formula::And(pred("UR", {1, 0}), once(inter)));
+    res.push_back(Formula::Agg(agg_type::CNT, 0, 1, ed::Int(0),
+                               Term::Var(0), since(inter, true)));
+    return res;
+  };
+  auto up = pred_id("UP", 1), uq = pred_id("UQ", 1), ur = pred_id("UR", 2);
+  trace steps;
+  steps.emplace_back(parse::database{{up, {int_tuple({1}), int_tuple({2})}},
+                                     {uq, {int_tuple({1}), int_tuple({2})}},
+                                     {ur, {int_tuple({1, 5})}}},
+                     1);
+  steps.emplace_back(parse::database{{uq, {int_tuple({1})}},
+                                     {ur, {int_tuple({2, 5}), int_tuple({1, 6})}}},
+                     2);
+  steps.emplace_back(parse::database{{up, {int_tuple({3})}},
+                                     {uq, {int_tuple({1}), int_tuple({3})}}},
+                     2);
+  steps.emplace_back(parse::database{{ur, {int_tuple({3, 7})}}}, 5);
+  steps.emplace_back(parse::database{{up, {int_tuple({2})}},
+                                     {uq, {int_tuple({3}), int_tuple({2})}},
+                                     {ur, {int_tuple({2, 7})}}},
+                     11);
+  auto unbounded = variants(Interval(0, 0, false));
+  auto bounded = variants(Interval(0, 100));
+  for (size_t i = 0; i < unbounded.size(); ++i) {
+    auto mon1 = monitor::monitor(unbounded[i]);
+    auto mon2 = monitor::monitor(bounded[i]);
+    SCOPED_TRACE(i);
+    expect_same_verdicts(mon1, mon2, steps);
+  }
+}
+
+TEST(MState, BatchedStepsMatchSingleSteps) {
+  // Operators pass runs of tables between each other. Monitoring several tps
+  // per step must give the same verdicts as monitoring them one by one with
+  // the predicates wrapped in a temporal operator, which produces one table
+  // per tp.
+  auto tt = Formula::Eq(Term::Const(ed::Int(0)), Term::Const(ed::Int(0)));
+  auto variants = [&](bool wrapped) {
+    auto p = [&](const char *name, std::vector<size_t> vars) {
+      auto res = pred(name, std::move(vars));
+      return wrapped ? Formula::Since(Interval(0, 0), tt, res) : res;
+    };
+    std::vector<Formula> res;
+    res.push_back(Formula::Or(p("RA", {0}), p("RB", {0})));
+    res.push_back(Formula::And(p("RA", {0}), Formula::Neg(p("RB", {0}))));
+    res.push_back(Formula::And(p("RC", {0, 1}), p("RA", {0})));
+    res.push_back(Formula::Neg(Formula::Exists(p("RA", {0}))));
+    res.push_back(
+      Formula::Or(Formula::And(p("RA", {0}), p("RB", {0})), p("RB", {0})));
+    res.push_back(Formula::Prev(Interval(1, 2), p("RA", {0})));
+    res.push_back(Formula::Next(Interval(2, 3), p("RB", {0})));
+    res.push_back(Formula::Until(Interval(0, 4), p("RB", {0}), p("RA", {0})));
+    res.push_back(Formula::Until(Interval(1, 3), tt, p("RC", {0, 1})));
+    res.push_back(Formula::And(p("RC", {0, 1}),
+                               Formula::Since(Interval(0, 2), tt, p("RA", {0}))));
+    res.push_back(Formula::Agg(agg_type::CNT, 0, 1, ed::Int(0), Term::Var(0),
+                               Formula::Or(p("RA", {0}), p("RB", {0}))));
+    res.push_back(
+      Formula::Agg(agg_type::CNT, 0, 1, ed::Int(0), Term::Var(0),
+                   Formula::Since(Interval(0, 3), p("RB", {0}), p("RA", {0}))));
+    res.push_back(Formula::Let("RL", p("RA", {0}),
+                               Formula::Or(p("RL", {0}), p("RB", {0}))));
+    return res;
+  };
+  auto ra = pred_id("RA", 1), rb = pred_id("RB", 1), rc = pred_id("RC", 2);
+  trace steps;
+  for (size_t i = 0; i < 14; ++i) {
+    parse::database db;
+    if (i % 4 == 1)
+      db[ra] = {int_tuple({1}), int_tuple({2})};
+    if (i % 5 == 1 || i == 2)
+      db[rb] = {int_tuple({2})};
+    if (i % 3 == 2)
+      db[rc] = {int_tuple({1, 3}), int_tuple({4, 5})};
+    // Uneven gaps, so that the intervals of the temporal operators matter
+    steps.emplace_back(std::move(db), 2 * i + (i % 3 == 1 ? 1 : 0));
+  }
+  std::vector<size_t> batch_sizes{5, 1, 3, 5};
+  auto batched = variants(false);
+  auto single = variants(true);
+  for (size_t i = 0; i < batched.size(); ++i) {
+    SCOPED_TRACE(i);
+    auto mon1 = monitor::monitor(batched[i]);
+    auto mon2 = monitor::monitor(single[i]);
+    size_t first = 0;
+    for (auto n : batch_sizes) {
+      monitor::database batch_db;
+      monitor::ts_list batch_ts;
+      monitor::satisfactions expected;
+      for (size_t k = 0; k < n; ++k) {
+        const auto &[parser_db, ts] = steps[first + k];
+        auto db = monitor::monitor_db_from_parser_db(parse::database(parser_db));
+        for (const auto &[id, tps] : db) {
+          auto &batch_tps = batch_db[id];
+          batch_tps.resize(k + 1);
+          batch_tps[k] = tps[0];
+        }
+        batch_ts.push_back(ts);
+        auto res = sorted_step(mon2, parser_db, ts);
+        expected.insert(expected.end(), res.begin(), res.end());
+      }
+      for (auto &[id, tps] : batch_db)
+        tps.resize(n);
+      EXPECT_EQ(sorted_sats(mon1.step(batch_db, batch_ts)), expected)
+        << "at tp " << first;
+      first += n;
+    }
+  }
+}
+
+TEST(MState, PredicatesGiveOneTablePerTpOfAStep) {
+  // P does not occur in the step, tp, ts and tpts are builtins
+  std::vector<std::pair<Formula, std::vector<std::vector<monitor::event>>>>
+    cases;
+  cases.emplace_back(pred("P", {0}),
+                     std::vector<std::vector<monitor::event>>{{}, {}, {}});
+  cases.emplace_back(
+    Formula::Pred("tp", {Term::Var(0)}, true),
+    std::vector<std::vector<monitor::event>>{
+      {int_tuple({0})}, {int_tuple({1})}, {int_tuple({2})}});
+  cases.emplace_back(
+    Formula::Pred("ts", {Term::Var(0)}, true),
+    std::vector<std::vector<monitor::event>>{
+      {int_tuple({3})}, {int_tuple({5})}, {int_tuple({8})}});
+  cases.emplace_back(
+    Formula::Pred("tpts", {Term::Var(0), Term::Var(1)}, true),
+    std::vector<std::vector<monitor::event>>{
+      {int_tuple({0, 3})}, {int_tuple({1, 5})}, {int_tuple({2, 8})}});
+  const std::vector<size_t> ts{3, 5, 8};
+  for (auto &[formula, verdicts] : cases) {
+    auto mon = monitor::monitor(formula);
+    monitor::database db;
+    monitor::satisfactions expected;
+    for (size_t i = 0; i < ts.size(); ++i)
+      expected.emplace_back(ts[i], i, std::move(verdicts[i]));
+    EXPECT_EQ(mon.step(db, ts), expected);
+  }
+}
+
+TEST(MState, ParallelSinceMatchesSequential) {
+  // Enough tuples for the since state to be filtered in parallel when
+  // there is a global pool
+  std::vector<Formula> formulas{
+    Formula::Since(Interval(0, 5), pred("PA", {0}), pred("PB", {0})),
+    Formula::Since(Interval(0, 5), Formula::Neg(pred("PA", {0})),
+                   pred("PB", {0})),
+    Formula::Since(Interval(0, 0, false), pred("PA", {0}), pred("PB", {0})),
+    // and enough for the lookups of until to run in parallel
+    Formula::Until(Interval(0, 1), pred("PA", {0}), pred("PB", {0}))};
+  auto pa = pred_id("PA", 1), pb = pred_id("PB", 1);
+  trace steps;
+  for (size_t i = 0; i < 4; ++i) {
+    parse::database db;
+    for (int64_t k = 0; k < 12000; ++k) {
+      if (k % (i + 2) != 0)
+        db[pa].push_back(int_tuple({k}));
+      if (i == 0 || k % 7 == static_cast<int64_t>(i))
+        db[pb].push_back(int_tuple({k}));
+    }
+    steps.emplace_back(std::move(db), i);
+  }
+  for (const auto &formula : formulas) {
+    auto sequential = monitor::monitor(formula);
+    auto parallel = monitor::monitor(formula);
+    for (const auto &[parser_db, ts] : steps) {
+      auto res1 = sorted_step(sequential, parser_db, ts);
+      common::task_pool::set_global_threads(4);
+      auto res2 = sorted_step(parallel, parser_db, ts);
+      common::task_pool::set_global_threads(1);
+      EXPECT_EQ(res1, res2) << "at ts " << ts;
+    }
+  }
+}
+
+TEST(MState, SlicedMatchesUnsliced) {
+  auto tt = Formula::Eq(Term::Const(ed::Int(0)), Term::Const(ed::Int(0)));
+  auto once = [&](Formula phi) {
+    return Formula::Since(Interval(0, 3), tt, std::move(phi));
+  };
+  std::vector<std::pair<const char *, Formula>> formulas;
+  // ∃y. SA(x, y) ∧ SB(y)
+  formulas.emplace_back(
+    "exists",
+    Formula::Exists(Formula::And(pred("SA", {1, 0}), pred("SB", {0}))));
+  // r <- SUM y GROUP BY x; SA(x, y), sliced on the group variable x
+  formulas.emplace_back("agg on group variable",
+                        Formula::Agg(agg_type::SUM, 1, 1, ed::Int(0),
+                                     Term::Var(0), pred("SA", {1, 0})));
+  // r <- CNT y; ONCE SB(y), sliced on the result variable r
+  formulas.emplace_back("agg on result variable",
+                        Formula::Agg(agg_type::CNT, 0, 1, ed::Int(0),
+                                     Term::Var(0), once(pred("SB", {0}))));
+  // LET SL(a, b) = SA(a, b) ∧ SB(b) IN SL(x, y) ∨ SC(x, y)
+  formulas.emplace_back(
+    "let", Formula::Let("SL", Formula::And(pred("SA", {0, 1}), pred("SB", {1})),
+                        Formula::Or(pred("SL", {0, 1}), pred("SC", {0, 1}))));
+  // SB(x) ∧ ∃y. SB(y) ∧ SA(y, x): SB is sent to all slices
+  formulas.emplace_back(
+    "replicated predicate",
+    Formula::And(pred("SB", {0}),
+                 Formula::Exists(Formula::And(pred("SB", {0}),
+                                              pred("SA", {0, 1})))));
+  // SA(x, y) ∧ ONCE SA(y, x) and SA(x, x)
+  formulas.emplace_back(
+    "two positions",
+    Formula::And(pred("SA", {0, 1}), once(pred("SA", {1, 0}))));
+  formulas.emplace_back("same variable twice", pred("SA", {0, 0}));
+
+  auto sa = pred_id("SA", 2), sb = pred_id("SB", 1), sc = pred_id("SC", 2);
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int64_t> val(0, 7);
+  trace steps;
+  for (size_t i = 0; i < 12; ++i) {
+    parse::database db;
+    for (size_t k = 0; k < 6; ++k)
+      db[sa].push_back(int_tuple({val(gen), val(gen)}));
+    for (size_t k = 0; k < 3; ++k) {
+      db[sb].push_back(int_tuple({val(gen)}));
+      db[sc].push_back(int_tuple({val(gen), val(gen)}));
+    }
+    steps.emplace_back(std::move(db), i);
+  }
+  for (const auto &[name, formula] : formulas) {
+    for (size_t num_slices : {2, 3, 5}) {
+      SCOPED_TRACE(fmt::format("{} with {} slices", name, num_slices));
+      auto sliced = monitor::sliced_monitor(formula, num_slices);
+      auto unsliced = monitor::monitor(formula);
+      size_t total_verdicts = 0;
+      for (const auto &[parser_db, ts] : steps) {
+        auto res1 = sorted_step(sliced, parser_db, ts);
+        auto res2 = sorted_step(unsliced, parser_db, ts);
+        EXPECT_EQ(res1, res2) << "at ts " << ts;
+        total_verdicts += num_verdicts(res2);
+      }
+      EXPECT_EQ(sorted_sats(sliced.last_step()),
+                sorted_sats(unsliced.last_step()));
+      EXPECT_GT(total_verdicts, 0u);
+    }
+  }
+}
+
+TEST(MState, SlicedHotKeyMatchesUnsliced) {
+  auto tt = Formula::Eq(Term::Const(ed::Int(0)), Term::Const(ed::Int(0)));
+  auto once = [&](Formula phi) {
+    return Formula::Since(Interval(0, 3), tt, std::move(phi));
+  };
+  std::vector<std::pair<const char *, Formula>> formulas;
+  // (ONCE SA(x, y)) ∧ SB(x): SB does not have the second variable
+  formulas.emplace_back("once",
+                        Formula::And(once(pred("SA", {0, 1})), pred("SB", {0})));
+  // SB(x) SINCE SA(x, y)
+  formulas.emplace_back(
+    "since", Formula::Since(Interval(0, 4), pred("SB", {0}), pred("SA", {0, 1})));
+  // SB(x) UNTIL SA(x, y)
+  formulas.emplace_back(
+    "until", Formula::Until(Interval(0, 3), pred("SB", {0}), pred("SA", {0, 1})));
+  // r <- CNT z GROUP BY x, y; ONCE SD(x, y, z)
+  formulas.emplace_back("agg",
+                        Formula::Agg(agg_type::CNT, 2, 1, ed::Int(0),
+                                     Term::Var(0), once(pred("SD", {1, 2, 0}))));
+  // ∃z. ONCE SD(x, y, z)
+  formulas.emplace_back("exists",
+                        Formula::Exists(once(pred("SD", {1, 2, 0}))));
+  // PREV SA(x, y), PREV PREV SA(x, y) and NEXT SA(x, y) buffer tables of
+  // other tps than the verdicts
+  formulas.emplace_back(
+    "prev", Formula::And(Formula::Prev(Interval(0, 5), pred("SA", {0, 1})),
+                         pred("SB", {0})));
+  formulas.emplace_back(
+    "prev prev",
+    Formula::Prev(Interval(0, 5),
+                  Formula::Prev(Interval(0, 5), pred("SA", {0, 1}))));
+  formulas.emplace_back(
+    "next", Formula::And(Formula::Next(Interval(0, 5), pred("SA", {0, 1})),
+                         pred("SB", {0})));
+
+  auto sa = pred_id("SA", 2), sb = pred_id("SB", 1), sd = pred_id("SD", 3);
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<int64_t> val(1, 20), sub_val(0, 15);
+  std::bernoulli_distribution hot(0.85), cool(0.25);
+  // Key 0 becomes hot at ts 10, cools down at ts 25, disappears at ts 31 and
+  // comes back at ts 35
+  auto key = [&](size_t ts) -> int64_t {
+    if (ts >= 10 && ts < 25 && hot(gen))
+      return 0;
+    if (ts >= 25 && ts < 31 && cool(gen))
+      return 0;
+    if (ts >= 25 && ts < 35)
+      return val(gen);
+    return val(gen) % 8;
+  };
+  trace steps;
+  for (size_t i = 0; i < 40; ++i) {
+    parse::database db;
+    for (size_t k = 0; k < 8; ++k) {
+      db[sa].push_back(int_tuple({key(i), sub_val(gen)}));
+      db[sd].push_back(int_tuple({key(i), sub_val(gen), sub_val(gen)}));
+    }
+    for (size_t k = 0; k < 3; ++k)
+      db[sb].push_back(int_tuple({key(i)}));
+    steps.emplace_back(std::move(db), i);
+  }
+  for (const auto &[name, formula] : formulas) {
+    SCOPED_TRACE(name);
+    const size_t num_slices = 3;
+    auto sliced = monitor::sliced_monitor(formula, num_slices, 32);
+    auto unsliced = monitor::monitor(formula);
+    size_t max_monitors = 0, total_verdicts = 0;
+    for (const auto &[parser_db, ts] : steps) {
+      auto res1 = sorted_step(sliced, parser_db, ts);
+      auto res2 = sorted_step(unsliced, parser_db, ts);
+      EXPECT_EQ(res1, res2) << "at ts " << ts << " with "
+                            << sliced.num_monitors() << " monitors";
+      total_verdicts += num_verdicts(res2);
+      max_monitors = std::max(max_monitors, sliced.num_monitors());
+    }
+    EXPECT_EQ(sorted_sats(sliced.last_step()),
+              sorted_sats(unsliced.last_step()));
+    EXPECT_GT(total_verdicts, 0u);
+    // The key was split and merged back
+    EXPECT_GT(max_monitors, num_slices);
+    EXPECT_EQ(sliced.num_monitors(), num_slices);
+  }
+}
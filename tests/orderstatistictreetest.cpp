@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include <iterator>
+#include <order_statistic_tree.h>
+#include <random>
+#include <set>
+#include <vector>
+
+using int_tree = common::order_statistic_tree<int>;
+
+// Checks size, every rank and some prefix counts against the multiset
+static void expect_same(const int_tree &tree, const std::multiset<int> &ref) {
+  ASSERT_EQ(tree.size(), ref.size());
+  EXPECT_EQ(tree.empty(), ref.empty());
+  size_t k = 0;
+  for (int val : ref)
+    EXPECT_EQ(tree.nth(k++), val);
+  for (int bound = -1; bound <= 101; bound += 17) {
+    auto expected =
+      static_cast<size_t>(std::distance(ref.begin(), ref.lower_bound(bound)));
+    EXPECT_EQ(tree.count_prefix([bound](int val) { return val < bound; }),
+              expected);
+  }
+}
+
+TEST(OrderStatisticTree, Empty) {
+  int_tree tree;
+  EXPECT_TRUE(tree.empty());
+  EXPECT_EQ(tree.size(), 0u);
+  EXPECT_EQ(tree.count_prefix([](int) { return true; }), 0u);
+}
+
+TEST(OrderStatisticTree, Duplicates) {
+  int_tree tree;
+  std::multiset<int> ref;
+  for (int val : {5, 5, 3, 5, 7, 3}) {
+    tree.insert(val);
+    ref.insert(val);
+  }
+  expect_same(tree, ref);
+  tree.erase(5);
+  ref.erase(ref.find(5));
+  expect_same(tree, ref);
+  tree.erase(3);
+  tree.erase(3);
+  ref.erase(3);
+  expect_same(tree, ref);
+}
+
+TEST(OrderStatisticTree, RandomOperations) {
+  std::mt19937 gen(1234);
+  std::uniform_int_distribution<int> key(0, 100);
+  std::uniform_int_distribution<int> op(0, 2);
+  int_tree tree;
+  std::multiset<int> ref;
+  for (size_t round = 0; round < 3; ++round) {
+    for (size_t i = 0; i < 2000; ++i) {
+      // Inserts twice as often as it erases, so that the tree grows
+      if (op(gen) == 0 && !ref.empty()) {
+        auto it = ref.begin();
+        std::advance(it, std::uniform_int_distribution<size_t>(
+                           0, ref.size() - 1)(gen));
+        tree.erase(*it);
+        ref.erase(it);
+      } else {
+        int val = key(gen);
+        tree.insert(val);
+        ref.insert(val);
+      }
+      if (i % 100 == 0)
+        expect_same(tree, ref);
+    }
+    expect_same(tree, ref);
+    // Erase everything, the nodes are reused in the next round
+    while (!ref.empty()) {
+      tree.erase(*ref.begin());
+      ref.erase(ref.begin());
+    }
+    expect_same(tree, ref);
+  }
+  tree.insert(1);
+  tree.clear();
+  EXPECT_TRUE(tree.empty());
+}
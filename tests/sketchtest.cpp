@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <event_data.h>
+#include <gtest/gtest.h>
+#include <random>
+#include <sketches.h>
+#include <string>
+#include <vector>
+
+using common::event_data;
+using monitor::detail::sketch::distinct_count_sketch;
+using monitor::detail::sketch::quantile_sketch;
+
+// Three times the standard error of HyperLogLog with 2^10 registers
+static constexpr double DCNT_TOLERANCE = 0.1;
+
+static void expect_dcnt_near(const distinct_count_sketch &sketch, size_t n) {
+  auto expected = static_cast<double>(n);
+  EXPECT_NEAR(static_cast<double>(sketch.estimate()), expected,
+              std::max(1.0, DCNT_TOLERANCE * expected))
+    << n << " distinct values";
+}
+
+static void expect_quantiles_near(const quantile_sketch &sketch,
+                                  std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  for (double q : {0.0, 0.1, 0.25, 0.5, 0.75, 0.9, 1.0}) {
+    auto rank = static_cast<size_t>(q * static_cast<double>(values.size() - 1));
+    double expected = values[rank];
+    double actual = sketch.quantile(q).to_double();
+    EXPECT_NEAR(actual, expected,
+                quantile_sketch::RELATIVE_ACCURACY * std::abs(expected) + 1e-9)
+      << "quantile " << q;
+  }
+}
+
+TEST(Sketch, DistinctCountErrorBound) {
+  for (size_t n : {1u, 10u, 100u, 1000u, 10000u, 100000u}) {
+    distinct_count_sketch ints, strings;
+    // Every value is added twice, duplicates must not be counted
+    for (size_t rep = 0; rep < 2; ++rep) {
+      for (size_t i = 0; i < n; ++i) {
+        ints.add(event_data::Int(static_cast<int64_t>(i)));
+        strings.add(event_data::String("dcnt-" + std::to_string(i)));
+      }
+    }
+    expect_dcnt_near(ints, n);
+    expect_dcnt_near(strings, n);
+    // Removing one copy keeps the value, removing both drops it
+    for (size_t i = 0; i < n; ++i)
+      ints.remove(event_data::Int(static_cast<int64_t>(i)));
+    expect_dcnt_near(ints, n);
+    for (size_t i = n / 2; i < n; ++i)
+      ints.remove(event_data::Int(static_cast<int64_t>(i)));
+    expect_dcnt_near(ints, n / 2);
+  }
+  distinct_count_sketch empty;
+  EXPECT_EQ(empty.estimate(), 0);
+}
+
+TEST(Sketch, QuantileErrorBound) {
+  std::mt19937 gen(7);
+  std::lognormal_distribution<double> magnitude(0.0, 3.0);
+  std::bernoulli_distribution negative(0.3), zero(0.05);
+  // Alternate between ints and floats, both are ranked by their value
+  auto to_event = [](size_t i, double x) {
+    return i % 2 == 0 ? event_data::Int(static_cast<int64_t>(x))
+                      : event_data::Float(x);
+  };
+  quantile_sketch sketch;
+  std::vector<double> values;
+  for (size_t i = 0; i < 5001; ++i) {
+    double x = zero(gen) ? 0.0 : magnitude(gen);
+    if (negative(gen))
+      x = -x;
+    if (i % 2 == 0)
+      x = std::trunc(x);
+    values.push_back(x);
+    sketch.add(to_event(i, x));
+  }
+  expect_quantiles_near(sketch, values);
+  // Remove the first half again
+  size_t half = values.size() / 2;
+  for (size_t i = 0; i < half; ++i)
+    sketch.remove(to_event(i, values[i]));
+  expect_quantiles_near(sketch,
+                        std::vector<double>(values.begin() + half,
+                                            values.end()));
+}
+
+TEST(Sketch, QuantileRanksNaNFirst) {
+  quantile_sketch sketch;
+  sketch.add(event_data::nan());
+  sketch.add(event_data::Float(2.0));
+  sketch.add(event_data::Float(-1.0));
+  EXPECT_TRUE(std::isnan(sketch.quantile(0.0).to_double()));
+  EXPECT_NEAR(sketch.quantile(0.5).to_double(), -1.0, 0.01);
+  EXPECT_NEAR(sketch.quantile(1.0).to_double(), 2.0, 0.02);
+  sketch.remove(event_data::nan());
+  EXPECT_NEAR(sketch.quantile(0.0).to_double(), -1.0, 0.01);
+}
+
+TEST(Sketch, StringHashIsFixed) {
+  // the hash, and so any estimate, does not depend on the platform or run
+  EXPECT_EQ(monitor::detail::sketch::hash_value(event_data::String("monitor")),
+            0xf51f0dbfc097782eu);
+}
@@ -1,6 +1,11 @@
+#include <columnar_storage.h>
+#include <event_data.h>
 #include <fmt/format.h>
 #include <gtest/gtest.h>
+#include <string>
+#include <symbol_table.h>
 #include <table.h>
+#include <task_pool.h>
 
 TEST(Table, Equality) {
   {
@@ -234,4 +239,122 @@ TEST(Table, AntiJoin) {
     tab1.anti_join_in_place(tab2, info);
     EXPECT_TRUE(tab1.equal_to(tab3, id_permutation(4)));
   }
-}
\ No newline at end of file
+}
+
+TEST(Table, Columnar) {
+  using common::event_data;
+  using col_table = table<event_data, columnar_storage>;
+  auto I = [](int64_t i) { return event_data::Int(i); };
+  auto S = [](const char *s) { return event_data::String(s); };
+  {
+    col_table t1(2, {{I(1), S("a")}, {I(2), S("b")}, {I(1), S("a")}}),
+      t2(2, {{S("b"), I(2)}, {S("a"), I(1)}});
+    EXPECT_EQ(t1.tab_size(), 2u);
+    EXPECT_TRUE(t1.equal_to(t2, find_permutation({1, 2}, {2, 1})));
+  }
+  {
+    table_layout l1 = {1, 2}, l2 = {2, 3};
+    auto info = get_join_info(l1, l2);
+    col_table tab1(2, {{I(1), S("a")}, {I(2), S("b")}}),
+      tab2(2, {{S("a"), event_data::Float(0.5)}, {S("c"), I(3)}}),
+      tab3(3, {{I(1), S("a"), event_data::Float(0.5)}});
+    auto res = tab1.natural_join(tab2, info);
+    ASSERT_TRUE(res);
+    EXPECT_TRUE(res->equal_to(tab3, id_permutation(3)));
+  }
+  {
+    // Mixed types within a column and -0.0 == 0.0
+    table_layout l1 = {1}, l2 = {1};
+    auto info = get_anti_join_info(l1, l2);
+    col_table tab1(1, {{I(1)}, {event_data::Float(0.0)}, {S("x")}}),
+      tab2(1, {{event_data::Float(-0.0)}}), tab3(1, {{I(1)}, {S("x")}});
+    tab1.anti_join_in_place(tab2, info);
+    EXPECT_TRUE(tab1.equal_to(tab3, id_permutation(1)));
+  }
+}
+
+TEST(Table, InternedStringsAreFreed) {
+  using common::event_data;
+  using common::symbol_table;
+  using col_table = table<event_data, columnar_storage>;
+  auto S = [](const char *s) { return event_data::String(s); };
+  size_t before = symbol_table::size();
+  {
+    col_table t1(1);
+    t1.add_row({S("interned-1")});
+    t1.add_row({S("interned-2")});
+    EXPECT_EQ(symbol_table::size(), before + 2);
+    auto t2 = t1;
+    auto s = S("interned-1");
+    t1 = col_table(1);
+    EXPECT_EQ(symbol_table::size(), before + 2);
+    {
+      col_table t3(1, {{S("interned-2")}});
+      t2.anti_join_in_place(t3, get_anti_join_info({1}, {1}));
+    }
+    EXPECT_EQ(symbol_table::size(), before + 1);
+    t2 = col_table(1);
+    EXPECT_EQ(symbol_table::size(), before + 1);
+    EXPECT_EQ(s, S("interned-1"));
+  }
+  EXPECT_EQ(symbol_table::size(), before);
+}
+
+TEST(Table, CopiesAreIndependent) {
+  table<int> t1(2, {{1, 2}, {3, 4}});
+  auto t2 = t1;
+  t2.add_row({5, 6});
+  EXPECT_EQ(t1.tab_size(), 2u);
+  EXPECT_EQ(t2.tab_size(), 3u);
+  auto t3 = t2;
+  t3.anti_join_in_place(table<int>(1, {{1}}), get_anti_join_info({1, 2}, {1}));
+  EXPECT_EQ(t2.tab_size(), 3u);
+  EXPECT_EQ(t3.tab_size(), 2u);
+  EXPECT_FALSE(t3.contains({1, 2}));
+  t3.erase_rows_if([](const auto &row) { return row[0] == 3; });
+  EXPECT_EQ(t3.tab_size(), 1u);
+  EXPECT_EQ(t2.tab_size(), 3u);
+  // Taking the rows of a copy leaves the original alone
+  auto t4 = t1;
+  auto rows = table<int>::hash_all_destructive(t4);
+  EXPECT_EQ(rows.size(), 2u);
+  EXPECT_TRUE(t4.empty());
+  EXPECT_EQ(t1.tab_size(), 2u);
+}
+
+template<typename Tab>
+void expect_parallel_join_matches_sequential() {
+  using common::event_data;
+  auto I = [](int64_t i) { return event_data::Int(i); };
+  // 9100 rows in total, above the threshold for the partitioned join, and
+  // four to five matches per key
+  Tab tab1(2), tab2(2);
+  for (int64_t i = 0; i < 5000; ++i)
+    tab1.add_row({I(i), I(i % 1000)});
+  // some partitions of the result then mix column types
+  for (int64_t i = 0; i < 100; ++i)
+    tab1.add_row({event_data::String("s" + std::to_string(i)), I(i)});
+  for (int64_t j = 0; j < 4000; ++j)
+    tab2.add_row({I(j % 1000), I(-j)});
+  auto info = get_join_info({1, 2}, {2, 3}),
+       info_swapped = get_join_info({2, 3}, {1, 2});
+  common::task_pool::set_global_threads(1);
+  auto sequential = tab1.natural_join(tab2, info);
+  common::task_pool::set_global_threads(4);
+  auto parallel = tab1.natural_join(tab2, info);
+  auto parallel_swapped = tab2.natural_join(tab1, info_swapped);
+  common::task_pool::set_global_threads(1);
+  ASSERT_TRUE(sequential && parallel && parallel_swapped);
+  EXPECT_EQ(sequential->tab_size(), 20400u);
+  EXPECT_TRUE(parallel->equal_to(*sequential, id_permutation(3)));
+  EXPECT_TRUE(parallel_swapped->equal_to(
+    *sequential,
+    find_permutation(info_swapped.result_layout, info.result_layout)));
+}
+
+TEST(Table, PartitionedJoinMatchesSequential) {
+  using common::event_data;
+  expect_parallel_join_matches_sequential<table<event_data>>();
+  expect_parallel_join_matches_sequential<
+    table<event_data, columnar_storage>>();
+}
@@ -0,0 +1,131 @@
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <task_pool.h>
+#include <thread>
+#include <vector>
+
+using common::task_pool;
+
+namespace {
+// Waits until flag is set or a few seconds have passed, returns the flag
+bool wait_until_set(const std::atomic<bool> &flag) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!flag.load() && std::chrono::steady_clock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  return flag.load();
+}
+
+size_t fib(task_pool &pool, size_t n) {
+  if (n < 2)
+    return n;
+  size_t a = 0, b = 0;
+  pool.fork_join([&]() { a = fib(pool, n - 1); },
+                 [&]() { b = fib(pool, n - 2); });
+  return a + b;
+}
+}// namespace
+
+TEST(TaskPool, ForkedTaskIsStolen) {
+  task_pool pool(2);
+  std::atomic<bool> f2_done = false;
+  std::thread::id f2_thread;
+  // f1 only returns once f2 ran, so a worker must have stolen f2
+  pool.fork_join([&]() { EXPECT_TRUE(wait_until_set(f2_done)); },
+                 [&]() {
+                   f2_thread = std::this_thread::get_id();
+                   f2_done = true;
+                 });
+  EXPECT_NE(f2_thread, std::this_thread::get_id());
+}
+
+TEST(TaskPool, OwnerWakesUpWhenStolenTaskFinishes) {
+  task_pool pool(2);
+  for (size_t round = 0; round < 100; ++round) {
+    std::atomic<bool> f2_started = false;
+    bool f2_done = false;
+    // f1 returns once f2 was stolen, so the owner waits for the worker
+    pool.fork_join([&]() { EXPECT_TRUE(wait_until_set(f2_started)); },
+                   [&]() {
+                     f2_started = true;
+                     std::this_thread::sleep_for(std::chrono::microseconds(50));
+                     f2_done = true;
+                   });
+    EXPECT_TRUE(f2_done);
+  }
+}
+
+TEST(TaskPool, SleepingWorkersWakeUp) {
+  task_pool pool(3);
+  for (size_t round = 0; round < 3; ++round) {
+    // give the workers time to go to sleep
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    std::atomic<bool> f2_done = false;
+    pool.fork_join([&]() { EXPECT_TRUE(wait_until_set(f2_done)); },
+                   [&]() { f2_done = true; });
+  }
+}
+
+TEST(TaskPool, ExceptionsAreRethrown) {
+  task_pool pool(2);
+  std::atomic<bool> f2_ran = false;
+  EXPECT_THROW(pool.fork_join([]() { throw std::runtime_error("f1"); },
+                              [&]() { f2_ran = true; }),
+               std::runtime_error);
+  // f2 is still executed and joined if f1 throws
+  EXPECT_TRUE(f2_ran);
+  EXPECT_THROW(pool.fork_join([]() {},
+                              []() { throw std::invalid_argument("f2"); }),
+               std::invalid_argument);
+  // the exception of f1 wins
+  EXPECT_THROW(pool.fork_join([]() { throw std::runtime_error("f1"); },
+                              []() { throw std::invalid_argument("f2"); }),
+               std::runtime_error);
+  // the pool is still usable
+  EXPECT_EQ(fib(pool, 10), 55u);
+}
+
+TEST(TaskPool, NestedForks) {
+  for (size_t num_threads : {1, 2, 4}) {
+    task_pool pool(num_threads);
+    EXPECT_EQ(fib(pool, 20), 6765u);
+    EXPECT_THROW(pool.fork_join([&]() { fib(pool, 10); },
+                                [&]() {
+                                  pool.fork_join(
+                                    [&]() { fib(pool, 8); },
+                                    []() { throw std::runtime_error("nested"); });
+                                }),
+                 std::runtime_error);
+  }
+}
+
+TEST(TaskPool, ParallelForCoversRange) {
+  task_pool pool(4);
+  for (size_t grain : {1, 7, 100, 5000}) {
+    std::vector<std::atomic<int>> visited(1000);
+    pool.parallel_for(0, visited.size(), grain, [&](size_t lo, size_t hi) {
+      EXPECT_LT(lo, hi);
+      EXPECT_TRUE(hi - lo >= grain || hi - lo == visited.size());
+      for (size_t i = lo; i < hi; ++i)
+        visited[i]++;
+    });
+    for (const auto &count : visited)
+      EXPECT_EQ(count.load(), 1);
+  }
+}
+
+TEST(TaskPool, GlobalPool) {
+  task_pool::set_global_threads(3);
+  ASSERT_NE(task_pool::global(), nullptr);
+  EXPECT_EQ(task_pool::global()->num_threads(), 3u);
+  std::atomic<size_t> sum = 0;
+  common::parallel_for(100, 10, [&](size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; ++i)
+      sum += i;
+  });
+  EXPECT_EQ(sum.load(), 4950u);
+  task_pool::set_global_threads(1);
+  EXPECT_EQ(task_pool::global(), nullptr);
+}